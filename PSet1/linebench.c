@@ -0,0 +1,89 @@
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <time.h>
+# include "linecount.h"
+
+// linebench.c
+// By: Jeffrey Wong
+/* Microbenchmark for meow's newline counting. Fills a buffer with text-like data and times the
+original byte-at-a-time loop from meow against each SIMD variant this CPU supports, checking that
+every variant agrees with the original count. Sizes default to 1 MB, 100 MB and 1 GB; pass sizes
+in MB as arguments to override. */
+
+#define REPEAT_BYTES (2L << 30) // Small inputs are repeated until at least this much has been scanned
+
+// The loop meow used before linecount.c, so we measure against what it actually did. Its int index is a size_t
+// here, since an int would overflow on the 1 GB buffer.
+long long originalLoop(const char *buf, size_t len){
+    long long lineswritten = 0;
+    for(size_t i = 0; i < len; i++){
+        if(buf[i] == '\n'){lineswritten++;}
+    }
+    return lineswritten;
+}
+
+size_t originalVariant(const char *buf, size_t len){
+    return (size_t)originalLoop(buf, len);
+}
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs fn over buf enough times to get a stable reading and prints MB/s. Returns the count from the last pass.
+size_t timeVariant(const char *name, size_t (*fn)(const char *, size_t), const char *buf, size_t len){
+    long reps = REPEAT_BYTES / len;
+    if(reps < 1){reps = 1;}
+    size_t count = 0;
+    double start = now();
+    for(long r = 0; r < reps; r++){
+        count = fn(buf, len);
+        __asm__ volatile("" : : "r"(count) : "memory"); // Keeps the compiler from hoisting the call out of the loop
+    }
+    double elapsed = now() - start;
+    printf("  %-10s %10.1f MB/s  (%zu newlines)\n", name, (double)len * reps / elapsed / 1e6, count);
+    return count;
+}
+
+int main(int argc, char *argv[]){
+    long defaults[] = {1, 100, 1000};
+    int nsizes = argc > 1 ? argc - 1 : 3;
+    const char *names[] = {"scalar", "sse2", "avx2", "avx512"};
+    size_t (*fns[])(const char *, size_t) = {countNewlinesScalar, countNewlinesSSE2, countNewlinesAVX2, countNewlinesAVX512};
+    int failures = 0;
+
+    printf("countNewlines dispatches to: %s\n", countNewlinesImpl());
+    for(int s = 0; s < nsizes; s++){
+        long mb = argc > 1 ? strtol(argv[s+1], NULL, 10) : defaults[s];
+        size_t len = (size_t)mb * 1000000;
+        char *buf = malloc(len);
+        if(!buf){
+            fprintf(stderr, "Skipping %ld MB: could not allocate buffer: %s\n", mb, strerror(errno));
+            continue;
+        }
+        // Each byte ends a line with probability 1/60, so line lengths are geometric with a mean of 60 bytes and no upper
+        // bound, roughly what our logs look like
+        srand(357);
+        for(size_t i = 0; i < len; i++){
+            buf[i] = (rand() % 60 == 0) ? '\n' : 'a' + rand() % 26;
+        }
+        printf("%ld MB input:\n", mb);
+        size_t expected = timeVariant("original", originalVariant, buf, len);
+        for(int v = 0; v < 4; v++){
+            if(!countNewlinesSupported(names[v])){
+                printf("  %-10s not supported on this CPU\n", names[v]);
+                continue;
+            }
+            if(timeVariant(names[v], fns[v], buf, len) != expected){
+                fprintf(stderr, "MISMATCH: %s disagrees with the original loop on %ld MB\n", names[v], mb);
+                failures++;
+            }
+        }
+        free(buf);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+# include "linecount.h"
+# include <string.h>
+# if defined(__x86_64__)
+# include <immintrin.h>
+# define LINECOUNT_X86
+# endif
+
+// The variant countNewlines hands off to, picked on the first call
+static size_t (*chosen)(const char *, size_t) = NULL;
+static const char *chosenname = "scalar";
+
+size_t countNewlinesScalar(const char *buf, size_t len){
+    size_t count = 0;
+    for(size_t i = 0; i < len; i++){
+        if(buf[i] == '\n'){count++;}
+    }
+    return count;
+}
+
+#ifdef LINECOUNT_X86
+
+/* The SSE2 and AVX2 kernels compare a whole vector against '\n' and subtract the result (0 or -1 per byte)
+from a byte-wide accumulator. Each byte lane can only hold 255 before it wraps, so every 255 vectors
+the accumulator is summed horizontally with psadbw into 64-bit lanes and reset. */
+
+__attribute__((target("sse2")))
+size_t countNewlinesSSE2(const char *buf, size_t len){
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    size_t i = 0;
+    while(len - i >= 16){
+        __m128i acc = zero;
+        size_t blocks = (len - i) / 16;
+        if(blocks > 255){blocks = 255;}
+        for(size_t b = 0; b < blocks; b++, i += 16){
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+    }
+    size_t count = (size_t)_mm_cvtsi128_si64(total) + (size_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+    return count + countNewlinesScalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t countNewlinesAVX2(const char *buf, size_t len){
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+    while(len - i >= 32){
+        __m256i acc = zero;
+        size_t blocks = (len - i) / 32;
+        if(blocks > 255){blocks = 255;}
+        for(size_t b = 0; b < blocks; b++, i += 32){
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+    }
+    size_t count = (size_t)_mm256_extract_epi64(total, 0) + (size_t)_mm256_extract_epi64(total, 1)
+                 + (size_t)_mm256_extract_epi64(total, 2) + (size_t)_mm256_extract_epi64(total, 3);
+    return count + countNewlinesSSE2(buf + i, len - i); // Tail is under 32 bytes, SSE2 is always present alongside AVX2
+}
+
+// AVX-512BW compares straight into a 64-bit mask register, so a popcount per vector is all we need
+__attribute__((target("avx512f,avx512bw,popcnt")))
+size_t countNewlinesAVX512(const char *buf, size_t len){
+    const __m512i nl = _mm512_set1_epi8('\n');
+    size_t count = 0, i = 0;
+    for(; len - i >= 64; i += 64){
+        __m512i v = _mm512_loadu_si512((const void *)(buf + i));
+        count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(v, nl));
+    }
+    if(i < len){
+        __mmask64 tail = (1ULL << (len - i)) - 1; // Masked load so we never touch bytes past the end of buf
+        __m512i v = _mm512_maskz_loadu_epi8(tail, (const void *)(buf + i));
+        count += _mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(tail, v, nl));
+    }
+    return count;
+}
+
+int countNewlinesSupported(const char *name){
+    __builtin_cpu_init();
+    if(!strcmp(name, "scalar")){return 1;}
+    if(!strcmp(name, "sse2")){return __builtin_cpu_supports("sse2");}
+    if(!strcmp(name, "avx2")){return __builtin_cpu_supports("avx2");}
+    if(!strcmp(name, "avx512")){return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt");}
+    return 0;
+}
+
+#else
+
+// Without x86 SIMD every variant is the scalar loop
+size_t countNewlinesSSE2(const char *buf, size_t len){return countNewlinesScalar(buf, len);}
+size_t countNewlinesAVX2(const char *buf, size_t len){return countNewlinesScalar(buf, len);}
+size_t countNewlinesAVX512(const char *buf, size_t len){return countNewlinesScalar(buf, len);}
+
+int countNewlinesSupported(const char *name){
+    return !strcmp(name, "scalar");
+}
+
+#endif
+
+static void pickVariant(void){
+    if(countNewlinesSupported("avx512")){
+        chosen = countNewlinesAVX512;
+        chosenname = "avx512";
+    }
+    else if(countNewlinesSupported("avx2")){
+        chosen = countNewlinesAVX2;
+        chosenname = "avx2";
+    }
+    else if(countNewlinesSupported("sse2")){
+        chosen = countNewlinesSSE2;
+        chosenname = "sse2";
+    }
+    else{
+        chosen = countNewlinesScalar;
+        chosenname = "scalar";
+    }
+}
+
+size_t countNewlines(const char *buf, size_t len){
+    if(!chosen){pickVariant();}
+    return chosen(buf, len);
+}
+
+const char *countNewlinesImpl(void){
+    if(!chosen){pickVariant();}
+    return chosenname;
+}
@@ -0,0 +1,29 @@
+#ifndef _LINECOUNT_H
+#define _LINECOUNT_H
+
+#include <stddef.h>
+
+size_t countNewlines(const char *buf, size_t len);
+/* Returns the number of '\n' bytes in buf[0..len). The first call picks the
+* widest variant the CPU supports (AVX-512, AVX2, SSE2, then scalar) using
+* CPUID, and every later call goes straight to that variant.
+*/
+
+const char *countNewlinesImpl(void);
+/* Returns the name of the variant countNewlines dispatches to.
+*/
+
+size_t countNewlinesScalar(const char *buf, size_t len);
+size_t countNewlinesSSE2(const char *buf, size_t len);
+size_t countNewlinesAVX2(const char *buf, size_t len);
+size_t countNewlinesAVX512(const char *buf, size_t len);
+/* The individual variants, exposed for benchmarking. Only call a SIMD variant
+* after checking countNewlinesSupported, otherwise it will raise SIGILL.
+*/
+
+int countNewlinesSupported(const char *name);
+/* Returns 1 if the variant called name ("scalar", "sse2", "avx2" or "avx512")
+* can run on this CPU, 0 otherwise.
+*/
+
+#endif
@@ -1,28 +1,209 @@
+#define _GNU_SOURCE
+
 # include <stdio.h>
 # include <stdlib.h>
+# include <string.h>
 # include <ctype.h>
 # include <errno.h>
 # include <fcntl.h>
 # include <unistd.h>
+# include <time.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <sys/sendfile.h>
+# include "linecount.h"
+# include "ringcopy.h"
+# include "prefetch.h"
 
 // meow.c
 // By: Jeffrey Wong
 /* This program mimics the functionality of cat- it allows users to write any number of files
 (or from standard input) to a specified output file (standard output if not specified) */
 
-int main(int argc, char* argv[]){
+// Transfer methods, from cheapest to most expensive. Everything except XFER_READWRITE stays inside the kernel.
+#define XFER_COPYRANGE 0 // copy_file_range: regular file to regular file
+#define XFER_SENDFILE 1 // sendfile: regular file to pipe or socket
+#define XFER_SPLICE 2 // splice: pipe to pipe (or pipe to anything else)
+#define XFER_READWRITE 3 // The original read/write loop through a user buffer
+
+#define XFER_CHUNK (1 << 30) // Largest single request handed to the kernel copy calls
+#define MAP_WINDOW (256L << 20) // Size of each mmap window used when counting lines on the side
+
+// Chooses how to move bytes from infd to outfd based on what kind of files they are.
+// Anything we can't move without looking at the bytes falls back to the read/write loop.
+int pickMethod(struct stat *instats, struct stat *outstats, int countlines){
+    if(S_ISREG(instats->st_mode)){
+        if(S_ISREG(outstats->st_mode)){return XFER_COPYRANGE;}
+        if(S_ISFIFO(outstats->st_mode) || S_ISSOCK(outstats->st_mode)){return XFER_SENDFILE;}
+        return XFER_READWRITE;
+    }
+    // Pipes have no page cache we could map afterwards, so we only bypass userspace if nobody wants the lines counted
+    if(S_ISFIFO(instats->st_mode) && !countlines){
+        return XFER_SPLICE;
+    }
+    return XFER_READWRITE;
+}
+
+// Errors that mean "the kernel won't do this particular copy for us" rather than a genuine I/O failure
+int isRefusal(int err){
+    return err == EINVAL || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP || err == EBADF || err == ETXTBSY || err == EPERM;
+}
+
+// Moves bytes from infd to outfd using one of the in-kernel copy calls until EOF. The amount moved is added to *bytes.
+// Returns 0 on EOF, 1 if the kernel refused the method (caller should finish with the read/write loop), or -1 on error.
+int kernelCopy(int infd, int outfd, int method, long long *bytes){
+    ssize_t n;
+    for(;;){
+        switch(method){
+            case XFER_COPYRANGE:
+                n = copy_file_range(infd, NULL, outfd, NULL, XFER_CHUNK, 0);
+                break;
+            case XFER_SENDFILE:
+                n = sendfile(outfd, infd, NULL, XFER_CHUNK);
+                break;
+            default:
+                n = splice(infd, NULL, outfd, NULL, XFER_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+                break;
+        }
+        if(n == 0){return 0;}
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            if(isRefusal(errno)){
+                errno = 0;
+                return 1;
+            }
+            return -1;
+        }
+        *bytes += n;
+    }
+}
+
+// Side path for line counting after an in-kernel copy: maps the bytes we just transferred and counts the newlines.
+// Returns the number of newlines in [start, start+len) of infd, or -1 if the file could not be mapped.
+long long countLinesMapped(int infd, off_t start, long long len){
+    long long newlines = 0;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    while(len > 0){
+        off_t mapstart = start - (start % pagesize); // mmap offsets must be page aligned
+        size_t skip = start - mapstart;
+        size_t span = len > MAP_WINDOW ? MAP_WINDOW : len;
+        char *map = mmap(NULL, span + skip, PROT_READ, MAP_PRIVATE, infd, mapstart);
+        if(map == MAP_FAILED){return -1;}
+        madvise(map, span + skip, MADV_SEQUENTIAL);
+        newlines += countNewlines(map + skip, span);
+        munmap(map, span + skip);
+        start += span;
+        len -= span;
+    }
+    return newlines;
+}
+
+// The original transfer loop: reads a block into buf, counts its lines, and writes it out.
+// Returns 0 on EOF, 1 if reading failed (reported here), or -1 if writing failed (reported here).
+int copyLoop(int infd, char *infile, int outfd, char *outfile, char *buf, size_t bufsize, int countlines, long long *bytes, long long *lines){
+    int j = 0;
+    while((j = read(infd, buf, bufsize)) > 0){
+        if(countlines){*lines += countNewlines(buf, j);}
+        int k = write(outfd, buf, j);
+        if(k < 0){
+            fprintf(stderr, "Error attempting to write to file %s: %s\n", outfile, strerror(errno));
+            return -1;
+        }
+        // Handling a "parital write" if bytes written < bytes read
+        if(k < j && k > 0){
+            int remainder = j - k;
+            while(remainder > 0){
+                int kk = write(outfd, buf + (j - remainder), remainder); // Pick up from the first byte that didn't make it out
+                if(kk < 0){
+                    fprintf(stderr, "Error attempting to write to file %s: %s\n", outfile, strerror(errno));
+                    return -1;
+                }
+                if(kk == 0){break;}
+                remainder -= kk;
+            }
+        }
+        *bytes += j;
+    }
+    if(j < 0){
+        fprintf(stderr, "Error occured while reading file %s: %s\n", infile, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+// Sends one already-opened input file to outfd with the cheapest method that works and prints its summary.
+// The bytes transferred are added to *total. Returns -1 on a fatal error (already reported), 0 otherwise.
+int catFile(int infd, char *infile, int outfd, char *outfile, struct stat *outstats, int countlines, int depth, long long *total){
     char buf[4096];
+    struct stat instats;
+    memset(buf,0,sizeof(buf)); // Empties out the buffer upon processing a new input file
+    long long byteswritten = 0;
+    long long lineswritten = 1; // There is always a first line even without a newline so we start the count at 1
+    int method = XFER_READWRITE;
+    if(fstat(infd, &instats) == 0){
+        method = pickMethod(&instats, outstats, countlines);
+        // Copying a file onto itself with the kernel calls would loop forever, let the read/write loop behave like cat does
+        if(instats.st_dev == outstats->st_dev && instats.st_ino == outstats->st_ino){
+            method = XFER_READWRITE;
+        }
+    }
+
+    int result = 1;
+    if(method != XFER_READWRITE){
+        off_t start = lseek(infd, 0, SEEK_CUR); // stdin may already be partway into a file
+        if((result = kernelCopy(infd, outfd, method, &byteswritten)) < 0){
+            fprintf(stderr, "Error attempting to write to file %s: %s\n", outfile, strerror(errno));
+            return -1;
+        }
+        if(countlines && byteswritten > 0){
+            long long newlines = countLinesMapped(infd, start, byteswritten);
+            if(newlines < 0){
+                fprintf(stderr, "Error attempting to map file %s for line counting: %s\n", infile, strerror(errno));
+                errno = 0;
+            }
+            else{
+                lineswritten += newlines;
+            }
+        }
+    }
+    // Either the file types need the loop, or the kernel refused partway through. The file offsets tell us where to resume.
+    if(result == 1){
+        if(depth > 0){
+            // Large blocks with the next read overlapping the current write
+            if(ringCopy(infd, infile, outfd, outfile, depth, countlines, &byteswritten, &lineswritten) < 0){
+                return -1;
+            }
+        }
+        else if(copyLoop(infd, infile, outfd, outfile, buf, sizeof(buf), countlines, &byteswritten, &lineswritten) < 0){
+            return -1;
+        }
+    }
+    if(countlines){
+        fprintf(stderr, "File %s finished reading. %lld bytes transferred, %lld lines read.\n", infile, byteswritten, lineswritten);
+    }
+    else{
+        fprintf(stderr, "File %s finished reading. %lld bytes transferred.\n", infile, byteswritten);
+    }
+    *total += byteswritten;
+    return 0;
+}
+
+int main(int argc, char* argv[]){
     // Variables for output file
     char *outfile = "<standard output>";
     int outfd = 1;
+    struct stat outstats;
     // Variables for input file
     char *infile;
     int infd;
+    int countlines = 1; // -n turns off line counting so pipe inputs can be spliced too
+    int depth = 0; // -q sets how many blocks the pipelined copy keeps in flight, 0 keeps the plain loop
+    int workers = 0; // -p sets how many files are opened and read ahead in parallel, 0 opens each one when it's reached
 
-    // Checking for -o flag and specifying output file
+    // Checking for -o, -n, -q and -p flags
     // Argument parsing thanks to https://www.gnu.org/software/libc/manual/html_node/Example-of-Getopt.html
     int c;
-    if((c = getopt(argc, argv, "o:")) >= 0){ // We only need to scan for one flag this time, multiple times would require a while loop
+    while((c = getopt(argc, argv, "o:nq:p:")) >= 0){
         switch(c){
             case 'o':
                 outfile = optarg;
@@ -31,9 +212,30 @@ int main(int argc, char* argv[]){
                     return -1;
                 }
                 break;
+            case 'n':
+                countlines = 0;
+                break;
+            case 'q':
+                depth = strtol(optarg, NULL, 10);
+                if(depth < 1 || depth > RING_MAX_DEPTH){
+                    fprintf(stderr, "Queue depth must be between 1 and %d.\n", RING_MAX_DEPTH);
+                    return -1;
+                }
+                break;
+            case 'p':
+                workers = strtol(optarg, NULL, 10);
+                if(workers < 1 || workers > PREFETCH_MAX_WORKERS){
+                    fprintf(stderr, "Prefetch worker count must be between 1 and %d.\n", PREFETCH_MAX_WORKERS);
+                    return -1;
+                }
+                break;
             case '?':
                 if(optopt == 'o')
                     fprintf(stderr, "No file name specified for output.\n");
+                else if(optopt == 'q')
+                    fprintf(stderr, "No queue depth specified.\n");
+                else if(optopt == 'p')
+                    fprintf(stderr, "No prefetch worker count specified.\n");
                 else
                     fprintf(stderr, "Unknown option character entered.\n");
                 return -1;
@@ -43,52 +245,52 @@ int main(int argc, char* argv[]){
                 return -1;
         }
     }
+    if(fstat(outfd, &outstats) < 0){
+        fprintf(stderr, "Error attempting to stat output file %s: %s\n", outfile, strerror(errno));
+        return -1;
+    }
 
     // Checking and reading from input files
+    struct prefetch pf;
+    if(workers > 0 && prefetchStart(&pf, argv + optind, argc - optind, workers) < 0){
+        fprintf(stderr, "Could not start prefetch workers, reading files one at a time: %s\n", strerror(errno));
+        workers = 0;
+    }
+    long long totalbytes = 0;
+    struct timespec starttime, endtime;
+    clock_gettime(CLOCK_MONOTONIC, &starttime);
     for(int i = optind; i < argc; i++){
-        memset(buf,0,sizeof(buf)); // Empties out the buffer upon processing a new input file
-        int byteswritten = 0;
-        int lineswritten = 1; // There is always a first line even without a newline so we start the count at 1
         if(!(strcmp(argv[i],"-"))){
             infile = "<standard input>";
             infd = 0;
         }
         else{
             infile = argv[i];
-            if((infd = open(infile, O_RDONLY, 0666)) < 0){
+            int err = 0;
+            // With -p the file was opened (and its first chunk read ahead) by a worker while earlier files were being copied
+            infd = workers > 0 ? prefetchTake(&pf, i - optind, &err) : open(infile, O_RDONLY, 0666);
+            if(infd < 0){
+                if(workers > 0){
+                    errno = err;
+                }
                 fprintf(stderr, "Error attempting to open file %s for reading: %s\n", infile, strerror(errno));
+                if(workers > 0){prefetchStop(&pf);}
                 return -1;
             }
         }
-        int j = 0;
-        while((j = read(infd, buf, sizeof(buf))) > 0){
-            for(int i = 0; i < j; i++){
-                if(buf[i] == '\n'){lineswritten++;}
-            }
-            int k = write(outfd, buf, j);
-            if(k < 0){
-                fprintf(stderr, "Error attempting to write to file %s: %s\n", outfile, strerror(errno));
-                return -1;
-            }
-            // Handling a "parital write" if bytes written < bytes read
-            if(k < j && k > 0){
-                int remainder = j - k;
-                while(remainder > 0){
-                    int kk = write(outfd, buf, remainder);
-                    if(kk < 0){
-                        fprintf(stderr, "Error attempting to write to file %s: %s\n", outfile, strerror(errno));
-                        return -1;
-                    }
-                    if(kk == 0){break;}
-                    remainder -= kk;
-                }
-            }
-            byteswritten += j;
-        }
-        if(j < 0){
-            fprintf(stderr, "Error occured while reading file %s: %s\n", infile, strerror(errno));
+        int result = catFile(infd, infile, outfd, outfile, &outstats, countlines, depth, &totalbytes);
+        if(infd != 0){close(infd);}
+        if(workers > 0){
+            if(result < 0){prefetchStop(&pf);}
+            else{prefetchDone(&pf, i - optind);}
         }
-        fprintf(stderr, "File %s finished reading. %d bytes transferred, %d lines read.\n", infile, byteswritten, lineswritten);
+        if(result < 0){return -1;}
+    }
+    if(workers > 0){
+        prefetchStop(&pf);
+        clock_gettime(CLOCK_MONOTONIC, &endtime);
+        double elapsed = (endtime.tv_sec - starttime.tv_sec) + (endtime.tv_nsec - starttime.tv_nsec) / 1e9;
+        fprintf(stderr, "Total: %lld bytes transferred from %d files in %.3f seconds (%.1f MB/s).\n", totalbytes, argc - optind, elapsed, elapsed > 0 ? totalbytes / elapsed / 1e6 : 0.0);
     }
     return 0;
-}
\ No newline at end of file
+}
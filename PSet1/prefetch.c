@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+
+# include "prefetch.h"
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+
+void *prefetchWorker(void *arg){
+    struct prefetch *p = arg;
+    for(;;){
+        pthread_mutex_lock(&p->lock);
+        // Stay within the window so we never hold more than a handful of files open ahead of the caller
+        while(!p->stop && p->nextclaim < p->nfiles && p->nextclaim >= p->consumed + p->window){
+            pthread_cond_wait(&p->changed, &p->lock);
+        }
+        if(p->stop || p->nextclaim >= p->nfiles){
+            pthread_mutex_unlock(&p->lock);
+            return NULL;
+        }
+        int k = p->nextclaim++;
+        pthread_mutex_unlock(&p->lock);
+
+        int fd = 0, err = 0;
+        if(strcmp(p->files[k], "-")){
+            if((fd = open(p->files[k], O_RDONLY)) < 0){
+                err = errno;
+            }
+            else{
+                struct stat st;
+                if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+                    off_t ahead = st.st_size < PREFETCH_BYTES ? st.st_size : PREFETCH_BYTES;
+                    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                    posix_fadvise(fd, 0, ahead, POSIX_FADV_WILLNEED);
+                    readahead(fd, 0, ahead); // Blocks this worker, not the caller, until the first chunk is on its way in
+                }
+            }
+        }
+
+        pthread_mutex_lock(&p->lock);
+        p->fds[k] = fd;
+        p->errs[k] = err;
+        p->ready[k] = 1;
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+int prefetchStart(struct prefetch *p, char **files, int nfiles, int workers){
+    if(workers < 1){workers = 1;}
+    if(workers > PREFETCH_MAX_WORKERS){workers = PREFETCH_MAX_WORKERS;}
+    memset(p, 0, sizeof(*p));
+    p->files = files;
+    p->nfiles = nfiles;
+    p->window = workers;
+    p->fds = calloc(nfiles + 1, sizeof(int));
+    p->errs = calloc(nfiles + 1, sizeof(int));
+    p->ready = calloc(nfiles + 1, 1);
+    p->threads = calloc(workers, sizeof(pthread_t));
+    if(!p->fds || !p->errs || !p->ready || !p->threads){
+        free(p->fds);
+        free(p->errs);
+        free(p->ready);
+        free(p->threads);
+        return -1;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+    for(int i = 0; i < workers; i++){
+        if((errno = pthread_create(&p->threads[i], NULL, prefetchWorker, p))){
+            if(i == 0){
+                prefetchStop(p);
+                return -1;
+            }
+            break; // Fewer workers than asked for still works
+        }
+        p->nthreads++;
+    }
+    return 0;
+}
+
+int prefetchTake(struct prefetch *p, int i, int *err){
+    pthread_mutex_lock(&p->lock);
+    while(!p->ready[i]){
+        pthread_cond_wait(&p->changed, &p->lock);
+    }
+    int fd = p->fds[i];
+    *err = p->errs[i];
+    p->fds[i] = -1; // The descriptor belongs to the caller now
+    pthread_mutex_unlock(&p->lock);
+    return fd;
+}
+
+void prefetchDone(struct prefetch *p, int i){
+    pthread_mutex_lock(&p->lock);
+    p->consumed = i + 1;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void prefetchStop(struct prefetch *p){
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+    for(int i = 0; i < p->nthreads; i++){
+        pthread_join(p->threads[i], NULL);
+    }
+    for(int i = 0; i < p->nfiles; i++){
+        if(p->ready[i] && p->fds[i] > 0){close(p->fds[i]);}
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->changed);
+    free(p->fds);
+    free(p->errs);
+    free(p->ready);
+    free(p->threads);
+}
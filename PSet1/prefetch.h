@@ -0,0 +1,49 @@
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+#include <pthread.h>
+
+#define PREFETCH_BYTES (32 << 20) // How much of each file a worker asks the kernel to read ahead
+#define PREFETCH_MAX_WORKERS 256
+
+struct prefetch{
+    char **files;
+    int nfiles;
+    int *fds; // Opened descriptor for each file, or -1 with the reason in errs
+    int *errs;
+    char *ready;
+    int nextclaim; // Next file a worker will open
+    int consumed; // Files the caller has finished with
+    int window; // Files allowed open ahead of the caller
+    int stop;
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+int prefetchStart(struct prefetch *p, char **files, int nfiles, int workers);
+/* Starts workers threads that open files[0..nfiles) in order, at most
+* workers files ahead of the caller, and hint the kernel to read each one
+* ahead (posix_fadvise SEQUENTIAL and WILLNEED, then readahead) so the
+* caller finds it in the page cache. "-" is left alone and handed back as
+* standard input. Returns 0 on success or -1 if the pool could not start.
+*/
+
+int prefetchTake(struct prefetch *p, int i, int *err);
+/* Blocks until file i has been opened and returns its descriptor. Returns
+* -1 with the open errno in *err if it could not be opened. Files must be
+* taken in order.
+*/
+
+void prefetchDone(struct prefetch *p, int i);
+/* Tells the pool the caller is finished with file i, letting the workers
+* move one file further ahead.
+*/
+
+void prefetchStop(struct prefetch *p);
+/* Stops and joins the workers and closes any descriptors opened but never
+* taken.
+*/
+
+#endif
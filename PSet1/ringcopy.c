@@ -0,0 +1,476 @@
+#define _GNU_SOURCE
+
+# include "ringcopy.h"
+# include "linecount.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <pthread.h>
+# include <poll.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+
+// Lifecycle of one block of the ring
+#define SLOT_FREE 0
+#define SLOT_READING 1
+#define SLOT_READY 2
+#define SLOT_WRITING 3
+
+#define URING_UNAVAILABLE 2 // Internal result telling ringCopy to fall back to threads
+
+struct slot{
+    char *buf;
+    off_t off; // Where the block starts in a seekable input
+    size_t want; // How much we asked for
+    size_t filled; // How much has actually been read into buf
+    size_t written; // How much of buf has reached outfd, so partial writes resume from the right place
+    int state;
+    int err; // errno of a failed read, 0 otherwise
+};
+
+struct ring{
+    struct slot slots[RING_MAX_DEPTH];
+    int depth;
+    size_t blocksize;
+    int seekable;
+};
+
+// Picks a block size that suits the input: big enough to amortize the syscalls over a large file,
+// the size of the pipe for pipes, and never more than the file could fill across the whole ring.
+size_t pickBlockSize(int infd, struct stat *instats, int depth){
+    long pagesize = sysconf(_SC_PAGESIZE);
+    size_t size = RING_MIN_BLOCK;
+    if(S_ISREG(instats->st_mode)){
+        size = instats->st_size / depth;
+    }
+    else if(S_ISFIFO(instats->st_mode)){
+        int pipesize = fcntl(infd, F_GETPIPE_SZ);
+        if(pipesize > 0){size = pipesize;}
+    }
+    else if(instats->st_blksize > 0){
+        size = instats->st_blksize * 16;
+    }
+    if(size < RING_MIN_BLOCK){size = RING_MIN_BLOCK;}
+    if(size > RING_MAX_BLOCK){size = RING_MAX_BLOCK;}
+    return (size + pagesize - 1) / pagesize * pagesize;
+}
+
+int ringInit(struct ring *r, int infd, int depth){
+    struct stat instats;
+    if(fstat(infd, &instats) < 0){return -1;}
+    if(depth < 1){depth = 1;}
+    if(depth > RING_MAX_DEPTH){depth = RING_MAX_DEPTH;}
+    memset(r, 0, sizeof(*r));
+    r->depth = depth;
+    r->blocksize = pickBlockSize(infd, &instats, depth);
+    r->seekable = S_ISREG(instats.st_mode) || S_ISBLK(instats.st_mode);
+    for(int i = 0; i < depth; i++){
+        if(posix_memalign((void **)&r->slots[i].buf, sysconf(_SC_PAGESIZE), r->blocksize)){
+            for(int j = 0; j < i; j++){free(r->slots[j].buf);}
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void ringFree(struct ring *r){
+    for(int i = 0; i < r->depth; i++){free(r->slots[i].buf);}
+}
+
+// ---------------------------------------------------------------------------------------------
+// io_uring path. There is no liburing on the machines we build on, so this talks to the raw syscalls.
+
+struct uring{
+    int fd;
+    unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqmap, *cqmap;
+    size_t sqmapsize, cqmapsize, sqesize;
+    unsigned pending; // SQEs queued but not yet handed to io_uring_enter
+};
+
+int uringSetup(struct uring *u, unsigned entries){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(u, 0, sizeof(*u));
+    if((u->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0){return -1;}
+    u->sqmapsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cqmapsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(u->cqmapsize > u->sqmapsize){u->sqmapsize = u->cqmapsize;}
+        u->cqmapsize = 0;
+    }
+    u->sqmap = mmap(NULL, u->sqmapsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if(u->sqmap == MAP_FAILED){
+        close(u->fd);
+        return -1;
+    }
+    u->cqmap = u->sqmap;
+    if(u->cqmapsize){
+        u->cqmap = mmap(NULL, u->cqmapsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if(u->cqmap == MAP_FAILED){
+            munmap(u->sqmap, u->sqmapsize);
+            close(u->fd);
+            return -1;
+        }
+    }
+    u->sqes = mmap(NULL, u->sqesize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED){
+        if(u->cqmapsize){munmap(u->cqmap, u->cqmapsize);}
+        munmap(u->sqmap, u->sqmapsize);
+        close(u->fd);
+        return -1;
+    }
+    u->sqhead = (unsigned *)((char *)u->sqmap + p.sq_off.head);
+    u->sqtail = (unsigned *)((char *)u->sqmap + p.sq_off.tail);
+    u->sqmask = (unsigned *)((char *)u->sqmap + p.sq_off.ring_mask);
+    u->sqarray = (unsigned *)((char *)u->sqmap + p.sq_off.array);
+    u->cqhead = (unsigned *)((char *)u->cqmap + p.cq_off.head);
+    u->cqtail = (unsigned *)((char *)u->cqmap + p.cq_off.tail);
+    u->cqmask = (unsigned *)((char *)u->cqmap + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cqmap + p.cq_off.cqes);
+    return 0;
+}
+
+void uringTeardown(struct uring *u){
+    munmap(u->sqes, u->sqesize);
+    if(u->cqmapsize){munmap(u->cqmap, u->cqmapsize);}
+    munmap(u->sqmap, u->sqmapsize);
+    close(u->fd);
+}
+
+// Queues a read or write of len bytes at off (-1 for the current file position). user_data carries the slot index.
+void uringQueue(struct uring *u, int opcode, int fd, char *buf, size_t len, off_t off, int slot){
+    unsigned tail = *u->sqtail;
+    unsigned idx = tail & *u->sqmask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = slot;
+    u->sqarray[idx] = idx;
+    __atomic_store_n(u->sqtail, tail + 1, __ATOMIC_RELEASE);
+    u->pending++;
+}
+
+// Submits everything queued and waits for at least one completion
+int uringWait(struct uring *u){
+    for(;;){
+        int n = syscall(__NR_io_uring_enter, u->fd, u->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(n >= 0){
+            u->pending -= n;
+            return 0;
+        }
+        if(errno != EINTR){return -1;}
+    }
+}
+
+void queueRead(struct uring *u, struct ring *r, int infd, int i){
+    struct slot *s = &r->slots[i];
+    // Seekable inputs can have several reads in flight at explicit offsets, pipes read from wherever they are
+    uringQueue(u, IORING_OP_READ, infd, s->buf + s->filled, s->want - s->filled, r->seekable ? s->off + (off_t)s->filled : (off_t)-1, i);
+}
+
+int uringCopy(int infd, char *infile, int outfd, char *outfile, int depth, int countlines, long long *bytes, long long *lines){
+    struct ring r;
+    struct uring u;
+    if(ringInit(&r, infd, depth) < 0){return URING_UNAVAILABLE;}
+    if(uringSetup(&u, 2 * r.depth) < 0){
+        ringFree(&r);
+        return URING_UNAVAILABLE;
+    }
+    off_t start = r.seekable ? lseek(infd, 0, SEEK_CUR) : 0;
+    if(start < 0){start = 0;}
+    long long before = *bytes; // The caller's running total may already count bytes moved before start
+    long long readseq = 0, writeseq = 0; // Next block to start reading and next block to write, in file order
+    long long lastblock = -1; // Once EOF or a read error is seen, no block after this one is written
+    int readsinflight = 0, writing = 0, result = 0, readerr = 0, moved = 0;
+
+    for(;;){
+        // Keep the ring full of reads. A pipe only gets one read at a time so its blocks come back in order.
+        while(lastblock < 0 && readseq - writeseq < r.depth && (r.seekable || readsinflight == 0)){
+            int i = readseq % r.depth;
+            struct slot *s = &r.slots[i];
+            s->off = start + readseq * (off_t)r.blocksize;
+            s->want = r.blocksize;
+            s->filled = s->written = 0;
+            s->err = 0;
+            s->state = SLOT_READING;
+            queueRead(&u, &r, infd, i);
+            readsinflight++;
+            readseq++;
+        }
+        // Writes go out strictly in order, one at a time
+        while(!writing && writeseq < readseq && r.slots[writeseq % r.depth].state == SLOT_READY){
+            struct slot *s = &r.slots[writeseq % r.depth];
+            if(s->filled == s->written){
+                // Nothing (left) to write in this block, it was an EOF or error marker
+                s->state = SLOT_FREE;
+                if(writeseq == lastblock){break;}
+                writeseq++;
+                continue;
+            }
+            s->state = SLOT_WRITING;
+            uringQueue(&u, IORING_OP_WRITE, outfd, s->buf + s->written, s->filled - s->written, -1, writeseq % r.depth);
+            writing = 1;
+        }
+        if(!writing && readsinflight == 0){break;} // Nothing left in flight, which only happens once the last block is written
+        if(uringWait(&u) < 0){
+            if(!moved){
+                result = URING_UNAVAILABLE;
+                break;
+            }
+            fprintf(stderr, "Error while waiting on io_uring for file %s: %s\n", infile, strerror(errno));
+            result = 1;
+            break;
+        }
+
+        unsigned head = *u.cqhead;
+        unsigned tail = __atomic_load_n(u.cqtail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++){
+            struct io_uring_cqe *cqe = &u.cqes[head & *u.cqmask];
+            int i = (int)cqe->user_data;
+            int res = cqe->res;
+            struct slot *s = &r.slots[i];
+            long long seq = s->state == SLOT_WRITING ? writeseq : writeseq + ((i - writeseq % r.depth + r.depth) % r.depth);
+            if(s->state == SLOT_READING){
+                if(res == -EINTR || res == -EAGAIN){
+                    queueRead(&u, &r, infd, i);
+                    continue;
+                }
+                // Old kernels without IORING_OP_READ say EINVAL; if nothing has moved yet we can still hand over to threads
+                if(res == -EINVAL && !moved){
+                    result = URING_UNAVAILABLE;
+                    readsinflight--;
+                    continue;
+                }
+                if(res > 0){
+                    s->filled += res;
+                    moved = 1;
+                    if(r.seekable && s->filled < s->want){
+                        queueRead(&u, &r, infd, i); // Short read on a file, ask for the rest of the block
+                        continue;
+                    }
+                }
+                readsinflight--;
+                s->state = SLOT_READY;
+                if(res <= 0 && (lastblock < 0 || seq < lastblock)){
+                    lastblock = seq;
+                    if(res < 0){
+                        readerr = -res;
+                    }
+                }
+            }
+            else if(s->state == SLOT_WRITING){
+                writing = 0;
+                if(res == -EINTR || res == -EAGAIN){
+                    s->state = SLOT_READY;
+                    continue;
+                }
+                if(res <= 0){
+                    fprintf(stderr, "Error attempting to write to file %s: %s\n", outfile, strerror(res < 0 ? -res : EIO));
+                    result = -1;
+                    continue;
+                }
+                moved = 1;
+                s->written += res;
+                if(s->written < s->filled){
+                    s->state = SLOT_READY; // Partial write: the next pass resubmits from s->written
+                    continue;
+                }
+                *bytes += s->filled;
+                if(countlines){*lines += countNewlines(s->buf, s->filled);}
+                s->state = SLOT_FREE;
+                if(writeseq != lastblock){writeseq++;}
+            }
+        }
+        __atomic_store_n(u.cqhead, head, __ATOMIC_RELEASE);
+        if(result != 0){break;}
+    }
+    // Don't free buffers the kernel may still be writing into
+    while(result != 0 && (readsinflight > 0 || writing)){
+        if(uringWait(&u) < 0){break;}
+        unsigned head = *u.cqhead;
+        unsigned tail = __atomic_load_n(u.cqtail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++){
+            struct slot *s = &r.slots[u.cqes[head & *u.cqmask].user_data];
+            if(s->state == SLOT_WRITING){writing = 0;}
+            else{readsinflight--;}
+            s->state = SLOT_FREE;
+        }
+        __atomic_store_n(u.cqhead, head, __ATOMIC_RELEASE);
+    }
+    uringTeardown(&u);
+    ringFree(&r);
+    if(result == 0 && r.seekable){
+        lseek(infd, start + (*bytes - before), SEEK_SET); // Reads at explicit offsets don't move the file position, leave it where read() would have
+    }
+    if(result == 0 && readerr){
+        fprintf(stderr, "Error occured while reading file %s: %s\n", infile, strerror(readerr));
+        return 1;
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Thread path: a reader thread fills the ring while the calling thread drains it.
+
+struct threadring{
+    struct ring r;
+    int infd;
+    long long readseq, writeseq;
+    int done; // Reader hit EOF or an error
+    int abort; // Writer failed, reader should stop
+    int wake[2]; // Pipe whose write end the writer closes when it aborts, so a reader waiting on input stops too
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+// Waits until a pipe, tty or socket has input, or the writer has aborted. Returns -1 if it has.
+static int waitInput(struct threadring *t){
+    struct pollfd fds[2] = {{t->infd, POLLIN, 0}, {t->wake[0], POLLIN, 0}};
+    while(poll(fds, 2, -1) < 0){
+        if(errno != EINTR){return 0;} // Let read find out what is wrong
+    }
+    return fds[1].revents ? -1 : 0;
+}
+
+void *readerThread(void *arg){
+    struct threadring *t = arg;
+    for(;;){
+        pthread_mutex_lock(&t->lock);
+        while(!t->abort && t->readseq - t->writeseq >= t->r.depth){
+            pthread_cond_wait(&t->changed, &t->lock);
+        }
+        if(t->abort){
+            pthread_mutex_unlock(&t->lock);
+            return NULL;
+        }
+        struct slot *s = &t->r.slots[t->readseq % t->r.depth];
+        pthread_mutex_unlock(&t->lock);
+
+        // The slot is ours until we publish it, no lock needed while reading
+        int n;
+        s->filled = s->written = 0;
+        s->err = 0;
+        for(;;){
+            if(!t->r.seekable && waitInput(t) < 0){return NULL;} // Input may never come, so don't block in read
+            if((n = read(t->infd, s->buf + s->filled, t->r.blocksize - s->filled)) == 0){break;}
+            if(n < 0){
+                if(errno == EINTR){continue;}
+                s->err = errno;
+                break;
+            }
+            s->filled += n;
+            if(!t->r.seekable || s->filled == t->r.blocksize){break;} // Hand pipe data on as soon as it arrives
+        }
+
+        pthread_mutex_lock(&t->lock);
+        s->state = SLOT_READY;
+        t->readseq++;
+        if(n <= 0){t->done = 1;}
+        pthread_cond_broadcast(&t->changed);
+        pthread_mutex_unlock(&t->lock);
+        if(n <= 0){return NULL;}
+    }
+}
+
+int threadCopy(int infd, char *infile, int outfd, char *outfile, int depth, int countlines, long long *bytes, long long *lines){
+    struct threadring t;
+    pthread_t reader;
+    if(ringInit(&t.r, infd, depth) < 0){
+        fprintf(stderr, "Error allocating copy buffers for file %s: %s\n", infile, strerror(errno));
+        return 1;
+    }
+    t.infd = infd;
+    t.readseq = t.writeseq = 0;
+    t.done = t.abort = 0;
+    pthread_mutex_init(&t.lock, NULL);
+    pthread_cond_init(&t.changed, NULL);
+    if(pipe2(t.wake, O_CLOEXEC) < 0){
+        fprintf(stderr, "Error starting reader thread for file %s: %s\n", infile, strerror(errno));
+        ringFree(&t.r);
+        return 1;
+    }
+    if((errno = pthread_create(&reader, NULL, readerThread, &t))){
+        fprintf(stderr, "Error starting reader thread for file %s: %s\n", infile, strerror(errno));
+        close(t.wake[0]);
+        close(t.wake[1]);
+        ringFree(&t.r);
+        return 1;
+    }
+
+    int result = 0;
+    for(;;){
+        pthread_mutex_lock(&t.lock);
+        while(t.writeseq == t.readseq && !t.done){
+            pthread_cond_wait(&t.changed, &t.lock);
+        }
+        if(t.writeseq == t.readseq){
+            pthread_mutex_unlock(&t.lock);
+            break;
+        }
+        struct slot *s = &t.r.slots[t.writeseq % t.r.depth];
+        pthread_mutex_unlock(&t.lock);
+
+        while(s->written < s->filled){
+            // Resume from the first byte that has not been written yet
+            int k = write(outfd, s->buf + s->written, s->filled - s->written);
+            if(k < 0 && errno == EINTR){continue;}
+            if(k <= 0){
+                fprintf(stderr, "Error attempting to write to file %s: %s\n", outfile, strerror(k < 0 ? errno : EIO));
+                result = -1;
+                break;
+            }
+            s->written += k;
+        }
+        if(result < 0){break;}
+        *bytes += s->filled;
+        if(countlines){*lines += countNewlines(s->buf, s->filled);}
+        if(s->err){
+            fprintf(stderr, "Error occured while reading file %s: %s\n", infile, strerror(s->err));
+            result = 1;
+        }
+
+        pthread_mutex_lock(&t.lock);
+        s->state = SLOT_FREE;
+        t.writeseq++;
+        pthread_cond_broadcast(&t.changed);
+        pthread_mutex_unlock(&t.lock);
+    }
+
+    pthread_mutex_lock(&t.lock);
+    t.abort = 1;
+    pthread_cond_broadcast(&t.changed);
+    pthread_mutex_unlock(&t.lock);
+    close(t.wake[1]); // Wakes the reader if it is waiting for input
+    pthread_join(reader, NULL);
+    close(t.wake[0]);
+    pthread_mutex_destroy(&t.lock);
+    pthread_cond_destroy(&t.changed);
+    ringFree(&t.r);
+    return result;
+}
+
+int ringCopy(int infd, char *infile, int outfd, char *outfile, int depth, int countlines, long long *bytes, long long *lines){
+    int result = URING_UNAVAILABLE;
+#ifndef RINGCOPY_NO_URING
+    result = uringCopy(infd, infile, outfd, outfile, depth, countlines, bytes, lines);
+#endif
+    if(result == URING_UNAVAILABLE){
+        errno = 0;
+        result = threadCopy(infd, infile, outfd, outfile, depth, countlines, bytes, lines);
+    }
+    return result;
+}
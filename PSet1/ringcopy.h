@@ -0,0 +1,19 @@
+#ifndef _RINGCOPY_H
+#define _RINGCOPY_H
+
+#define RING_MIN_BLOCK (64 << 10)
+#define RING_MAX_BLOCK (4 << 20)
+#define RING_MAX_DEPTH 64
+
+int ringCopy(int infd, char *infile, int outfd, char *outfile, int depth, int countlines, long long *bytes, long long *lines);
+/* Copies infd to outfd until EOF with up to depth page-aligned blocks in
+* flight, so the read of block N+1 overlaps the write of block N. Blocks are
+* sized from the input's type and length (between RING_MIN_BLOCK and
+* RING_MAX_BLOCK). Uses io_uring when the kernel allows it and otherwise a
+* reader thread feeding the calling thread through a ring of buffers.
+* Bytes and (if countlines) newlines written are added to *bytes and *lines.
+* Returns 0 on EOF, 1 if reading failed, or -1 if writing failed. Errors are
+* reported on stderr using infile and outfile, like meow's own loop.
+*/
+
+#endif
@@ -0,0 +1,119 @@
+# include "compare.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <time.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+
+struct comparestats compareStats;
+
+static long long nowNsec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int compareTargetLoad(struct comparetarget *t, const char *name){
+    struct stat st;
+    int fd;
+    memset(t, 0, sizeof(*t));
+    t->name = name;
+    if((fd = open(name, O_RDONLY)) < 0){return -1;}
+    if(fstat(fd, &st) < 0){
+        close(fd);
+        return -1;
+    }
+    t->size = st.st_size;
+    if(t->size == 0){
+        close(fd);
+        return 0;
+    }
+    void *p = mmap(NULL, t->size, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fd, 0);
+    if(p != MAP_FAILED){
+        t->data = p;
+        t->mapped = 1;
+    }
+    else{
+        // Not mappable (odd filesystems, special files): fall back to a copy in memory
+        unsigned char *buf = malloc(t->size);
+        size_t got = 0;
+        ssize_t n = 0;
+        while(buf && got < t->size && (n = pread(fd, buf + got, t->size - got, got)) != 0){
+            if(n < 0){
+                if(errno == EINTR){continue;}
+                break;
+            }
+            got += n;
+        }
+        if(!buf || n < 0){
+            int err = buf ? errno : ENOMEM;
+            free(buf);
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        t->size = got;
+        t->data = buf;
+    }
+    close(fd);
+    __atomic_add_fetch(&compareStats.targetbytes, (long long)t->size, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void compareTargetFree(struct comparetarget *t){
+    if(t->mapped){munmap((void *)t->data, t->size);}
+    else{free((void *)t->data);}
+    t->data = NULL;
+}
+
+// Reads exactly len bytes at off, anything less (EOF or an error) means the candidate can't match
+static int readAt(int fd, unsigned char *buf, size_t len, off_t off, long long *bytes){
+    size_t got = 0;
+    while(got < len){
+        ssize_t n = pread(fd, buf + got, len - got, off + got);
+        if(n < 0 && errno == EINTR){continue;}
+        if(n <= 0){return -1;}
+        got += n;
+        *bytes += n;
+    }
+    return 0;
+}
+
+int compareWith(struct comparetarget *t, int candidatefd, const char *candidatename){
+    if(t->size == 0){return 1;}
+    size_t chunk = t->size < COMPARE_CHUNK ? t->size : COMPARE_CHUNK;
+    unsigned char *buf = malloc(chunk);
+    if(!buf){
+        fprintf(stderr, "Warning: Out of memory comparing %s\n", candidatename);
+        return 0;
+    }
+    long long start = nowNsec(), bytes = 0;
+    int result = 1;
+    errno = 0;
+    size_t tail = t->size < COMPARE_TAIL ? t->size : COMPARE_TAIL;
+    size_t body = t->size - tail;
+    // Last block first: a cheap early exit for files that share a long prefix
+    if(readAt(candidatefd, buf, tail, body, &bytes) < 0 || memcmp(buf, t->data + body, tail)){
+        result = 0;
+        if(bytes == (long long)tail){__atomic_add_fetch(&compareStats.tailexits, 1, __ATOMIC_RELAXED);}
+    }
+    if(result && body){posix_fadvise(candidatefd, 0, body, POSIX_FADV_SEQUENTIAL);}
+    for(size_t off = 0; result && off < body; off += chunk){
+        size_t len = body - off < chunk ? body - off : chunk;
+        if(readAt(candidatefd, buf, len, off, &bytes) < 0 || memcmp(buf, t->data + off, len)){result = 0;}
+    }
+    if(errno){
+        fprintf(stderr, "Warning: Error occured while reading candidate file %s: %s\n", candidatename, strerror(errno));
+        errno = 0;
+    }
+    free(buf);
+    __atomic_add_fetch(&compareStats.compares, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&compareStats.bytesread, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&compareStats.nsec, nowNsec() - start, __ATOMIC_RELAXED);
+    if(result){__atomic_add_fetch(&compareStats.matches, 1, __ATOMIC_RELAXED);}
+    return result;
+}
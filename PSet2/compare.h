@@ -0,0 +1,47 @@
+#ifndef _COMPARE_H
+#define _COMPARE_H
+
+#include <stddef.h>
+
+#define COMPARE_CHUNK (1 << 20) // Candidates are read and compared this much at a time
+#define COMPARE_TAIL 4096 // Size of the last block, which is checked before anything else
+
+// A target held in memory for the whole run, so it is read from disk once no matter how many candidates there are
+struct comparetarget{
+    const char *name;
+    const unsigned char *data; // NULL for an empty file
+    size_t size;
+    int mapped; // data is an mmap, otherwise a malloc'd copy
+};
+
+// Counters for --stats and the progress reports, updated atomically from every traversal thread
+struct comparestats{
+    long long compares; // Candidates that got as far as reading data
+    long long matches;
+    long long tailexits; // Candidates ruled out by their last block alone
+    long long bytesread; // Candidate bytes read from disk
+    long long targetbytes; // Target bytes loaded, once per target
+    long long nsec; // Time spent comparing, summed over threads
+    long long prunedsize; // Files never read because no other file (or the target) had their size
+    long long prunedhash; // Files ruled out by a prefix or full hash without a byte compare
+};
+
+extern struct comparestats compareStats;
+
+int compareTargetLoad(struct comparetarget *t, const char *name);
+/* Maps the file at name (or reads it into memory if it can't be mapped).
+* Returns 0 on success or -1 with errno set.
+*/
+
+void compareTargetFree(struct comparetarget *t);
+
+int compareWith(struct comparetarget *t, int candidatefd, const char *candidatename);
+/* Compares the candidate open on candidatefd with t, which it is assumed to
+* match in size. The last COMPARE_TAIL bytes are compared first, since
+* files that only differ at the end (appended logs, edited trailers) are
+* common, then the rest from the start in COMPARE_CHUNK reads with memcmp.
+* Reads at explicit offsets, so the fd's position doesn't matter. Returns 1
+* if the files match and 0 if they don't or the candidate can't be read.
+*/
+
+#endif
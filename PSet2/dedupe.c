@@ -0,0 +1,404 @@
+# include "dedupe.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+# include "walk.h"
+# include "compare.h"
+# include "json.h"
+
+#define SIZEGROUP_MIN_CAPACITY 4096
+
+// All the members of one size group that share an inode. Hashes are per inode so hard links are only read once.
+struct inode{
+    struct member **m; // Regular files sort ahead of symlinks, so m[0] is a real path whenever there is one
+    long n;
+    struct hashentry h;
+    int cls; // Index of the inode representing this one's content class
+    int bad; // Could not be read, left out of every comparison
+};
+
+
+static uint64_t sizeSlot(struct dedupe *d, int64_t size){
+    uint64_t k = (uint64_t)size * 0x9E3779B97F4A7C15ULL;
+    return (k ^ (k >> 29)) & (d->capacity - 1);
+}
+
+static struct sizegroup *findGroup(struct dedupe *d, int64_t size){
+    uint64_t i = sizeSlot(d, size);
+    while(d->groups[i].used && d->groups[i].size != size){
+        i = (i + 1) & (d->capacity - 1);
+    }
+    return &d->groups[i];
+}
+
+static int growGroups(struct dedupe *d){
+    struct sizegroup *old = d->groups;
+    uint64_t oldcap = d->capacity;
+    d->capacity = oldcap ? oldcap * 2 : SIZEGROUP_MIN_CAPACITY;
+    if(!(d->groups = calloc(d->capacity, sizeof(struct sizegroup)))){
+        d->groups = old;
+        d->capacity = oldcap;
+        return -1;
+    }
+    for(uint64_t i = 0; i < oldcap; i++){
+        if(old[i].used){*findGroup(d, old[i].size) = old[i];}
+    }
+    free(old);
+    return 0;
+}
+
+// First walk: one more file of this size
+static int countSize(struct dedupe *d, int64_t size){
+    if((d->count + 1) * 4 > d->capacity * 3 && growGroups(d) < 0){return -1;}
+    struct sizegroup *g = findGroup(d, size);
+    if(!g->used){
+        g->used = 1;
+        g->size = size;
+        d->count++;
+    }
+    g->seen++;
+    return 0;
+}
+
+// Second walk: keeps the file if the first walk saw another of its size. Sizes that have turned up since are left
+// out, there was no second file of them to compare against.
+static int addMember(struct dedupe *d, char *path, struct stat *st, int islink){
+    struct sizegroup *g = findGroup(d, st->st_size);
+    if(!g->used || g->seen < 2){return 0;}
+    struct member *m = malloc(sizeof(struct member));
+    if(!m || !(m->path = strdup(path))){
+        free(m);
+        return -1;
+    }
+    m->dev = st->st_dev;
+    m->ino = st->st_ino;
+    m->size = st->st_size;
+    m->nlink = st->st_nlink;
+    m->mtimesec = st->st_mtim.tv_sec;
+    m->mtimensec = st->st_mtim.tv_nsec;
+    m->ctimesec = st->st_ctim.tv_sec;
+    m->ctimensec = st->st_ctim.tv_nsec;
+    m->islink = islink;
+    m->next = g->members;
+    g->members = m;
+    g->count++;
+    return 0;
+}
+
+// Visitor for walkTree: every regular file (or symlink to one) is counted under its size, or filed there
+static int collectEntry(struct walkworker *ww, struct walkentry *e, void *arg){
+    struct dedupe *d = arg;
+    struct stat linkedstats, *st = NULL;
+    int islink = 0;
+    switch(e->st.st_mode & S_IFMT){
+        case S_IFREG:
+            // Empty files are all trivially identical, listing them would drown out the real duplicates
+            if(e->st.st_size > 0){st = &e->st;}
+            break;
+        case S_IFLNK:
+            if(walkStat(e->dirfd, e->name, &linkedstats, 1) == 0 && S_ISREG(linkedstats.st_mode) && linkedstats.st_size > 0){
+                st = &linkedstats;
+                islink = 1;
+            }
+            errno = 0; // Dangling links are not worth a warning
+            break;
+        default:
+            break;
+    }
+    if(!st){return 0;}
+    int r;
+    if(d->counting){
+        pthread_mutex_lock(&d->lock);
+        r = countSize(d, st->st_size);
+        pthread_mutex_unlock(&d->lock);
+    }
+    else{
+        char entname[strlen(e->dirpath) + strlen(e->name) + 2];
+        sprintf(entname, "%s/%s", e->dirpath, e->name);
+        pthread_mutex_lock(&d->lock);
+        r = addMember(d, entname, st, islink);
+        pthread_mutex_unlock(&d->lock);
+    }
+    if(r < 0){
+        fprintf(stderr, "ERROR: Out of memory while walking %s\n", e->dirpath);
+        return -1;
+    }
+    return 0;
+}
+
+static int byIdentity(const void *a, const void *b){
+    const struct member *x = *(struct member * const *)a, *y = *(struct member * const *)b;
+    if(x->dev != y->dev){return x->dev < y->dev ? -1 : 1;}
+    if(x->ino != y->ino){return x->ino < y->ino ? -1 : 1;}
+    if(x->islink != y->islink){return x->islink - y->islink;}
+    return strcmp(x->path, y->path);
+}
+
+static int byPrefix(const void *a, const void *b){
+    const struct inode *x = a, *y = b;
+    if(x->bad != y->bad){return x->bad - y->bad;} // Unreadable inodes sink to the end
+    if(x->h.prefix != y->h.prefix){return x->h.prefix < y->h.prefix ? -1 : 1;}
+    return 0;
+}
+
+static int byFull(const void *a, const void *b){
+    const struct inode *x = a, *y = b;
+    if(x->bad != y->bad){return x->bad - y->bad;}
+    if(x->h.full != y->h.full){return x->h.full < y->h.full ? -1 : 1;}
+    return 0;
+}
+
+// Whether two inodes could still be the same file once their hashes are in
+static int sameHashes(struct inode *a, struct inode *b){
+    if(a->bad || b->bad || a->h.prefix != b->h.prefix){return 0;}
+    if((a->h.flags & HASHENTRY_FULL) && (b->h.flags & HASHENTRY_FULL)){return a->h.full == b->h.full;}
+    return 1;
+}
+
+// Makes sure ino has its prefix hash (and full hash if full is set), from the index when it has them
+static void hashInode(struct dedupe *d, struct inode *ino, int full){
+    uint32_t need = HASHENTRY_PREFIX | (full ? HASHENTRY_FULL : 0);
+    if(ino->bad || (ino->h.flags & need) == need){return;}
+    struct member *m = ino->m[0];
+    struct hashentry *e = &ino->h;
+    if(d->idx){
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        st.st_dev = m->dev;
+        st.st_ino = m->ino;
+        st.st_size = m->size;
+        st.st_mtim.tv_sec = m->mtimesec;
+        st.st_mtim.tv_nsec = m->mtimensec;
+        st.st_ctim.tv_sec = m->ctimesec;
+        st.st_ctim.tv_nsec = m->ctimensec;
+        if((e = hashIndexGet(d->idx, &st)) == NULL){e = &ino->h;}
+        else if((e->flags & need) == need){
+            ino->h = *e;
+            return;
+        }
+    }
+    int fd;
+    if((fd = open(m->path, O_RDONLY)) < 0 || hashIndexFill(e, e == &ino->h ? NULL : d->idx, fd, full) < 0){
+        fprintf(stderr, "Warning: Could not read %s: %s\n", m->path, strerror(errno));
+        errno = 0;
+        ino->bad = 1;
+    }
+    if(fd >= 0){close(fd);}
+    if(e != &ino->h){ino->h = *e;}
+}
+
+// The NDJSON form of one line of a group: relation is first, hardlink, symlink, duplicate or symlink_duplicate
+static void jsonMember(struct dedupe *d, int64_t size, struct member *m, const char *relation, struct member *first, const char *link){
+    char *path = jsonField("path", m->path);
+    char *of = m == first ? NULL : jsonField("of", first->path);
+    char *quotedlink = link ? jsonField("link", link) : NULL;
+    if(!path || (m != first && !of) || (link && !quotedlink)){
+        fprintf(stderr, "ERROR: Out of memory printing %s\n", m->path);
+    }
+    else{
+        printf("{\"group\":%ld,\"size\":%lld,%s,\"relation\":\"%s\",\"nlink\":%ld%s%s%s%s}\n",
+               d->reported, (long long)size, path, relation, m->nlink,
+               of ? "," : "", of ? of : "", quotedlink ? "," : "", quotedlink ? quotedlink : "");
+    }
+    free(path);
+    free(of);
+    free(quotedlink);
+}
+
+static void printGroup(struct dedupe *d, struct inode *inodes, long ninodes, int rep, int64_t size){
+    // Prefer a real file over a symlink as the copy everything else is described against
+    if(inodes[rep].m[0]->islink){
+        for(long i = 0; i < ninodes; i++){
+            if(inodes[i].cls == rep && !inodes[i].m[0]->islink){
+                rep = i;
+                break;
+            }
+        }
+    }
+    struct member *first = inodes[rep].m[0];
+    char linkedname[4096];
+    ++d->reported;
+    if(!d->json){printf("Duplicate group %ld (%lld bytes each):\n", d->reported, (long long)size);}
+    if(first->islink){
+        ssize_t len = readlink(first->path, linkedname, sizeof(linkedname) - 1);
+        linkedname[len < 0 ? 0 : len] = '\0';
+        if(d->json){jsonMember(d, size, first, "first", first, linkedname);}
+        else{printf("%s\tSYMLINK (%s) FIRST COPY\n", first->path, linkedname);}
+    }
+    else if(d->json){
+        jsonMember(d, size, first, "first", first, NULL);
+    }
+    else{
+        printf("%s\tFIRST COPY (nlink=%ld)\n", first->path, first->nlink);
+    }
+    for(long i = 0; i < ninodes; i++){
+        if(inodes[i].cls != inodes[rep].cls){continue;}
+        for(long j = 0; j < inodes[i].n; j++){
+            struct member *m = inodes[i].m[j];
+            if(m == first){continue;}
+            if(m->islink){
+                ssize_t len = readlink(m->path, linkedname, sizeof(linkedname) - 1);
+                linkedname[len < 0 ? 0 : len] = '\0';
+                if(d->json){jsonMember(d, size, m, i == rep ? "symlink" : "symlink_duplicate", first, linkedname);}
+                else if(i == rep){printf("%s\tSYMLINK RESOLVES TO %s\n", m->path, first->path);}
+                else{printf("%s\tSYMLINK (%s) RESOLVES TO DUPLICATE OF %s\n", m->path, linkedname, first->path);}
+            }
+            else if(d->json){
+                jsonMember(d, size, m, i == rep ? "hardlink" : "duplicate", first, NULL);
+            }
+            else if(i == rep){
+                printf("%s\tHARD LINK TO %s\n", m->path, first->path);
+            }
+            else{
+                printf("%s\tDUPLICATE OF %s (nlink=%ld)\n", m->path, first->path, m->nlink);
+            }
+        }
+    }
+}
+
+// Narrows one size group down to its sets of identical files and prints them
+static int processGroup(struct dedupe *d, struct sizegroup *g){
+    struct member **m = malloc(g->count * sizeof(struct member *));
+    struct inode *inodes = calloc(g->count, sizeof(struct inode));
+    if(!m || !inodes){
+        free(m);
+        free(inodes);
+        return -1;
+    }
+    long n = 0, ninodes = 0;
+    for(struct member *p = g->members; p; p = p->next){m[n++] = p;}
+    qsort(m, n, sizeof(struct member *), byIdentity);
+    for(long i = 0; i < n; i++){
+        if(i == 0 || m[i]->dev != m[i-1]->dev || m[i]->ino != m[i-1]->ino){
+            inodes[ninodes].m = &m[i];
+            ninodes++;
+        }
+        inodes[ninodes-1].n++;
+    }
+
+    // Only inodes that share the size with some other inode need reading at all
+    if(ninodes > 1){
+        for(long i = 0; i < ninodes; i++){hashInode(d, &inodes[i], 0);}
+        qsort(inodes, ninodes, sizeof(struct inode), byPrefix);
+        for(long i = 0; i < ninodes;){
+            long j = i + 1;
+            while(j < ninodes && !inodes[j].bad && !inodes[i].bad && inodes[j].h.prefix == inodes[i].h.prefix){j++;}
+            if(j - i > 1){
+                for(long k = i; k < j; k++){hashInode(d, &inodes[k], 1);}
+                qsort(inodes + i, j - i, sizeof(struct inode), byFull);
+            }
+            i = j;
+        }
+    }
+    // Inodes whose hashes nobody else shares are settled without reading a byte more
+    for(long i = 0; ninodes > 1 && i < ninodes; i++){
+        if(!inodes[i].bad && !(i > 0 && sameHashes(&inodes[i-1], &inodes[i])) && !(i + 1 < ninodes && sameHashes(&inodes[i], &inodes[i+1]))){
+            __atomic_add_fetch(&compareStats.prunedhash, inodes[i].n, __ATOMIC_RELAXED);
+        }
+    }
+    // Every inode starts in a class of its own, then runs with matching hashes are settled byte by byte
+    for(long i = 0; i < ninodes; i++){inodes[i].cls = i;}
+    for(long i = 0; i + 1 < ninodes;){
+        long j = i + 1;
+        while(j < ninodes && !inodes[i].bad && !inodes[j].bad && (inodes[j].h.flags & HASHENTRY_FULL)
+              && inodes[j].h.prefix == inodes[i].h.prefix && inodes[j].h.full == inodes[i].h.full){j++;}
+        // Each representative is loaded once and holds it while everything after it not yet placed is compared
+        for(long r = i; r + 1 < j; r++){
+            struct comparetarget rep;
+            if(inodes[r].cls != r || inodes[r].bad){continue;}
+            if(compareTargetLoad(&rep, inodes[r].m[0]->path) < 0){
+                fprintf(stderr, "Warning: Could not load %s for comparing: %s\n", inodes[r].m[0]->path, strerror(errno));
+                errno = 0;
+                inodes[r].bad = 1;
+                continue;
+            }
+            for(long k = r + 1; k < j; k++){
+                int fd;
+                if(inodes[k].cls != k || inodes[k].bad){continue;}
+                if((fd = open(inodes[k].m[0]->path, O_RDONLY)) < 0){
+                    fprintf(stderr, "Warning: Could not read %s: %s\n", inodes[k].m[0]->path, strerror(errno));
+                    errno = 0;
+                    inodes[k].bad = 1;
+                    continue;
+                }
+                if(compareWith(&rep, fd, inodes[k].m[0]->path) == 1){inodes[k].cls = r;}
+                close(fd);
+            }
+            compareTargetFree(&rep);
+        }
+        i = j;
+    }
+    for(long r = 0; r < ninodes; r++){
+        if(inodes[r].cls != r || inodes[r].bad){continue;}
+        long total = 0;
+        for(long i = r; i < ninodes; i++){
+            if(inodes[i].cls == r){total += inodes[i].n;}
+        }
+        if(total > 1){printGroup(d, inodes, ninodes, r, g->size);}
+    }
+    free(m);
+    free(inodes);
+    return 0;
+}
+
+static int bySizeDescending(const void *a, const void *b){
+    const struct sizegroup *x = *(struct sizegroup * const *)a, *y = *(struct sizegroup * const *)b;
+    if(x->size != y->size){return x->size > y->size ? -1 : 1;}
+    return 0;
+}
+
+int dedupeTree(char *startdir, struct hashindex *idx, int nworkers, int json){
+    struct dedupe d;
+    memset(&d, 0, sizeof(d));
+    d.idx = idx;
+    d.json = json;
+    pthread_mutex_init(&d.lock, NULL);
+    if(growGroups(&d) < 0){
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+    d.counting = 1;
+    int result = walkTree(startdir, nworkers, 0, collectEntry, &d);
+    if(result < 0){return -1;}
+    d.counting = 0;
+    int second = walkTree(startdir, nworkers, 0, collectEntry, &d);
+    if(second < 0){return -1;}
+    if(second > result){result = second;}
+
+    // Largest sizes first, that's where the wasted space is
+    uint64_t ncandidates = 0;
+    struct sizegroup **order = malloc((d.count ? d.count : 1) * sizeof(struct sizegroup *));
+    if(!order){
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+    for(uint64_t i = 0; i < d.capacity; i++){
+        if(d.groups[i].used && d.groups[i].count > 1){order[ncandidates++] = &d.groups[i];}
+        else if(d.groups[i].used){__atomic_add_fetch(&compareStats.prunedsize, d.groups[i].seen < 2 ? d.groups[i].seen : d.groups[i].count, __ATOMIC_RELAXED);}
+    }
+    qsort(order, ncandidates, sizeof(struct sizegroup *), bySizeDescending);
+    for(uint64_t i = 0; i < ncandidates; i++){
+        if(processGroup(&d, order[i]) < 0){
+            fprintf(stderr, "ERROR: Out of memory\n");
+            result = -1;
+            break;
+        }
+    }
+    free(order);
+    for(uint64_t i = 0; i < d.capacity; i++){
+        struct member *p = d.groups[i].members;
+        while(p){
+            struct member *next = p->next;
+            free(p->path);
+            free(p);
+            p = next;
+        }
+    }
+    free(d.groups);
+    pthread_mutex_destroy(&d.lock);
+    return result;
+}
@@ -0,0 +1,55 @@
+#ifndef _DEDUPE_H
+#define _DEDUPE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "hashindex.h"
+
+// One path seen during the walk. Symlinks carry the stats of the file they resolve to.
+struct member{
+    char *path;
+    uint64_t dev, ino;
+    int64_t size;
+    long nlink;
+    int64_t mtimesec, mtimensec; // Kept for the hash index, which only trusts entries whose mtime and ctime still match
+    int64_t ctimesec, ctimensec;
+    int islink;
+    struct member *next;
+};
+
+// One file size. The first walk only counts the files of each size, the second keeps members (and their paths)
+// only for sizes the first walk saw at least twice, so a size seen once costs this entry and nothing more.
+struct sizegroup{
+    int64_t size;
+    long seen; // Files of this size in the first walk
+    struct member *members;
+    long count; // Members kept in the second walk
+    int used;
+};
+
+struct dedupe{
+    struct sizegroup *groups; // Open-addressing table keyed by size
+    uint64_t capacity, count;
+    struct hashindex *idx; // Optional persistent index from -i, NULL otherwise
+    long reported; // Duplicate groups printed so far
+    int json; // Print NDJSON records instead of the labelled lines
+    int counting; // Set during the first walk, which only counts files per size
+    pthread_mutex_t lock; // Guards groups while the traversal threads fill it
+};
+
+int dedupeTree(char *startdir, struct hashindex *idx, int nworkers, int json);
+/* Walks startdir twice and reports every set of identical files in it: the
+* first walk counts the files of each size, the second records the files of
+* the sizes that were seen more than once, so memory grows with the
+* candidates rather than with the tree. Files are grouped by size, each group is narrowed by the hash of the first
+* HASH_PREFIX_BYTES, then by the full hash, and only files whose hashes
+* collide are compared byte for byte. Hard links and symlinks into a set are
+* labelled the way the single-target search labels them. Hashes come from
+* and go into idx when it is not NULL. The walk itself runs on nworkers
+* threads, the grouping afterwards is single-threaded. With json set every
+* file in a set is one NDJSON record carrying the set number, size, path,
+* relation, nlink and (symlinks only) the link text. Returns 0 on success, 1 if there were
+* non-fatal errors, -1 on a fatal one.
+*/
+
+#endif
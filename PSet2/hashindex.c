@@ -0,0 +1,327 @@
+# include "hashindex.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <time.h>
+
+#define HASH_READ_BYTES (1 << 20) // Read size while computing a full hash
+#define HASHINDEX_MIN_CAPACITY 1024
+
+// ---------------------------------------------------------------------------------------------
+// XXH64, following the reference description at https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+#define P64_1 0x9E3779B185EBCA87ULL
+#define P64_2 0xC2B2AE3D27D4EB4FULL
+#define P64_3 0x165667B19E3779F9ULL
+#define P64_4 0x85EBCA77C2B2AE63ULL
+#define P64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p){
+    uint64_t v;
+    memcpy(&v, p, 8); // Little-endian hosts only, which is everything we run hunt on
+    return v;
+}
+
+static uint32_t read32(const unsigned char *p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t xxhRound(uint64_t acc, uint64_t input){
+    acc += input * P64_2;
+    acc = rotl64(acc, 31);
+    return acc * P64_1;
+}
+
+static uint64_t xxhMerge(uint64_t acc, uint64_t val){
+    acc ^= xxhRound(0, val);
+    return acc * P64_1 + P64_4;
+}
+
+void xxh64Init(struct xxh64state *s, uint64_t seed){
+    memset(s, 0, sizeof(*s));
+    s->v[0] = seed + P64_1 + P64_2;
+    s->v[1] = seed + P64_2;
+    s->v[2] = seed;
+    s->v[3] = seed - P64_1;
+}
+
+void xxh64Update(struct xxh64state *s, const void *data, size_t len){
+    const unsigned char *p = data;
+    s->total += len;
+    // Top up a partial stripe left over from the last call first
+    if(s->buffered){
+        size_t take = 32 - s->buffered < len ? 32 - s->buffered : len;
+        memcpy(s->buf + s->buffered, p, take);
+        s->buffered += take;
+        p += take;
+        len -= take;
+        if(s->buffered < 32){return;}
+        for(int i = 0; i < 4; i++){s->v[i] = xxhRound(s->v[i], read64(s->buf + 8*i));}
+        s->buffered = 0;
+    }
+    while(len >= 32){
+        s->v[0] = xxhRound(s->v[0], read64(p));
+        s->v[1] = xxhRound(s->v[1], read64(p + 8));
+        s->v[2] = xxhRound(s->v[2], read64(p + 16));
+        s->v[3] = xxhRound(s->v[3], read64(p + 24));
+        p += 32;
+        len -= 32;
+    }
+    memcpy(s->buf, p, len);
+    s->buffered = len;
+}
+
+uint64_t xxh64Digest(struct xxh64state *s){
+    uint64_t h;
+    if(s->total >= 32){
+        h = rotl64(s->v[0], 1) + rotl64(s->v[1], 7) + rotl64(s->v[2], 12) + rotl64(s->v[3], 18);
+        for(int i = 0; i < 4; i++){h = xxhMerge(h, s->v[i]);}
+    }
+    else{
+        h = s->v[2] + P64_5; // v[2] still holds the seed
+    }
+    h += s->total;
+    const unsigned char *p = s->buf;
+    unsigned len = s->buffered;
+    while(len >= 8){
+        h ^= xxhRound(0, read64(p));
+        h = rotl64(h, 27) * P64_1 + P64_4;
+        p += 8;
+        len -= 8;
+    }
+    if(len >= 4){
+        h ^= (uint64_t)read32(p) * P64_1;
+        h = rotl64(h, 23) * P64_2 + P64_3;
+        p += 4;
+        len -= 4;
+    }
+    while(len > 0){
+        h ^= (*p) * P64_5;
+        h = rotl64(h, 11) * P64_1;
+        p++;
+        len--;
+    }
+    h ^= h >> 33;
+    h *= P64_2;
+    h ^= h >> 29;
+    h *= P64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// ---------------------------------------------------------------------------------------------
+// The index itself: an open-addressing table of hashentry, saved to disk as a header plus the used slots
+
+struct indexheader{
+    char magic[8];
+    uint64_t count;
+};
+
+static uint64_t slotFor(struct hashindex *idx, uint64_t dev, uint64_t ino){
+    uint64_t k = (ino * P64_1) ^ rotl64(dev * P64_2, 29);
+    k ^= k >> 31;
+    return k & (idx->capacity - 1);
+}
+
+// Finds the slot for (dev, ino): either the one holding it or the empty slot where it belongs
+static struct hashentry *findSlot(struct hashindex *idx, uint64_t dev, uint64_t ino){
+    uint64_t i = slotFor(idx, dev, ino);
+    while(idx->entries[i].used && (idx->entries[i].dev != dev || idx->entries[i].ino != ino)){
+        i = (i + 1) & (idx->capacity - 1);
+    }
+    return &idx->entries[i];
+}
+
+static int growIndex(struct hashindex *idx){
+    struct hashentry *old = idx->entries;
+    uint64_t oldcap = idx->capacity;
+    uint64_t newcap = oldcap ? oldcap * 2 : HASHINDEX_MIN_CAPACITY;
+    struct hashentry *fresh = calloc(newcap, sizeof(struct hashentry));
+    if(!fresh){return -1;}
+    idx->entries = fresh;
+    idx->capacity = newcap;
+    for(uint64_t i = 0; i < oldcap; i++){
+        if(old[i].used){*findSlot(idx, old[i].dev, old[i].ino) = old[i];}
+    }
+    free(old);
+    return 0;
+}
+
+static struct hashentry *insertEntry(struct hashindex *idx, uint64_t dev, uint64_t ino){
+    if((idx->count + 1) * 4 > idx->capacity * 3 && growIndex(idx) < 0){return NULL;} // Keep the load factor under 3/4
+    struct hashentry *e = findSlot(idx, dev, ino);
+    if(!e->used){
+        memset(e, 0, sizeof(*e));
+        e->dev = dev;
+        e->ino = ino;
+        e->used = 1;
+        idx->count++;
+    }
+    return e;
+}
+
+// Throws away whatever a failed load put in idx so the caller still has a usable empty index
+static int resetIndex(struct hashindex *idx, int err){
+    memset(idx->entries, 0, idx->capacity * sizeof(struct hashentry));
+    idx->count = 0;
+    errno = err;
+    return -1;
+}
+
+int hashIndexLoad(struct hashindex *idx, const char *path){
+    memset(idx, 0, sizeof(*idx));
+    if(growIndex(idx) < 0){return -1;}
+    FILE *f = fopen(path, "r");
+    if(!f){
+        if(errno == ENOENT){
+            errno = 0;
+            return 0; // First run, nothing indexed yet
+        }
+        return resetIndex(idx, errno);
+    }
+    struct indexheader h;
+    if(fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, HASHINDEX_MAGIC, 8)){
+        fclose(f);
+        return resetIndex(idx, EINVAL);
+    }
+    struct hashentry rec;
+    for(uint64_t i = 0; i < h.count; i++){
+        if(fread(&rec, sizeof(rec), 1, f) != 1){
+            fclose(f);
+            return resetIndex(idx, EINVAL);
+        }
+        struct hashentry *e = insertEntry(idx, rec.dev, rec.ino);
+        if(!e){
+            fclose(f);
+            return resetIndex(idx, ENOMEM);
+        }
+        *e = rec;
+        e->used = 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+// Whether a file was changed so recently that another change could leave its stats as they are. Timestamps are only
+// compared to the second, since some filesystems keep no more than that.
+static int racy(struct hashentry *e, time_t saved){
+    return e->mtimesec >= saved || e->ctimesec >= saved;
+}
+
+int hashIndexSave(struct hashindex *idx, const char *path){
+    if(!idx->dirty){return 0;}
+    time_t saved = time(NULL);
+    char tmppath[strlen(path) + 8];
+    sprintf(tmppath, "%s.XXXXXX", path);
+    int fd = mkstemp(tmppath);
+    if(fd < 0){return -1;}
+    FILE *f = fdopen(fd, "w");
+    if(!f){
+        close(fd);
+        unlink(tmppath);
+        return -1;
+    }
+    struct indexheader h;
+    memcpy(h.magic, HASHINDEX_MAGIC, 8);
+    h.count = 0;
+    for(uint64_t i = 0; i < idx->capacity; i++){h.count += idx->entries[i].used && !racy(&idx->entries[i], saved);}
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for(uint64_t i = 0; ok && i < idx->capacity; i++){
+        if(idx->entries[i].used && !racy(&idx->entries[i], saved)){ok = fwrite(&idx->entries[i], sizeof(struct hashentry), 1, f) == 1;}
+    }
+    if(fclose(f) != 0){ok = 0;}
+    if(!ok || rename(tmppath, path) < 0){
+        int saved = errno;
+        unlink(tmppath);
+        errno = saved;
+        return -1;
+    }
+    idx->dirty = 0;
+    return 0;
+}
+
+void hashIndexFree(struct hashindex *idx){
+    free(idx->entries);
+    idx->entries = NULL;
+    idx->capacity = idx->count = 0;
+}
+
+struct hashentry *hashIndexGet(struct hashindex *idx, struct stat *st){
+    struct hashentry *e = insertEntry(idx, st->st_dev, st->st_ino);
+    if(!e){return NULL;}
+    // The inode may have been rewritten (or deleted and reused) since we hashed it
+    if(e->size != st->st_size || e->mtimesec != st->st_mtim.tv_sec || e->mtimensec != st->st_mtim.tv_nsec ||
+       e->ctimesec != st->st_ctim.tv_sec || e->ctimensec != st->st_ctim.tv_nsec){
+        e->size = st->st_size;
+        e->mtimesec = st->st_mtim.tv_sec;
+        e->mtimensec = st->st_mtim.tv_nsec;
+        e->ctimesec = st->st_ctim.tv_sec;
+        e->ctimensec = st->st_ctim.tv_nsec;
+        e->flags = 0;
+        e->prefix = e->full = 0;
+        idx->dirty = 1;
+    }
+    return e;
+}
+
+long long hashBytesRead;
+
+int hashIndexFill(struct hashentry *e, struct hashindex *idx, int fd, int full){
+    if(full && !(e->flags & HASHENTRY_FULL)){
+        // One pass gives us both hashes
+        char *buf = malloc(HASH_READ_BYTES);
+        if(!buf){return -1;}
+        struct xxh64state whole, prefix;
+        xxh64Init(&whole, 0);
+        xxh64Init(&prefix, 0);
+        off_t off = 0;
+        ssize_t n;
+        while((n = pread(fd, buf, HASH_READ_BYTES, off)) != 0){
+            if(n < 0){
+                if(errno == EINTR){continue;}
+                free(buf);
+                return -1;
+            }
+            if(off < HASH_PREFIX_BYTES){
+                xxh64Update(&prefix, buf, n < HASH_PREFIX_BYTES - off ? n : HASH_PREFIX_BYTES - off);
+            }
+            xxh64Update(&whole, buf, n);
+            off += n;
+        }
+        free(buf);
+        __atomic_add_fetch(&hashBytesRead, (long long)off, __ATOMIC_RELAXED);
+        e->prefix = xxh64Digest(&prefix);
+        e->full = xxh64Digest(&whole);
+        e->flags |= HASHENTRY_PREFIX | HASHENTRY_FULL;
+        if(idx){idx->dirty = 1;}
+    }
+    else if(!(e->flags & HASHENTRY_PREFIX)){
+        char buf[HASH_PREFIX_BYTES];
+        size_t got = 0;
+        ssize_t n;
+        while(got < HASH_PREFIX_BYTES && (n = pread(fd, buf + got, HASH_PREFIX_BYTES - got, got)) != 0){
+            if(n < 0){
+                if(errno == EINTR){continue;}
+                return -1;
+            }
+            got += n;
+        }
+        __atomic_add_fetch(&hashBytesRead, (long long)got, __ATOMIC_RELAXED);
+        struct xxh64state prefix;
+        xxh64Init(&prefix, 0);
+        xxh64Update(&prefix, buf, got);
+        e->prefix = xxh64Digest(&prefix);
+        e->flags |= HASHENTRY_PREFIX;
+        if(idx){idx->dirty = 1;}
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef _HASHINDEX_H
+#define _HASHINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define HASH_PREFIX_BYTES 4096 // The prefix hash covers this much of the start of each file
+#define HASHINDEX_MAGIC "HUNTIDX2" // Indexes from before ctime was kept are not loaded, a new one is started
+
+#define HASHENTRY_PREFIX 1 // prefix hash is valid
+#define HASHENTRY_FULL 2 // full hash is valid
+
+// One file's hashes, keyed by (dev, ino) and only trusted while size, mtime and ctime still match. mtime can be
+// set back after an edit (touch -d, rsync -t, tar), ctime cannot be set from userspace at all.
+struct hashentry{
+    uint64_t dev, ino;
+    int64_t size;
+    int64_t mtimesec, mtimensec;
+    int64_t ctimesec, ctimensec;
+    uint64_t prefix, full;
+    uint32_t flags;
+    uint32_t used; // Slot in use
+};
+
+struct hashindex{
+    struct hashentry *entries; // Open-addressing table, capacity is always a power of two
+    uint64_t capacity, count;
+    int dirty; // Something changed since load, save needs to write
+};
+
+struct xxh64state{
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char buf[32];
+    unsigned buffered;
+};
+
+void xxh64Init(struct xxh64state *s, uint64_t seed);
+void xxh64Update(struct xxh64state *s, const void *data, size_t len);
+uint64_t xxh64Digest(struct xxh64state *s);
+/* Streaming XXH64. Produces the same values as the reference xxHash
+* implementation, so index files can be checked with other tools.
+*/
+
+int hashIndexLoad(struct hashindex *idx, const char *path);
+/* Initializes idx and fills it from the index file at path. A missing file
+* gives an empty index. Returns 0 on success or -1 if the file exists but
+* could not be read or is not an index, in which case idx is still a usable
+* empty index (unless memory ran out, when idx->capacity is 0).
+*/
+
+int hashIndexSave(struct hashindex *idx, const char *path);
+/* Writes idx to path (through a temporary file and rename, so a crash never
+* leaves a half-written index) if anything changed since it was loaded.
+* Files whose mtime or ctime falls in the second of the save or later are
+* left out: they could still be rewritten without either changing, within
+* the filesystem's timestamp granularity, so they are hashed again next
+* time (git's index guards against "racily clean" files the same way).
+* Returns 0 on success or -1 with errno set.
+*/
+
+void hashIndexFree(struct hashindex *idx);
+
+struct hashentry *hashIndexGet(struct hashindex *idx, struct stat *st);
+/* Returns the entry for the file st describes. If there is none, or the
+* file's size, mtime or ctime no longer match what was hashed, an empty entry
+* (flags == 0) is returned for the caller to fill. The pointer is only good
+* until the next call, which may grow the table. Returns NULL only if memory
+* runs out.
+*/
+
+extern long long hashBytesRead; // Everything hashIndexFill has read so far, for progress reports
+
+int hashIndexFill(struct hashentry *e, struct hashindex *idx, int fd, int full);
+/* Makes sure e has its prefix hash, and its full hash too if full is set,
+* reading fd from the start as needed. idx may be NULL for an entry that
+* lives outside any index. Returns 0 on success or -1 with errno set if
+* reading failed.
+*/
+
+#endif
@@ -1,28 +1,149 @@
 # include <stdio.h>
+# include <stdlib.h>
 # include <string.h>
 # include <errno.h>
 # include <fcntl.h>
 # include <unistd.h>
-# include <dirent.h>
+# include <getopt.h>
+# include <pthread.h>
+# include <time.h>
 # include <sys/stat.h>
+# include "hashindex.h"
+# include "dedupe.h"
+# include "walk.h"
+# include "compare.h"
+# include "json.h"
+# include "progress.h"
 
 // hunt.c
 // By: Jeffrey Wong
 /* This program accepts a regular file and a directory, and attempts to find
 files that are "identical" (every byte matches) to the given file in the given
-directory and all of its subdirectories. */
+directory and all of its subdirectories. With -a it instead accepts just a
+directory and reports every set of identical files inside it. --json prints
+results as NDJSON, and --progress / --metrics <file> report how the search is
+going every second. */
+
+// What every traversal thread needs to know about the target
+struct target{
+    char *name;
+    struct stat stats;
+    struct comparetarget data; // Loaded once and compared against every candidate
+};
 
 // Function Declarations
-int processDirectory(char *dname, char *targetname, struct stat *targetstats);
-int compareFile(char *targetname, char *candidatename);
+int processEntry(struct walkworker *ww, struct walkentry *e, void *arg);
+int isDuplicate(struct target *t, struct walkentry *e, struct stat *candidatestats);
+void printHit(struct walkworker *ww, struct walkentry *e, const char *relation, long nlink, const char *link);
+void printStats(double elapsed);
+double secondsSince(struct timespec *start);
+
+// Persistent hash index (-i), NULL when hunt runs without one. Shared by the traversal threads under hashlock.
+struct hashindex *hashidx = NULL;
+pthread_mutex_t hashlock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t targetprefix, targetfull;
+int jsonout = 0; // --json: one NDJSON record per hit instead of the labelled lines
 
 int main(int argc, char* argv[]){
-    if(argc < 3){
+    char *indexfile = NULL;
+    struct hashindex index;
+    int allpairs = 0;
+    int workers = defaultWorkers();
+    int stats = 0, showprogress = 0;
+    char *metricsfile = NULL;
+    FILE *metrics = NULL;
+    struct progress progress;
+    struct option longopts[] = {
+        {"stats", no_argument, NULL, 'S'},
+        {"json", no_argument, NULL, 'J'},
+        {"progress", no_argument, NULL, 'P'},
+        {"metrics", required_argument, NULL, 'M'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+    while((c = getopt_long(argc, argv, "ai:j:", longopts, NULL)) >= 0){
+        switch(c){
+            case 'S':
+                stats = 1;
+                break;
+            case 'J':
+                jsonout = 1;
+                break;
+            case 'P':
+                showprogress = 1;
+                break;
+            case 'M':
+                metricsfile = optarg;
+                break;
+            case 'a':
+                allpairs = 1;
+                break;
+            case 'j':
+                workers = strtol(optarg, NULL, 10);
+                if(workers < 1 || workers > WALK_MAX_WORKERS){
+                    fprintf(stderr, "ERROR: Thread count must be between 1 and %d.\n", WALK_MAX_WORKERS);
+                    return -1;
+                }
+                break;
+            case 'i':
+                indexfile = optarg;
+                break;
+            case '?':
+                if(optopt == 'i')
+                    fprintf(stderr, "ERROR: No file name specified for the hash index.\n");
+                else if(optopt == 'j')
+                    fprintf(stderr, "ERROR: No thread count specified.\n");
+                else if(optopt == 'M')
+                    fprintf(stderr, "ERROR: No file name specified for the metrics.\n");
+                else
+                    fprintf(stderr, "ERROR: Unknown option character entered.\n");
+                return -1;
+            default:
+                return -1;
+        }
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(metricsfile && !(metrics = fopen(metricsfile, "a"))){
+        fprintf(stderr, "ERROR: Could not open metrics file %s: %s\n", metricsfile, strerror(errno));
+        return -1;
+    }
+    if(jsonout){setvbuf(stdout, NULL, _IOFBF, WALK_OUTBUF);} // Results go out in large writes, not one per line
+    if((showprogress || metrics) && progressStart(&progress, showprogress ? stderr : NULL, metrics) < 0){
+        fprintf(stderr, "Warning: Could not start progress reporting: %s\n", strerror(errno));
+        errno = 0;
+        showprogress = 0;
+        metrics = NULL;
+    }
+    if(allpairs){
+        if(argc - optind < 1){
+            fprintf(stderr, "ERROR: Too few arguments passed to hunt.");
+            return -1;
+        }
+        struct hashindex *idx = NULL;
+        if(indexfile){
+            if(hashIndexLoad(&index, indexfile) < 0){
+                fprintf(stderr, "Warning: Could not load hash index %s, starting a new one: %s\n", indexfile, strerror(errno));
+                errno = 0;
+            }
+            if(index.capacity){idx = &index;}
+        }
+        int result = dedupeTree(argv[optind], idx, workers, jsonout);
+        fflush(stdout);
+        if(idx && hashIndexSave(idx, indexfile) < 0){
+            fprintf(stderr, "Warning: Could not save hash index %s: %s\n", indexfile, strerror(errno));
+        }
+        if(showprogress || metrics){progressStop(&progress);}
+        if(stats){printStats(secondsSince(&start));}
+        return result < 0 ? -1 : 0;
+    }
+    if(argc - optind < 2){
         fprintf(stderr, "ERROR: Too few arguments passed to hunt.");
         return -1;
     }
     // Checking and statting initial file
-    char *targetfile = argv[1];
+    struct target target;
+    char *targetfile = target.name = argv[optind];
     int targetfd;
     struct stat targetstats;
 
@@ -34,127 +155,181 @@ int main(int argc, char* argv[]){
         fprintf(stderr, "ERROR: Could not stat target file %s: %s\n", targetfile, strerror(errno));
         exit(-1);        
     }
+    if(indexfile){
+        if(hashIndexLoad(&index, indexfile) < 0){
+            fprintf(stderr, "Warning: Could not load hash index %s, starting a new one: %s\n", indexfile, strerror(errno));
+            errno = 0;
+        }
+        struct hashentry *e = index.capacity ? hashIndexGet(&index, &targetstats) : NULL;
+        if(e && hashIndexFill(e, &index, targetfd, 1) == 0){
+            targetprefix = e->prefix;
+            targetfull = e->full;
+            hashidx = &index;
+        }
+        else{
+            fprintf(stderr, "Warning: Could not hash target file %s, continuing without the index: %s\n", targetfile, strerror(errno));
+            errno = 0;
+        }
+    }
     close(targetfd);
 
+    target.stats = targetstats;
+    if(compareTargetLoad(&target.data, targetfile) < 0){
+        fprintf(stderr, "ERROR: Could not read target file %s: %s\n", targetfile, strerror(errno));
+        exit(-1);
+    }
+
     // Prechecking and processing starting directory
-    char *startdir = argv[2];
-    DIR *dirp;
-    if(!(dirp=opendir(startdir))){
+    char *startdir = argv[optind+1];
+    int startfd;
+    if((startfd = open(startdir, O_RDONLY|O_DIRECTORY)) < 0){
         fprintf(stderr, "ERROR: Could not open starting directory %s: %s\n", startdir, strerror(errno));
         exit(-1);
     }
-    processDirectory(startdir, targetfile, &targetstats);
-    closedir(dirp);
-    return 0;
+    close(startfd);
+    int result = walkTree(startdir, workers, 0, processEntry, &target);
+    if(hashidx && hashIndexSave(hashidx, indexfile) < 0){
+        fprintf(stderr, "Warning: Could not save hash index %s: %s\n", indexfile, strerror(errno));
+    }
+    compareTargetFree(&target.data);
+    if(showprogress || metrics){progressStop(&progress);}
+    if(stats){printStats(secondsSince(&start));}
+    return result < 0 ? -1 : 0;
+}
+
+double secondsSince(struct timespec *start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// --stats: how much comparing the run did and how fast it went
+void printStats(double elapsed){
+    struct comparestats *s = &compareStats;
+    double comparesecs = s->nsec / 1e9;
+    fprintf(stderr, "Compared %lld candidates (%lld matched, %lld ruled out by their last block) in %.3f seconds of %.3f\n",
+            s->compares, s->matches, s->tailexits, comparesecs, elapsed);
+    fprintf(stderr, "Read %lld candidate bytes and %lld target bytes (%.1f MB/s while comparing)\n",
+            s->bytesread, s->targetbytes, comparesecs > 0 ? s->bytesread / comparesecs / 1e6 : 0.0);
 }
 
-// Recursive function used to traverse a directory to find hits for a given target file descriptor
+// Called by the traversal engine for every non-directory entry to find hits for the target.
 // Returns 0 on successful execution, or 1 if there is a non-fatal error. Exits program with status -1 if there is a fatal error
-int processDirectory(char *dname, char *targetname, struct stat *targetstats){
-    DIR *dirp;
-    struct dirent *de;
-    if(!(dirp=opendir(dname))){
-        fprintf(stderr, "Warning: Could not open directory %s: %s\n", dname, strerror(errno));
-        errno = 0;
-        return 1;
-    }
-    while(de = readdir(dirp)){
-        // Create entry name for processing
-        char *entname = strdup(dname);
-        strcat(strcat(entname,"/"),de->d_name);
-        struct stat candidatestats;
-        lstat(entname, &candidatestats); // We don't want to traverse through symlinks just yet
-        int type = (candidatestats.st_mode & S_IFMT); // Pull out type so we can process entry correctly
-        switch(type){
-            case S_IFDIR:
-                int i;
-                if(!(strcmp(de->d_name,".") && strcmp(de->d_name,"..")) ){break;} // We don't want to traverse through the . or .. entries to prevent infinite loop
-                if((i = (processDirectory(entname,targetname,targetstats))) == -1){
-                    exit(-1);
-                } 
-                break;
-            case S_IFREG:
-                if(targetstats->st_size == candidatestats.st_size){
-                    int j;
-                    if(targetstats->st_dev == candidatestats.st_dev && targetstats->st_ino == candidatestats.st_ino && targetstats->st_nlink > 1){
-                        printf("%s\tHARD LINK TO TARGET\n", entname);
-                        break;
-                    }
-                    else if((j = compareFile(targetname, entname)) == 1){
-                        printf("%s\tDUPLICATE OF TARGET (nlink=%d)\n", entname, candidatestats.st_nlink);
-                    }
+int processEntry(struct walkworker *ww, struct walkentry *e, void *arg){
+    struct target *t = arg;
+    struct stat *targetstats = &t->stats;
+    int j;
+    switch(e->st.st_mode & S_IFMT){ // Pull out type so we can process entry correctly
+        case S_IFREG:
+            if(targetstats->st_size == e->st.st_size){
+                if(targetstats->st_dev == e->st.st_dev && targetstats->st_ino == e->st.st_ino && targetstats->st_nlink > 1){
+                    if(jsonout){printHit(ww, e, "hardlink", e->st.st_nlink, NULL);}
+                    else{walkPrintf(ww, "%s/%s\tHARD LINK TO TARGET\n", e->dirpath, e->name);}
                 }
+                else if((j = isDuplicate(t, e, &e->st)) == 1){
+                    if(jsonout){printHit(ww, e, "duplicate", e->st.st_nlink, NULL);}
+                    else{walkPrintf(ww, "%s/%s\tDUPLICATE OF TARGET (nlink=%d)\n", e->dirpath, e->name, (int)e->st.st_nlink);}
+                }
+            }
+            else{
+                __atomic_add_fetch(&compareStats.prunedsize, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        case S_IFLNK:
+            struct stat linkedstats;
+            if(walkStat(e->dirfd, e->name, &linkedstats, 1) < 0){ // Retreives the data of the linked entry at this point
+                errno = 0; // Dangling link, nothing it could duplicate
                 break;
-            case S_IFLNK:
-                struct stat linkedstats;
-                stat(entname,&linkedstats); // Retreives the data of the linked entry at this point
-                if(targetstats->st_size == linkedstats.st_size){
-                    int j;
-                    if(targetstats->st_dev == linkedstats.st_dev && targetstats->st_ino == linkedstats.st_ino){
-                        printf("%s\tSYMLINK RESOLVES TO TARGET\n", entname);
-                        break;
-                    }
-                    else if((j = compareFile(targetname, entname)) == 1){
-                        char linkedname[4096];
-                        if(readlink(entname, linkedname, 4096) < 0){
-                            fprintf(stderr, "Warning: Symlink could not be read: %s\n", strerror(errno));
-                            errno = 0;
-                            break;
-                        }
-                        printf("%s\tSYMLINK (%s) RESOLVES TO DUPLICATE\n", entname, linkedname);
+            }
+            if(S_ISREG(linkedstats.st_mode) && targetstats->st_size == linkedstats.st_size){
+                if(targetstats->st_dev == linkedstats.st_dev && targetstats->st_ino == linkedstats.st_ino){
+                    if(jsonout){printHit(ww, e, "symlink", linkedstats.st_nlink, NULL);}
+                    else{walkPrintf(ww, "%s/%s\tSYMLINK RESOLVES TO TARGET\n", e->dirpath, e->name);}
+                }
+                else if((j = isDuplicate(t, e, &linkedstats)) == 1){
+                    char linkedname[4096];
+                    ssize_t len;
+                    if((len = readlinkat(e->dirfd, e->name, linkedname, sizeof(linkedname) - 1)) < 0){
+                        fprintf(stderr, "Warning: Symlink could not be read: %s\n", strerror(errno));
+                        errno = 0;
+                        return 1;
                     }
+                    linkedname[len] = '\0';
+                    if(jsonout){printHit(ww, e, "symlink_duplicate", linkedstats.st_nlink, linkedname);}
+                    else{walkPrintf(ww, "%s/%s\tSYMLINK (%s) RESOLVES TO DUPLICATE\n", e->dirpath, e->name, linkedname);}
                 }
-                break;
-            default:
-                break;
-        }
-        free(entname);
-    }
-    if(errno){
-        errno = 0;
-        return 1;
+            }
+            else if(S_ISREG(linkedstats.st_mode)){
+                __atomic_add_fetch(&compareStats.prunedsize, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        default:
+            break;
     }
-    closedir(dirp);
     return 0;
 }
 
-// Function that compares the target file to a candidate file. It is assumed that they are of equal size beforehand,
-// and in this program this check is made before calling this function. Returns 1 if the files match, 0 if they do not match,
-// and -1 if there is a fatal error (probably involving the target file)
-int compareFile(char *targetname, char *candidatename){
-
-    int targetfd, candidatefd;
-    // Buffers for reading target and candidate, respectively, as well as tracker ints
-    char buftar[4096];
-    char bufcan[4096];
-    int i, j;
-
-    // Tedious error handling
-    if((targetfd = open(targetname, O_RDONLY)) < 0){
-        fprintf(stderr, "ERROR: Could not open target file %s for reading: %s\n", targetname, strerror(errno));
-        exit(-1);
+// Prints one hit as an NDJSON record: relation is hardlink, duplicate, symlink or symlink_duplicate, nlink belongs to
+// the file the entry resolves to and link (symlink_duplicate only) is the symlink's text. Names that aren't valid
+// UTF-8 also get their exact bytes as path_b64 or link_b64 (see jsonField).
+void printHit(struct walkworker *ww, struct walkentry *e, const char *relation, long nlink, const char *link){
+    char path[strlen(e->dirpath) + strlen(e->name) + 2];
+    sprintf(path, "%s/%s", e->dirpath, e->name);
+    char *quotedpath = jsonField("path", path);
+    char *quotedlink = link ? jsonField("link", link) : NULL;
+    if(!quotedpath || (link && !quotedlink)){
+        fprintf(stderr, "ERROR: Out of memory printing %s\n", path);
+    }
+    else{
+        walkPrintf(ww, "{%s,\"relation\":\"%s\",\"nlink\":%ld%s%s}\n", quotedpath, relation, nlink,
+                   quotedlink ? "," : "", quotedlink ? quotedlink : "");
     }
-    if((candidatefd = open(candidatename, O_RDONLY)) < 0){
+    free(quotedpath);
+    free(quotedlink);
+}
+
+// Decides whether a candidate of the same size as the target is a duplicate. With a hash index, candidates whose
+// prefix or full hash differs from the target's are ruled out without reading the target again; only files whose
+// hashes collide get the byte-for-byte compare. Returns 1 if the candidate matches the target and 0 if it does not.
+int isDuplicate(struct target *t, struct walkentry *e, struct stat *candidatestats){
+    int candidatefd;
+    char candidatename[strlen(e->dirpath) + strlen(e->name) + 2];
+    sprintf(candidatename, "%s/%s", e->dirpath, e->name);
+    if((candidatefd = openat(e->dirfd, e->name, O_RDONLY)) < 0){
         fprintf(stderr, "Warning: Could not open candidate file %s for reading: %s\n", candidatename, strerror(errno));
         errno = 0;
         return 0;
     }
-
-    while((i = read(targetfd, buftar, sizeof(buftar))) > 0){
-        if(i < 0){
-            fprintf(stderr, "ERROR: Error occured while reading target file %s: %s\n", targetname, strerror(errno));
-            exit(-1);
+    if(hashidx){
+        // Work on a copy so the (slow) hashing happens outside the lock
+        struct hashentry h, *ent;
+        int have = 0;
+        pthread_mutex_lock(&hashlock);
+        if((ent = hashIndexGet(hashidx, candidatestats))){
+            h = *ent;
+            have = 1;
         }
-        if((j = read(candidatefd, bufcan, sizeof(bufcan))) != i){
-            if(j < 0){
-                fprintf(stderr, "Warning: Error occured while reading candidate file %s: %s\n", candidatename, strerror(errno));
-                errno = 0;
+        pthread_mutex_unlock(&hashlock);
+        if(have && (h.flags & HASHENTRY_FULL) == 0){
+            // The cheap prefix hash first, and the full hash only if the prefix matches
+            if(hashIndexFill(&h, NULL, candidatefd, 0) == 0 && h.prefix == targetprefix){
+                hashIndexFill(&h, NULL, candidatefd, 1);
             }
+            errno = 0;
+            pthread_mutex_lock(&hashlock);
+            if((ent = hashIndexGet(hashidx, candidatestats))){
+                *ent = h;
+                hashidx->dirty = 1;
+            }
+            pthread_mutex_unlock(&hashlock);
+        }
+        if(have && (((h.flags & HASHENTRY_PREFIX) && h.prefix != targetprefix) || ((h.flags & HASHENTRY_FULL) && h.full != targetfull))){
+            __atomic_add_fetch(&compareStats.prunedhash, 1, __ATOMIC_RELAXED);
+            close(candidatefd);
             return 0;
         }
-        if(strncmp(buftar,bufcan,i)){return 0;} // strncmp will be nonzero if there is a discrepancy at any point
     }
-    close(targetfd);
+    int result = compareWith(&t->data, candidatefd, candidatename);
     close(candidatefd);
-    return 1;
-}
\ No newline at end of file
+    return result;
+}
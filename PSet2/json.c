@@ -0,0 +1,91 @@
+# include "json.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+
+// Length of the valid UTF-8 sequence starting at s, or 0 if there isn't one
+static int utf8Length(const unsigned char *s){
+    int len;
+    if(s[0] < 0x80){return 1;}
+    else if(s[0] >= 0xC2 && s[0] <= 0xDF){len = 2;}
+    else if(s[0] >= 0xE0 && s[0] <= 0xEF){len = 3;}
+    else if(s[0] >= 0xF0 && s[0] <= 0xF4){len = 4;}
+    else{return 0;}
+    for(int i = 1; i < len; i++){
+        if((s[i] & 0xC0) != 0x80){return 0;}
+    }
+    // Overlong three and four byte forms, surrogates and anything past U+10FFFF
+    if(s[0] == 0xE0 && s[1] < 0xA0){return 0;}
+    if(s[0] == 0xED && s[1] >= 0xA0){return 0;}
+    if(s[0] == 0xF0 && s[1] < 0x90){return 0;}
+    if(s[0] == 0xF4 && s[1] >= 0x90){return 0;}
+    return len;
+}
+
+// jsonQuote into out, which has room for the worst case. Returns the end of it, and whether s was valid UTF-8 in *valid.
+static char *quoteInto(char *o, const char *s, int *valid){
+    const unsigned char *p = (const unsigned char *)s;
+    *valid = 1;
+    *o++ = '"';
+    while(*p){
+        int len = utf8Length(p);
+        if(len > 1){
+            memcpy(o, p, len);
+            o += len;
+            p += len;
+            continue;
+        }
+        switch(*p){
+            case '"': o += sprintf(o, "\\\""); break;
+            case '\\': o += sprintf(o, "\\\\"); break;
+            case '\n': o += sprintf(o, "\\n"); break;
+            case '\t': o += sprintf(o, "\\t"); break;
+            case '\r': o += sprintf(o, "\\r"); break;
+            default:
+                if(len == 0){*valid = 0;}
+                if(*p < 0x20 || len == 0){o += sprintf(o, "\\u%04x", *p);}
+                else{*o++ = *p;}
+                break;
+        }
+        p++;
+    }
+    *o++ = '"';
+    *o = '\0';
+    return o;
+}
+
+// Base64 of the n bytes at s into out, null-terminated. Returns the end of it.
+static char *base64Into(char *o, const unsigned char *s, size_t n){
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for(size_t i = 0; i < n; i += 3){
+        unsigned long bits = (unsigned long)s[i] << 16 | (i+1 < n ? s[i+1] << 8 : 0) | (i+2 < n ? s[i+2] : 0);
+        *o++ = digits[bits >> 18 & 63];
+        *o++ = digits[bits >> 12 & 63];
+        *o++ = i+1 < n ? digits[bits >> 6 & 63] : '=';
+        *o++ = i+2 < n ? digits[bits & 63] : '=';
+    }
+    *o = '\0';
+    return o;
+}
+
+char *jsonQuote(const char *s){
+    int valid;
+    char *out = malloc(strlen(s) * 6 + 3); // Worst case every byte becomes \u00XX
+    if(out){quoteInto(out, s, &valid);}
+    return out;
+}
+
+char *jsonField(const char *key, const char *s){
+    size_t n = strlen(s), keylen = strlen(key);
+    int valid;
+    char *out = malloc(2 * keylen + n * 6 + (n + 2) / 3 * 4 + 20); // Both members at their worst
+    if(!out){return NULL;}
+    char *o = out + sprintf(out, "\"%s\":", key);
+    o = quoteInto(o, s, &valid);
+    if(!valid){
+        o += sprintf(o, ",\"%s_b64\":\"", key);
+        o = base64Into(o, (const unsigned char *)s, n);
+        strcpy(o, "\"");
+    }
+    return out;
+}
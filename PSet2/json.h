@@ -0,0 +1,19 @@
+#ifndef _JSON_H
+#define _JSON_H
+
+char *jsonQuote(const char *s);
+/* Returns s as a malloc'd JSON string literal, quotes included, or NULL if
+* memory ran out. Quotes, backslashes and control characters (tabs and
+* newlines in file names included) are escaped. Paths are bytes, not text,
+* so any byte that isn't part of valid UTF-8 comes out as \u00XX. That can't
+* be told apart from the character it names, so use jsonField for anything
+* that has to be turned back into the original bytes.
+*/
+
+char *jsonField(const char *key, const char *s);
+/* Returns "key":<s quoted by jsonQuote> as a malloc'd string, or NULL if
+* memory ran out. If s isn't valid UTF-8, ,"key_b64":"..." follows with s's
+* exact bytes in base64 (RFC 4648), so readers can recover the real name.
+*/
+
+#endif
@@ -0,0 +1,96 @@
+# include "progress.h"
+# include "walk.h"
+# include "compare.h"
+# include "hashindex.h"
+# include <string.h>
+# include <errno.h>
+
+static void takeSnap(struct progress *p, struct progresssnap *s){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    s->elapsed = (now.tv_sec - p->start.tv_sec) + (now.tv_nsec - p->start.tv_nsec) / 1e9;
+    s->dirs = __atomic_load_n(&walkStats.dirs, __ATOMIC_RELAXED);
+    s->entries = __atomic_load_n(&walkStats.entries, __ATOMIC_RELAXED);
+    s->compares = __atomic_load_n(&compareStats.compares, __ATOMIC_RELAXED);
+    s->bytesread = __atomic_load_n(&compareStats.bytesread, __ATOMIC_RELAXED);
+    s->comparensec = __atomic_load_n(&compareStats.nsec, __ATOMIC_RELAXED);
+    s->hashbytes = __atomic_load_n(&hashBytesRead, __ATOMIC_RELAXED);
+    s->prunedsize = __atomic_load_n(&compareStats.prunedsize, __ATOMIC_RELAXED);
+    s->prunedhash = __atomic_load_n(&compareStats.prunedhash, __ATOMIC_RELAXED);
+}
+
+// Rates are over the span since from, which is the previous report (or the start of the run for the final one)
+static void report(struct progress *p, struct progresssnap *from, struct progresssnap *to, int final){
+    double span = to->elapsed - from->elapsed;
+    if(span <= 0){span = 1e-9;}
+    double dirrate = (to->dirs - from->dirs) / span;
+    double entryrate = (to->entries - from->entries) / span;
+    double mbrate = (to->bytesread - from->bytesread) / span / 1e6;
+    double busy = (to->comparensec - from->comparensec) / 1e9 / span;
+    double hashrate = (to->hashbytes - from->hashbytes) / span / 1e6;
+    if(p->human){
+        fprintf(p->human, "%s%.1fs: %lld dirs (%.0f/s), %lld entries (%.0f/s), %lld compared (%.1f MB/s, %.2f busy), %.1f MB/s hashed, pruned %lld by size, %lld by hash\n",
+                final ? "Done after " : "", to->elapsed, to->dirs, dirrate, to->entries, entryrate, to->compares, mbrate, busy,
+                hashrate, to->prunedsize, to->prunedhash);
+        fflush(p->human);
+    }
+    if(p->metrics){
+        fprintf(p->metrics, "{\"elapsed\":%.3f,\"final\":%s,\"dirs\":%lld,\"dirs_per_sec\":%.1f,\"entries\":%lld,\"entries_per_sec\":%.1f,"
+                "\"compared\":%lld,\"bytes_compared\":%lld,\"compare_mb_per_sec\":%.2f,\"compare_busy\":%.3f,"
+                "\"bytes_hashed\":%lld,\"hash_mb_per_sec\":%.2f,\"pruned_by_size\":%lld,\"pruned_by_hash\":%lld}\n",
+                to->elapsed, final ? "true" : "false", to->dirs, dirrate, to->entries, entryrate,
+                to->compares, to->bytesread, mbrate, busy, to->hashbytes, hashrate, to->prunedsize, to->prunedhash);
+        fflush(p->metrics);
+    }
+}
+
+static void *progressThread(void *arg){
+    struct progress *p = arg;
+    pthread_mutex_lock(&p->lock);
+    while(!p->stop){
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += PROGRESS_INTERVAL_MS / 1000;
+        until.tv_nsec += (PROGRESS_INTERVAL_MS % 1000) * 1000000L;
+        if(until.tv_nsec >= 1000000000L){
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        if(pthread_cond_timedwait(&p->wake, &p->lock, &until) != ETIMEDOUT || p->stop){continue;}
+        struct progresssnap now;
+        takeSnap(p, &now);
+        report(p, &p->last, &now, 0);
+        p->last = now;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+int progressStart(struct progress *p, FILE *human, FILE *metrics){
+    memset(p, 0, sizeof(*p));
+    p->human = human;
+    p->metrics = metrics;
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    if((errno = pthread_create(&p->thread, NULL, progressThread, p))){
+        pthread_mutex_destroy(&p->lock);
+        pthread_cond_destroy(&p->wake);
+        return -1;
+    }
+    return 0;
+}
+
+void progressStop(struct progress *p){
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    struct progresssnap zero, now;
+    memset(&zero, 0, sizeof(zero));
+    takeSnap(p, &now);
+    report(p, &zero, &now, 1);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+}
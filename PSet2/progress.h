@@ -0,0 +1,44 @@
+#ifndef _PROGRESS_H
+#define _PROGRESS_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+#define PROGRESS_INTERVAL_MS 1000
+
+// One reading of every counter, rates are worked out between two of them
+struct progresssnap{
+    double elapsed;
+    long long dirs, entries;
+    long long compares, bytesread, comparensec;
+    long long hashbytes;
+    long long prunedsize, prunedhash;
+};
+
+struct progress{
+    FILE *human; // One line per interval for people, NULL for none
+    FILE *metrics; // One NDJSON record per interval for tools, NULL for none
+    struct timespec start;
+    struct progresssnap last;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+int progressStart(struct progress *p, FILE *human, FILE *metrics);
+/* Starts a thread that reports walkStats and compareStats every
+* PROGRESS_INTERVAL_MS: directories and entries per second show how fast
+* the metadata side is going, bytes compared and compare time per second
+* (which goes past 1 with several threads comparing) how busy the I/O side
+* is (along with bytes hashed), and the candidate counts how much the size
+* and hash checks saved.
+* Returns 0, or -1 if the thread could not be started.
+*/
+
+void progressStop(struct progress *p);
+/* Stops the thread and writes one last report covering the whole run.
+*/
+
+#endif
@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+
+# include "statring.h"
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/sysmacros.h>
+
+// Same raw-syscall setup as meow's ring copy, there is no liburing on the machines we build on
+int statRingInit(struct statring *r){
+#ifdef STATRING_NO_URING
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    errno = ENOSYS;
+    return -1;
+#else
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    if((r->fd = syscall(__NR_io_uring_setup, STATRING_ENTRIES, &p)) < 0){
+        r->fd = -1;
+        return -1;
+    }
+    r->entries = p.sq_entries;
+    r->sqmapsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqmapsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(r->cqmapsize > r->sqmapsize){r->sqmapsize = r->cqmapsize;}
+        r->cqmapsize = 0;
+    }
+    r->sqmap = mmap(NULL, r->sqmapsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if(r->sqmap == MAP_FAILED){
+        close(r->fd);
+        r->fd = -1;
+        return -1;
+    }
+    r->cqmap = r->sqmap;
+    if(r->cqmapsize){
+        r->cqmap = mmap(NULL, r->cqmapsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if(r->cqmap == MAP_FAILED){
+            munmap(r->sqmap, r->sqmapsize);
+            close(r->fd);
+            r->fd = -1;
+            return -1;
+        }
+    }
+    r->sqes = mmap(NULL, r->sqesize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED){
+        if(r->cqmapsize){munmap(r->cqmap, r->cqmapsize);}
+        munmap(r->sqmap, r->sqmapsize);
+        close(r->fd);
+        r->fd = -1;
+        return -1;
+    }
+    r->sqhead = (unsigned *)((char *)r->sqmap + p.sq_off.head);
+    r->sqtail = (unsigned *)((char *)r->sqmap + p.sq_off.tail);
+    r->sqmask = (unsigned *)((char *)r->sqmap + p.sq_off.ring_mask);
+    r->sqarray = (unsigned *)((char *)r->sqmap + p.sq_off.array);
+    r->cqhead = (unsigned *)((char *)r->cqmap + p.cq_off.head);
+    r->cqtail = (unsigned *)((char *)r->cqmap + p.cq_off.tail);
+    r->cqmask = (unsigned *)((char *)r->cqmap + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cqmap + p.cq_off.cqes);
+    return 0;
+#endif
+}
+
+void statRingFree(struct statring *r){
+    if(r->fd < 0){return;}
+    munmap(r->sqes, r->sqesize);
+    if(r->cqmapsize){munmap(r->cqmap, r->cqmapsize);}
+    munmap(r->sqmap, r->sqmapsize);
+    close(r->fd);
+    r->fd = -1;
+}
+
+void statxToStat(struct statx *stx, struct stat *st){
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino = stx->stx_ino;
+    st->st_mode = stx->stx_mode;
+    st->st_nlink = stx->stx_nlink;
+    st->st_size = stx->stx_size;
+    st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+static void statOne(int dirfd, struct statreq *q){
+    q->err = statx(dirfd, q->name, q->flags, STATRING_MASK, &q->stx) < 0 ? errno : 0;
+}
+
+// Queues reqs[first..first+n) and waits for all of them. Returns 0, or -1 if the ring itself failed.
+static int ringRound(struct statring *r, int dirfd, struct statreq *reqs, int first, int n){
+    unsigned tail = *r->sqtail;
+    for(int i = 0; i < n; i++){
+        struct statreq *q = &reqs[first + i];
+        unsigned idx = (tail + i) & *r->sqmask;
+        struct io_uring_sqe *sqe = &r->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = dirfd;
+        sqe->addr = (unsigned long)q->name;
+        sqe->len = STATRING_MASK;
+        sqe->off = (unsigned long)&q->stx; // addr2, where the result goes
+        sqe->statx_flags = q->flags;
+        sqe->user_data = first + i;
+        r->sqarray[idx] = idx;
+        q->err = -1; // Not back yet
+    }
+    __atomic_store_n(r->sqtail, tail + n, __ATOMIC_RELEASE);
+    int submitted = 0, done = 0;
+    while(done < n){
+        int k = syscall(__NR_io_uring_enter, r->fd, n - submitted, n - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(k < 0){
+            if(errno == EINTR){continue;}
+            if(submitted == 0){
+                __atomic_store_n(r->sqtail, tail, __ATOMIC_RELEASE); // Take back what the kernel never saw
+            }
+            return -1;
+        }
+        submitted += k;
+        unsigned head = *r->cqhead;
+        unsigned ctail = __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE);
+        for(; head != ctail; head++){
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cqmask];
+            reqs[cqe->user_data].err = cqe->res < 0 ? -cqe->res : 0;
+            done++;
+        }
+        __atomic_store_n(r->cqhead, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+int statBatch(struct statring *r, int dirfd, struct statreq *reqs, int n){
+    int i = 0, result = 0;
+    if(r && r->fd >= 0){
+        while(i < n){
+            int chunk = n - i < (int)r->entries ? n - i : (int)r->entries;
+            if(ringRound(r, dirfd, reqs, i, chunk) < 0){
+                result = -1;
+                break;
+            }
+            // A kernel that knows io_uring but not IORING_OP_STATX fails every request with EINVAL
+            if(reqs[i].err == EINVAL){
+                result = -1;
+                break;
+            }
+            i += chunk;
+        }
+    }
+    for(; i < n; i++){statOne(dirfd, &reqs[i]);}
+    return result;
+}
@@ -0,0 +1,53 @@
+#ifndef _STATRING_H
+#define _STATRING_H
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <linux/stat.h> // struct statx without needing _GNU_SOURCE in every includer
+#include <linux/io_uring.h>
+
+#define STATRING_ENTRIES 256 // Largest batch handed to the kernel in one io_uring_enter
+
+// Only what hunt looks at: type, size and identity, plus mtime and ctime for the hash index
+#define STATRING_MASK (STATX_TYPE|STATX_MODE|STATX_NLINK|STATX_INO|STATX_SIZE|STATX_MTIME|STATX_CTIME)
+
+// One statx to run relative to a directory fd. name must stay valid until the batch returns.
+struct statreq{
+    const char *name;
+    int flags; // AT_* flags for statx, e.g. AT_SYMLINK_NOFOLLOW
+    int err; // 0, or the errno statx failed with
+    struct statx stx;
+};
+
+struct statring{
+    int fd; // -1 when there is no ring
+    unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqmap, *cqmap;
+    size_t sqmapsize, cqmapsize, sqesize;
+    unsigned entries;
+};
+
+int statRingInit(struct statring *r);
+/* Sets up an io_uring for statx batches. Returns -1 (with errno set) if the
+* kernel doesn't allow io_uring or was built without it, or if this was
+* compiled with STATRING_NO_URING; statBatch then runs the calls one by one.
+*/
+
+void statRingFree(struct statring *r);
+
+int statBatch(struct statring *r, int dirfd, struct statreq *reqs, int n);
+/* Runs statx with STATRING_MASK for every request, through r when it is not
+* NULL and has a ring, and with plain statx calls otherwise. Each request
+* gets its own err. If the kernel turns the ring down partway (old kernels
+* have no IORING_OP_STATX) the rest of the batch falls back to plain calls.
+* Returns 0, or -1 if the ring failed and should not be used again.
+*/
+
+void statxToStat(struct statx *stx, struct stat *st);
+/* Fills the fields of st that STATRING_MASK covers and zeroes the rest.
+*/
+
+#endif
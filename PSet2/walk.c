@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+
+# include "walk.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <stdarg.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <stdint.h>
+# include <dirent.h>
+# include <time.h>
+# include <sys/syscall.h>
+
+#define WALK_IDLE_NSEC 2000000 // How long an idle worker sleeps before looking for work to steal again
+
+// What getdents64 fills in. glibc only wraps the call from 2.30 on, so we go through syscall() like the io_uring code.
+struct linuxdirent{
+    uint64_t ino;
+    int64_t off;
+    unsigned short reclen;
+    unsigned char type;
+    char name[];
+};
+
+int defaultWorkers(void){
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n < 1){n = 1;}
+    if(n > WALK_MAX_WORKERS){n = WALK_MAX_WORKERS;}
+    return (int)n;
+}
+
+struct walkstats walkStats;
+
+// Records a visitor or scanner result: any -1 aborts the walk, otherwise a 1 sticks so the caller hears about it
+static void noteResult(struct walker *w, int r){
+    if(r < 0){
+        __atomic_store_n(&w->abort, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->result, -1, __ATOMIC_RELAXED);
+    }
+    else if(r > 0){
+        int expected = 0;
+        __atomic_compare_exchange_n(&w->result, &expected, 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+}
+
+static void releaseDir(struct walker *w, struct walkdir *d){
+    if(d && __atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL) == 0){
+        if(d->fd >= 0){
+            close(d->fd);
+            __atomic_sub_fetch(&w->opendirs, 1, __ATOMIC_RELAXED);
+        }
+        free(d);
+    }
+}
+
+static void freeTask(struct walker *w, struct walktask *t){
+    releaseDir(w, t->parent);
+    free(t->path);
+    free(t);
+}
+
+// ---------------------------------------------------------------------------------------------
+// Deques: the owner pushes and pops at the tail (depth first, warm caches), thieves take the oldest task at the head,
+// which tends to be the biggest remaining subtree.
+
+static int queuePush(struct walkqueue *q, struct walktask *t){
+    pthread_mutex_lock(&q->lock);
+    if(q->head == q->tail){q->head = q->tail = 0;}
+    if(q->tail == q->cap){
+        long newcap = q->cap ? q->cap * 2 : 64;
+        struct walktask **grown = realloc(q->tasks, newcap * sizeof(struct walktask *));
+        if(!grown){
+            pthread_mutex_unlock(&q->lock);
+            return -1;
+        }
+        q->tasks = grown;
+        q->cap = newcap;
+    }
+    q->tasks[q->tail++] = t;
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static struct walktask *queuePop(struct walkqueue *q){
+    struct walktask *t = NULL;
+    pthread_mutex_lock(&q->lock);
+    if(q->tail > q->head){t = q->tasks[--q->tail];}
+    pthread_mutex_unlock(&q->lock);
+    return t;
+}
+
+static struct walktask *queueSteal(struct walkqueue *q){
+    struct walktask *t = NULL;
+    if(pthread_mutex_trylock(&q->lock)){return NULL;} // Someone else is in there, try another victim
+    if(q->tail > q->head){t = q->tasks[q->head++];}
+    pthread_mutex_unlock(&q->lock);
+    return t;
+}
+
+static struct walktask *findWork(struct walkworker *ww){
+    struct walker *w = ww->w;
+    struct walktask *t = queuePop(&ww->q);
+    if(t || w->nworkers == 1){return t;}
+    int start = rand_r(&ww->seed) % w->nworkers;
+    for(int i = 0; i < w->nworkers && !t; i++){
+        int victim = (start + i) % w->nworkers;
+        if(victim != ww->id){t = queueSteal(&w->workers[victim].q);}
+    }
+    return t;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Output
+
+static void flushOutput(struct walkworker *ww){
+    if(!ww->outlen){return;}
+    pthread_mutex_lock(&ww->w->outlock);
+    size_t done = 0;
+    while(done < ww->outlen){
+        ssize_t n = write(1, ww->out + done, ww->outlen - done);
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            break;
+        }
+        done += n;
+    }
+    pthread_mutex_unlock(&ww->w->outlock);
+    ww->outlen = 0;
+}
+
+void walkPrintf(struct walkworker *ww, const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(ww->out + ww->outlen, WALK_OUTBUF - ww->outlen, fmt, ap);
+    va_end(ap);
+    if(n >= 0 && ww->outlen + n < WALK_OUTBUF){
+        ww->outlen += n;
+        return;
+    }
+    // Didn't fit: flush what we have (all whole lines) and format again into the empty buffer
+    flushOutput(ww);
+    va_start(ap, fmt);
+    n = vsnprintf(ww->out, WALK_OUTBUF, fmt, ap);
+    va_end(ap);
+    if(n >= WALK_OUTBUF){n = WALK_OUTBUF - 1;} // A single line longer than the buffer gets cut, paths are far shorter
+    ww->outlen = n < 0 ? 0 : n;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Scanning
+
+static int pushTask(struct walkworker *ww, struct walkdir *parent, const char *dirpath, const char *name){
+    struct walker *w = ww->w;
+    struct walktask *t = malloc(sizeof(struct walktask));
+    size_t dirlen = strlen(dirpath);
+    if(!t || !(t->path = malloc(dirlen + strlen(name) + 2))){
+        free(t);
+        return -1;
+    }
+    memcpy(t->path, dirpath, dirlen);
+    t->path[dirlen] = '/';
+    strcpy(t->path + dirlen + 1, name);
+    t->name = t->path + dirlen + 1;
+    t->parent = parent;
+    if(parent){__atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);}
+    __atomic_add_fetch(&w->pending, 1, __ATOMIC_ACQ_REL);
+    if(queuePush(&ww->q, t) < 0){
+        __atomic_sub_fetch(&w->pending, 1, __ATOMIC_ACQ_REL);
+        freeTask(w, t);
+        return -1;
+    }
+    if(__atomic_load_n(&w->sleepers, __ATOMIC_RELAXED)){
+        pthread_mutex_lock(&w->idlelock);
+        pthread_cond_signal(&w->idlecond);
+        pthread_mutex_unlock(&w->idlelock);
+    }
+    return 0;
+}
+
+int walkStat(int dirfd, const char *name, struct stat *st, int follow){
+    struct statx stx;
+    if(statx(dirfd, name, follow ? 0 : AT_SYMLINK_NOFOLLOW, STATRING_MASK, &stx) < 0){return -1;}
+    statxToStat(&stx, st);
+    return 0;
+}
+
+// Queues a subdirectory or visits anything else
+static void handleEntry(struct walkworker *ww, struct walkdir *self, struct walktask *t, struct walkentry *e){
+    struct walker *w = ww->w;
+    if(S_ISDIR(e->st.st_mode)){
+        if(pushTask(ww, self, t->path, e->name) < 0){
+            fprintf(stderr, "ERROR: Out of memory while walking %s\n", t->path);
+            noteResult(w, -1);
+        }
+    }
+    else{
+        noteResult(w, w->visit(ww, e, w->arg));
+    }
+}
+
+// Stats the first n queued requests in one batch and hands the results on
+static void flushStats(struct walkworker *ww, struct walkdir *self, struct walktask *t, int fd, int n){
+    struct walker *w = ww->w;
+    struct walkentry e;
+    if(statBatch(&ww->ring, fd, ww->reqs, n) < 0){
+        statRingFree(&ww->ring); // The kernel turned the ring down, plain statx from here on
+    }
+    e.dirfd = fd;
+    e.dirpath = t->path;
+    for(int i = 0; i < n && !__atomic_load_n(&w->abort, __ATOMIC_RELAXED); i++){
+        struct statreq *q = &ww->reqs[i];
+        if(q->err){
+            fprintf(stderr, "Warning: Could not stat %s/%s: %s\n", t->path, q->name, strerror(q->err));
+            noteResult(w, 1);
+            continue;
+        }
+        e.name = q->name;
+        statxToStat(&q->stx, &e.st);
+        handleEntry(ww, self, t, &e);
+    }
+}
+
+static void scanDirectory(struct walkworker *ww, struct walktask *t){
+    struct walker *w = ww->w;
+    int fd;
+    if(t->parent && t->parent->fd >= 0){
+        fd = openat(t->parent->fd, t->name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    }
+    else{
+        fd = open(t->path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    }
+    releaseDir(w, t->parent);
+    t->parent = NULL;
+    if(fd < 0){
+        fprintf(stderr, "Warning: Could not open directory %s: %s\n", t->path, strerror(errno));
+        noteResult(w, 1);
+        return;
+    }
+    // Children can openat relative to us as long as we stay under the open fd budget
+    struct walkdir *self = NULL;
+    if(__atomic_add_fetch(&w->opendirs, 1, __ATOMIC_RELAXED) <= WALK_MAX_OPEN_DIRS && (self = malloc(sizeof(struct walkdir)))){
+        self->fd = dup(fd);
+        self->refs = 1;
+        if(self->fd < 0){
+            free(self);
+            self = NULL;
+        }
+    }
+    if(!self){__atomic_sub_fetch(&w->opendirs, 1, __ATOMIC_RELAXED);}
+
+    struct walkentry e;
+    e.dirfd = fd;
+    e.dirpath = t->path;
+    while(!__atomic_load_n(&w->abort, __ATOMIC_RELAXED)){
+        long n = syscall(SYS_getdents64, fd, ww->dents, WALK_DENTS_BUF);
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            fprintf(stderr, "Warning: Error while reading directory %s: %s\n", t->path, strerror(errno));
+            noteResult(w, 1);
+            errno = 0;
+            break;
+        }
+        if(n == 0){break;}
+        int nreqs = 0;
+        long seen = 0;
+        for(long off = 0; off < n && !__atomic_load_n(&w->abort, __ATOMIC_RELAXED);){
+            struct linuxdirent *d = (struct linuxdirent *)(ww->dents + off);
+            off += d->reclen;
+            if(!(strcmp(d->name,".") && strcmp(d->name,".."))){continue;} // We don't want to traverse through the . or .. entries to prevent infinite loop
+            seen++;
+            switch(d->type){
+                case DT_REG:
+                case DT_LNK:
+                case DT_UNKNOWN: // Some filesystems don't fill in d_type, those entries need the stat to find out
+                    ww->reqs[nreqs].name = d->name;
+                    ww->reqs[nreqs].flags = AT_SYMLINK_NOFOLLOW; // We don't want to traverse through symlinks just yet
+                    if(++nreqs == WALK_STAT_BATCH){
+                        flushStats(ww, self, t, fd, nreqs);
+                        nreqs = 0;
+                    }
+                    break;
+                default: // Directories and special files: the type is all we need, skip the stat
+                    memset(&e.st, 0, sizeof(e.st));
+                    e.st.st_mode = DTTOIF(d->type);
+                    e.st.st_ino = d->ino;
+                    e.name = d->name;
+                    handleEntry(ww, self, t, &e);
+                    break;
+            }
+        }
+        if(nreqs){flushStats(ww, self, t, fd, nreqs);} // Names point into dents, so finish them before the next getdents
+        __atomic_add_fetch(&walkStats.entries, seen, __ATOMIC_RELAXED);
+    }
+    close(fd);
+    releaseDir(w, self);
+    __atomic_add_fetch(&walkStats.dirs, 1, __ATOMIC_RELAXED);
+}
+
+static void *walkWorker(void *arg){
+    struct walkworker *ww = arg;
+    struct walker *w = ww->w;
+    for(;;){
+        struct walktask *t = findWork(ww);
+        if(t){
+            if(!__atomic_load_n(&w->abort, __ATOMIC_RELAXED)){scanDirectory(ww, t);}
+            freeTask(w, t);
+            // Children were counted when pushed, so pending only hits 0 once the whole tree is done
+            if(__atomic_sub_fetch(&w->pending, 1, __ATOMIC_ACQ_REL) == 0){
+                pthread_mutex_lock(&w->idlelock);
+                pthread_cond_broadcast(&w->idlecond);
+                pthread_mutex_unlock(&w->idlelock);
+            }
+            continue;
+        }
+        pthread_mutex_lock(&w->idlelock);
+        if(__atomic_load_n(&w->pending, __ATOMIC_ACQUIRE) == 0){
+            pthread_mutex_unlock(&w->idlelock);
+            break;
+        }
+        // Someone is still scanning and may push more; nap briefly, a push wakes us early
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += WALK_IDLE_NSEC;
+        if(until.tv_nsec >= 1000000000L){
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        w->sleepers++;
+        pthread_cond_timedwait(&w->idlecond, &w->idlelock, &until);
+        w->sleepers--;
+        pthread_mutex_unlock(&w->idlelock);
+    }
+    flushOutput(ww);
+    return NULL;
+}
+
+int walkTree(char *startdir, int nworkers, int flags, walkfn visit, void *arg){
+    struct walker w;
+    if(nworkers < 1){nworkers = 1;}
+    if(nworkers > WALK_MAX_WORKERS){nworkers = WALK_MAX_WORKERS;}
+    memset(&w, 0, sizeof(w));
+    w.nworkers = nworkers;
+    w.visit = visit;
+    w.arg = arg;
+    pthread_mutex_init(&w.idlelock, NULL);
+    pthread_cond_init(&w.idlecond, NULL);
+    pthread_mutex_init(&w.outlock, NULL);
+    if(!(flags & (WALK_SYNC_STAT|WALK_URING_STAT))){
+        flags |= sysconf(_SC_NPROCESSORS_ONLN) > 1 ? WALK_URING_STAT : WALK_SYNC_STAT;
+    }
+    if(!(w.workers = calloc(nworkers, sizeof(struct walkworker)))){
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+    for(int i = 0; i < nworkers; i++){
+        w.workers[i].w = &w;
+        w.workers[i].id = i;
+        w.workers[i].seed = i * 2654435761u + 1;
+        pthread_mutex_init(&w.workers[i].q.lock, NULL);
+        if(!(w.workers[i].out = malloc(WALK_OUTBUF)) || !(w.workers[i].dents = malloc(WALK_DENTS_BUF))
+           || !(w.workers[i].reqs = malloc(WALK_STAT_BATCH * sizeof(struct statreq)))){
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+        w.workers[i].ring.fd = -1;
+        if(flags & WALK_URING_STAT){statRingInit(&w.workers[i].ring);} // No ring just means plain statx calls
+    }
+
+    // The root is just a task without a parent fd, the first worker picks it up
+    struct walktask *root = malloc(sizeof(struct walktask));
+    if(!root || !(root->path = strdup(startdir))){
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+    root->name = root->path;
+    root->parent = NULL;
+    w.pending = 1;
+    queuePush(&w.workers[0].q, root);
+
+    fflush(stdout); // Anything printed before the walk must come out before the workers' buffers
+    int started = 0;
+    for(int i = 1; i < nworkers; i++){
+        if(pthread_create(&w.workers[i].thread, NULL, walkWorker, &w.workers[i])){break;}
+        started = i;
+    }
+    walkWorker(&w.workers[0]); // The calling thread is worker 0
+    for(int i = 1; i <= started; i++){
+        pthread_join(w.workers[i].thread, NULL);
+    }
+    // If the remaining workers failed to start, worker 0 still drained everything on its own
+    for(int i = 0; i < nworkers; i++){
+        struct walktask *t;
+        while((t = queuePop(&w.workers[i].q))){freeTask(&w, t);}
+        flushOutput(&w.workers[i]);
+        free(w.workers[i].q.tasks);
+        free(w.workers[i].out);
+        free(w.workers[i].dents);
+        free(w.workers[i].reqs);
+        statRingFree(&w.workers[i].ring);
+        pthread_mutex_destroy(&w.workers[i].q.lock);
+    }
+    free(w.workers);
+    pthread_mutex_destroy(&w.idlelock);
+    pthread_cond_destroy(&w.idlecond);
+    pthread_mutex_destroy(&w.outlock);
+    return w.result;
+}
@@ -0,0 +1,123 @@
+#ifndef _WALK_H
+#define _WALK_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include "statring.h"
+
+#define WALK_MAX_WORKERS 256
+#define WALK_MAX_OPEN_DIRS 512 // Directory fds kept open for openat by queued children, beyond this children reopen by path
+#define WALK_OUTBUF (64 << 10) // Per-worker output buffer, always flushed on a line boundary
+#define WALK_DENTS_BUF (256 << 10) // Per-worker getdents64 buffer, several thousand entries per call
+#define WALK_STAT_BATCH STATRING_ENTRIES // Entries stat'ed together, through io_uring when there is one
+
+// Flags for walkTree
+#define WALK_SYNC_STAT 1 // Never use io_uring, stat every entry with its own statx call
+#define WALK_URING_STAT 2 // Batch statx through io_uring whenever the kernel allows it, even on one CPU
+
+// A directory that has been opened for scanning. Queued subdirectories open themselves relative to it.
+struct walkdir{
+    int fd; // -1 once closed
+    int refs; // The scanner plus every queued child still holding it
+};
+
+struct walktask{
+    struct walkdir *parent; // NULL if the child has to reopen by path
+    char *path; // Full path, only used for printing and as the fallback open
+    char *name; // Last component, points into path
+};
+
+struct walkqueue{
+    struct walktask **tasks;
+    long head, tail, cap; // Owner works at the tail, thieves take from the head
+    pthread_mutex_t lock;
+};
+
+struct walker;
+
+struct walkworker{
+    struct walker *w;
+    int id;
+    struct walkqueue q;
+    char *out;
+    size_t outlen;
+    unsigned seed; // For picking steal victims
+    char *dents;
+    struct statreq *reqs;
+    struct statring ring; // fd is -1 when statx runs synchronously
+    pthread_t thread;
+};
+
+// One non-directory entry handed to the visitor. For regular files and symlinks st comes from statx (without following
+// symlinks) and has the fields in STATRING_MASK; for every other type the directory entry already told us the type
+// and only st_mode is filled in.
+struct walkentry{
+    int dirfd;
+    const char *dirpath;
+    const char *name;
+    struct stat st;
+};
+
+// Running totals over every walk in the process, for progress reports
+struct walkstats{
+    long long dirs; // Directories scanned
+    long long entries; // Entries read from them, . and .. aside
+};
+
+extern struct walkstats walkStats;
+
+typedef int (*walkfn)(struct walkworker *ww, struct walkentry *e, void *arg);
+/* Visitors return 0 normally, 1 for a non-fatal error, or -1 to abort the
+* whole walk. They may be called from several threads at once.
+*/
+
+struct walker{
+    int nworkers;
+    struct walkworker *workers;
+    long pending; // Tasks queued or being scanned, the walk is over when this reaches 0
+    int opendirs; // Directory fds currently held open for children
+    int abort;
+    int result;
+    int sleepers;
+    pthread_mutex_t idlelock;
+    pthread_cond_t idlecond;
+    pthread_mutex_t outlock;
+    walkfn visit;
+    void *arg;
+};
+
+int walkTree(char *startdir, int nworkers, int flags, walkfn visit, void *arg);
+/* Walks startdir with nworkers threads. Each thread keeps its own deque of
+* directories still to scan and steals from the others when it runs dry.
+* Directories are opened with openat relative to their parent and read with
+* large getdents64 calls. The entry type from the directory decides what
+* needs a stat at all: subdirectories are queued and special files visited
+* straight away, and only regular files and symlinks (or entries whose
+* filesystem doesn't report a type) get a statx. With more than one CPU
+* online those are batched through a per-thread io_uring (if the kernel
+* allows it), which saves nearly all the syscalls; the kernel runs ring
+* statx calls on its own worker threads though, so on a single CPU the
+* plain calls are faster. WALK_SYNC_STAT and WALK_URING_STAT in flags
+* override that choice.
+* visit is called for every entry that is not a directory; . and .. are
+* skipped and symlinks are never followed. Returns 0 on success, 1 if there
+* were non-fatal errors, or -1 if the walk was aborted.
+*/
+
+int walkStat(int dirfd, const char *name, struct stat *st, int follow);
+/* One statx of name relative to dirfd with STATRING_MASK, following a
+* final symlink if follow is set. Returns 0, or -1 with errno set.
+*/
+
+void walkPrintf(struct walkworker *ww, const char *fmt, ...);
+/* printf into ww's output buffer. Each call must produce whole lines; the
+* buffer is written to standard output in one piece when it fills or the
+* walk ends, so lines from different threads never interleave.
+*/
+
+int defaultWorkers(void);
+/* Number of online CPUs, clamped to 1..WALK_MAX_WORKERS.
+*/
+
+#endif
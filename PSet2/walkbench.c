@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <signal.h>
+# include <dirent.h>
+# include <time.h>
+# include <sys/stat.h>
+# include <sys/wait.h>
+# include <sys/ptrace.h>
+# include <linux/ptrace.h>
+# include "walk.h"
+
+// walkbench.c
+// By: Jeffrey Wong
+/* Benchmark for hunt's metadata path. Builds a synthetic tree (1M entries by default, pass a count
+to override, and a directory to build it in instead of a fresh one under /tmp), then walks it with
+the traversal hunt originally used (readdir, lstat of every path, stat of every symlink) and with
+walk.c's getdents64 + statx engine, with and without io_uring batching. Each variant is timed on a
+warm cache and then run again under ptrace to count the system calls it makes. All variants have to
+agree on what they saw. */
+
+#define BENCH_PER_DIR 1000 // Entries per leaf directory
+#define BENCH_EVERY_LINK 20 // One in this many entries is a symlink to a sibling file
+#define BENCH_EVERY_FIFO 50 // and one in this many a fifo, the kind of entry d_type lets us skip stat'ing
+
+// What a walk saw, compared across variants
+struct tally{
+    long entries; // Everything but directories
+    long long bytes; // Sizes of regular files plus the files symlinks resolve to
+};
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Tree
+
+int buildTree(char *root, long entries){
+    char path[4096];
+    long made = 0;
+    for(long d = 0; made < entries; d++){
+        snprintf(path, sizeof(path), "%s/d%05ld", root, d);
+        if(mkdir(path, 0755) < 0){return -1;}
+        made++; // The directory is an entry of root
+        for(long i = 0; i < BENCH_PER_DIR && made < entries; i++, made++){
+            snprintf(path, sizeof(path), "%s/d%05ld/e%04ld", root, d, i);
+            if(i > 0 && i % BENCH_EVERY_LINK == 0){
+                char target[32];
+                snprintf(target, sizeof(target), "e%04ld", i - 1);
+                if(symlink(target, path) < 0){return -1;}
+            }
+            else if(i % BENCH_EVERY_FIFO == 1){
+                if(mkfifo(path, 0644) < 0){return -1;}
+            }
+            else{
+                int fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0644);
+                if(fd < 0){return -1;}
+                // Sparse, so the sizes vary without writing any data
+                if(ftruncate(fd, (i * 7919) % 65536) < 0){
+                    close(fd);
+                    return -1;
+                }
+                close(fd);
+            }
+        }
+    }
+    return 0;
+}
+
+int removeTree(char *dname){
+    DIR *dirp = opendir(dname);
+    struct dirent *de;
+    if(!dirp){return -1;}
+    while((de = readdir(dirp))){
+        if(!(strcmp(de->d_name,".") && strcmp(de->d_name,".."))){continue;}
+        char path[strlen(dname) + strlen(de->d_name) + 2];
+        sprintf(path, "%s/%s", dname, de->d_name);
+        if(de->d_type == DT_DIR || (unlink(path) < 0 && errno == EISDIR)){removeTree(path);}
+    }
+    closedir(dirp);
+    return rmdir(dname);
+}
+
+// ---------------------------------------------------------------------------------------------
+// Variants
+
+// hunt's traversal before walk.c, minus the comparing: a path built per entry, lstat on it, and stat on symlinks
+void originalWalk(char *dname, struct tally *t){
+    DIR *dirp = opendir(dname);
+    struct dirent *de;
+    if(!dirp){return;}
+    while((de = readdir(dirp))){
+        if(!(strcmp(de->d_name,".") && strcmp(de->d_name,".."))){continue;}
+        char entname[strlen(dname) + strlen(de->d_name) + 2];
+        sprintf(entname, "%s/%s", dname, de->d_name);
+        struct stat st, linkedstats;
+        if(lstat(entname, &st) < 0){continue;}
+        switch(st.st_mode & S_IFMT){
+            case S_IFDIR:
+                originalWalk(entname, t);
+                continue;
+            case S_IFREG:
+                t->bytes += st.st_size;
+                break;
+            case S_IFLNK:
+                if(stat(entname, &linkedstats) == 0){t->bytes += linkedstats.st_size;}
+                break;
+            default:
+                break;
+        }
+        t->entries++;
+    }
+    closedir(dirp);
+}
+
+// The same work as a walk.c visitor, the way hunt's processEntry does it
+int countEntry(struct walkworker *ww, struct walkentry *e, void *arg){
+    struct tally *t = arg;
+    struct stat linkedstats;
+    if(S_ISREG(e->st.st_mode)){t->bytes += e->st.st_size;}
+    else if(S_ISLNK(e->st.st_mode) && walkStat(e->dirfd, e->name, &linkedstats, 1) == 0){t->bytes += linkedstats.st_size;}
+    t->entries++;
+    return 0;
+}
+
+void runVariant(int v, char *root, struct tally *t){
+    memset(t, 0, sizeof(*t));
+    switch(v){
+        case 0:
+            originalWalk(root, t);
+            break;
+        case 1:
+            walkTree(root, 1, WALK_SYNC_STAT, countEntry, t);
+            break;
+        case 2:
+            walkTree(root, 1, WALK_URING_STAT, countEntry, t);
+            break;
+    }
+}
+
+// Runs a variant in a traced child and counts the system calls it enters. Returns -1 if ptrace is not allowed here.
+long countSyscalls(int v, char *root){
+    fflush(stdout); // walkTree flushes stdout in the child, which would print our buffered lines twice
+    pid_t pid = fork();
+    if(pid < 0){return -1;}
+    if(pid == 0){
+        struct tally t;
+        if(ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0){_exit(2);}
+        raise(SIGSTOP);
+        runVariant(v, root, &t);
+        _exit(0);
+    }
+    int status;
+    long calls = 0;
+    if(waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)){return -1;}
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD|PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+    while(waitpid(pid, &status, 0) == pid){
+        if(WIFEXITED(status) || WIFSIGNALED(status)){break;}
+        int sig = 0;
+        if(WSTOPSIG(status) == (SIGTRAP|0x80)){
+            struct ptrace_syscall_info info;
+            if(ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY){calls++;}
+        }
+        else{
+            sig = WSTOPSIG(status); // Pass real signals on
+        }
+        ptrace(PTRACE_SYSCALL, pid, NULL, sig);
+    }
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){return -1;}
+    return calls - 1; // The final exit_group is not the walk's
+}
+
+int main(int argc, char *argv[]){
+    long entries = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+    char tmpl[] = "/tmp/walkbenchXXXXXX";
+    char *root = argc > 2 ? argv[2] : tmpl;
+    int failures = 0;
+    if(entries < 1){
+        fprintf(stderr, "ERROR: Entry count must be positive.\n");
+        return -1;
+    }
+    if(argc > 2 ? mkdir(root, 0755) < 0 : !mkdtemp(tmpl)){
+        fprintf(stderr, "ERROR: Could not create %s: %s\n", root, strerror(errno));
+        return -1;
+    }
+
+    printf("Building %ld entries under %s...\n", entries, root);
+    double start = now();
+    if(buildTree(root, entries) < 0){
+        fprintf(stderr, "ERROR: Could not build tree under %s: %s\n", root, strerror(errno));
+        removeTree(root);
+        return -1;
+    }
+    printf("Built in %.1f s\n", now() - start);
+
+    struct statring probe;
+    int haveuring = statRingInit(&probe) == 0;
+    statRingFree(&probe);
+    const char *names[] = {"readdir+lstat (original)", "getdents64+statx", "getdents64+statx io_uring"};
+    struct tally expected, t;
+    runVariant(0, root, &expected); // Warms the cache for everyone
+    printf("%ld entries visited, one worker each, warm cache:\n", expected.entries);
+    printf("  %-26s %12s %12s %14s\n", "", "ns/entry", "syscalls", "syscalls/entry");
+    for(int v = 0; v < 3; v++){
+        if(v == 2 && !haveuring){
+            printf("  %-26s io_uring not available here\n", names[v]);
+            continue;
+        }
+        runVariant(v, root, &t);
+        start = now();
+        runVariant(v, root, &t);
+        double elapsed = now() - start;
+        if(t.entries != expected.entries || t.bytes != expected.bytes){
+            fprintf(stderr, "MISMATCH: %s saw %ld entries (%lld bytes), expected %ld (%lld bytes)\n", names[v], t.entries, t.bytes, expected.entries, expected.bytes);
+            failures++;
+        }
+        long calls = countSyscalls(v, root);
+        if(calls < 0){
+            printf("  %-26s %12.1f %12s %14s\n", names[v], elapsed * 1e9 / expected.entries, "n/a", "n/a");
+        }
+        else{
+            printf("  %-26s %12.1f %12ld %14.3f\n", names[v], elapsed * 1e9 / expected.entries, calls, (double)calls / expected.entries);
+        }
+    }
+
+    if(removeTree(root) < 0){
+        fprintf(stderr, "Warning: Could not remove %s: %s\n", root, strerror(errno));
+    }
+    return failures ? 1 : 0;
+}
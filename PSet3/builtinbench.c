@@ -0,0 +1,149 @@
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <spawn.h>
+# include <time.h>
+# include <sys/wait.h>
+
+// builtinbench.c
+// By: Jeffrey Wong
+/* Benchmark for the utilities myshell runs in-process. Writes a script (10k lines by default, pass
+a count to override and the path to myshell after it) made of the echo, true, false, test, [, cat
+and sleep lines typical of our scripts, some of them redirected, and runs it through myshell with
+the fast paths and with -e, which launches every one of them from PATH. Reports lines/s for both,
+the speedup, and whether the two runs wrote exactly the same output. */
+
+extern char **environ;
+
+// Script lines, used in rotation
+static const char *mix[] = {
+    "echo building target number one",
+    "test -f %s",
+    "[ -d /tmp ]",
+    "echo -n partial",
+    "echo",
+    "true",
+    "cat %s",
+    "[ abc = abc ]",
+    "echo appended line >> %s.log",
+    "false",
+    "test 3 -lt 10 -a -n word",
+    "cat < %s",
+    "sleep 0",
+    "echo -e 'tab\\tseparated\\nfields'",
+    "true",
+};
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs myshell on script with standard output sent to out and standard error thrown away. Returns the wall time, or
+// -1 if it could not be run
+double runShell(char *shell, char *flag, char *script, char *out){
+    char *argv[4];
+    int n = 0;
+    argv[n++] = shell;
+    if(flag){argv[n++] = flag;}
+    argv[n++] = script;
+    argv[n] = NULL;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    int status;
+    double start = now();
+    if((errno = posix_spawn(&pid, shell, &actions, NULL, argv, environ))){
+        fprintf(stderr, "ERROR: Could not run %s: %s\n", shell, strerror(errno));
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+    waitpid(pid, &status, 0);
+    double elapsed = now() - start;
+    posix_spawn_file_actions_destroy(&actions);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "ERROR: %s exited with status %d\n", shell, status);
+        return -1;
+    }
+    return elapsed;
+}
+
+// 1 if the two files have the same contents
+int sameFile(const char *a, const char *b){
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    int same = fa && fb;
+    while(same){
+        int ca = getc(fa), cb = getc(fb);
+        if(ca != cb){same = 0;}
+        if(ca == EOF){break;}
+    }
+    if(fa){fclose(fa);}
+    if(fb){fclose(fb);}
+    return same;
+}
+
+int main(int argc, char *argv[]){
+    long lines = argc > 1 ? strtol(argv[1], NULL, 10) : 10000;
+    char *shell = argc > 2 ? argv[2] : "./myshell.exe";
+    char script[] = "/tmp/builtinbenchXXXXXX";
+    char data[] = "/tmp/builtinbenchXXXXXX";
+    char outs[2][64];
+    char log[64];
+    if(lines < 1){
+        fprintf(stderr, "ERROR: Line count must be positive.\n");
+        return -1;
+    }
+
+    int datafd = mkstemp(data);
+    int fd = datafd < 0 ? -1 : mkstemp(script);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "w");
+    if(!f){
+        fprintf(stderr, "ERROR: Could not create script: %s\n", strerror(errno));
+        return -1;
+    }
+    // A small file for cat and test to work on, like the config and stamp files our scripts look at
+    const char *contents = "name=builtinbench\nversion=1\n";
+    if(write(datafd, contents, strlen(contents)) < 0){
+        fprintf(stderr, "ERROR: Could not write %s: %s\n", data, strerror(errno));
+        return -1;
+    }
+    close(datafd);
+    snprintf(log, sizeof(log), "%s.log", data);
+    size_t nmix = sizeof(mix) / sizeof(*mix);
+    for(long i = 0; i < lines - 1; i++){
+        fprintf(f, mix[i % nmix], data);
+        fputc('\n', f);
+    }
+    fputs("true\n", f); // The shell exits with the last line's status
+    fclose(f);
+
+    printf("%ld lines of echo, true, false, test, [, cat and sleep through %s:\n", lines, shell);
+    char *flags[] = {NULL, "-e"};
+    const char *names[] = {"in-process", "from PATH"};
+    double elapsed[2];
+    for(int m = 0; m < 2; m++){
+        snprintf(outs[m], sizeof(outs[m]), "%s.out%d", script, m);
+        unlink(log);
+        elapsed[m] = runShell(shell, flags[m], script, outs[m]);
+        if(elapsed[m] < 0){continue;}
+        printf("  %-12s %10.0f lines/s  (%.3f s)\n", names[m], lines / elapsed[m], elapsed[m]);
+    }
+    int failed = elapsed[0] < 0 || elapsed[1] < 0;
+    if(!failed){
+        int same = sameFile(outs[0], outs[1]);
+        printf("  speedup %.1fx, output %s\n", elapsed[1] / elapsed[0], same ? "identical" : "DIFFERS");
+        failed = !same;
+    }
+    unlink(outs[0]);
+    unlink(outs[1]);
+    unlink(log);
+    unlink(script);
+    unlink(data);
+    return failed ? 1 : 0;
+}
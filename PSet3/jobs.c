@@ -0,0 +1,267 @@
+# include "jobs.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <signal.h>
+# include <unistd.h>
+# include <sys/wait.h>
+# include <sys/epoll.h>
+# include <sys/signalfd.h>
+# include <sys/syscall.h>
+
+#define SIGFD_TAG ((uint64_t)-1) // epoll data for the signalfd; every other event carries a pid
+
+static int pidfdOpen(pid_t pid){
+#if defined(SYS_pidfd_open) && !defined(JOBS_NO_PIDFD)
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int jobsInit(struct jobtable *t){
+    memset(t, 0, sizeof(*t));
+    t->sigfd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &t->epoch);
+    if((t->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0){return -1;}
+    int probe = pidfdOpen(getpid());
+    if(probe >= 0){
+        close(probe);
+        return 0;
+    }
+    // No pidfds: SIGCHLD has to be blocked so it queues on the signalfd instead of being discarded
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = SIGFD_TAG;
+    if(sigprocmask(SIG_BLOCK, &mask, NULL) < 0 || (t->sigfd = signalfd(-1, &mask, SFD_CLOEXEC|SFD_NONBLOCK)) < 0
+       || epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->sigfd, &ev) < 0){
+        close(t->epfd);
+        return -1;
+    }
+    return 0;
+}
+
+struct job *jobStart(struct jobtable *t, const char *text, int background){
+    int slot;
+    int id = 1;
+    for(slot = 0; slot < t->capacity && t->jobs[slot]; slot++){}
+    for(int i = 0; i < t->capacity; i++){ // Background jobs are numbered like sh numbers them: one past the highest still running
+        if(t->jobs[i] && t->jobs[i]->background && t->jobs[i]->id >= id){id = t->jobs[i]->id + 1;}
+    }
+    if(slot == t->capacity){
+        int newcap = t->capacity ? t->capacity * 2 : 16;
+        struct job **grown = realloc(t->jobs, newcap * sizeof(*grown));
+        if(!grown){return NULL;}
+        memset(grown + t->capacity, 0, (newcap - t->capacity) * sizeof(*grown));
+        t->jobs = grown;
+        t->capacity = newcap;
+    }
+    struct job *j = calloc(1, sizeof(*j)); // Allocated one by one so callers can hold on to it while the table grows
+    if(!j){return NULL;}
+    if(!(j->text = strdup(text))){
+        free(j);
+        return NULL;
+    }
+    j->id = background ? id : 0;
+    j->background = background;
+    j->report = stderr;
+    for(int e = 0; e < PROFILE_EVENTS; e++){j->counters[e] = -1;}
+    clock_gettime(CLOCK_MONOTONIC, &j->start);
+    t->jobs[slot] = j;
+    return j;
+}
+
+int jobAddProc(struct jobtable *t, struct job *j, pid_t pid, int last, int *perf){
+    struct proc *grown = realloc(j->procs, (j->nprocs + 1) * sizeof(struct proc));
+    if(!grown){
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    j->procs = grown;
+    struct proc *p = &j->procs[j->nprocs++];
+    p->pid = pid;
+    p->pidfd = -1;
+    p->done = 0;
+    p->last = last;
+    for(int e = 0; e < PROFILE_EVENTS; e++){p->perf[e] = perf ? perf[e] : -1;}
+    j->running++;
+    if(t->sigfd < 0){
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = (uint64_t)pid;
+        if((p->pidfd = pidfdOpen(pid)) < 0 || epoll_ctl(t->epfd, EPOLL_CTL_ADD, p->pidfd, &ev) < 0){
+            fprintf(stderr, "Error while attempting to watch child %d: %s\n", pid, strerror(errno));
+            errno = 0;
+            if(p->pidfd >= 0){close(p->pidfd);}
+            p->pidfd = -1;
+            p->done = 1;
+            j->running--;
+            waitpid(pid, NULL, 0);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void jobFree(struct jobtable *t, struct job *j){
+    for(int i = 0; i < t->capacity; i++){
+        if(t->jobs[i] == j){t->jobs[i] = NULL;}
+    }
+    for(int i = 0; i < j->nprocs; i++){
+        if(j->procs[i].pidfd >= 0){close(j->procs[i].pidfd);}
+        for(int e = 0; e < PROFILE_EVENTS; e++){
+            if(j->procs[i].perf[e] >= 0){close(j->procs[i].perf[e]);}
+        }
+    }
+    free(j->procs);
+    free(j->text);
+    free(j);
+}
+
+// Prints how one child ended (unless report is NULL) and returns its status in lastexitstatus form
+static int reportChild(FILE *report, pid_t cpid, int status){
+    if(status != 0){
+        if(WIFSIGNALED(status)){
+            if(report){fprintf(report, "Child process %d exited with signal %d: %s\n", cpid, WTERMSIG(status), strsignal(WTERMSIG(status)));}
+            return WTERMSIG(status)+128; // Need to add 128 to denote exit caused by signal
+        }
+        if(report){fprintf(report, "Child process %d exited with exit code %d\n", cpid, WEXITSTATUS(status));}
+        return WEXITSTATUS(status);
+    }
+    if(report){fprintf(report, "Child process %d exited normally\n", cpid);}
+    return 0;
+}
+
+// One NDJSON line with everything measured about a finished job
+static void writeProfile(struct jobtable *t, struct job *j, double real){
+    static const char *names[PROFILE_EVENTS] = {"cycles", "instructions", "cache_misses", "task_clock_ns"};
+    FILE *f = t->profile;
+    double start = (j->start.tv_sec - t->epoch.tv_sec) + (j->start.tv_nsec - t->epoch.tv_nsec) / 1e9;
+    fprintf(f, "{\"line\":%ld,\"job\":%d,\"cmd\":", j->line, j->id);
+    jsonString(f, j->text);
+    fprintf(f, ",\"background\":%s,\"pids\":[", j->background ? "true" : "false");
+    for(int i = 0; i < j->nprocs; i++){fprintf(f, "%s%d", i ? "," : "", j->procs[i].pid);}
+    fprintf(f, "],\"status\":%d,\"start\":%.6f,\"real\":%.6f,\"user\":%ld.%06ld,\"sys\":%ld.%06ld", j->status, start, real,
+            j->usage.ru_utime.tv_sec, j->usage.ru_utime.tv_usec, j->usage.ru_stime.tv_sec, j->usage.ru_stime.tv_usec);
+    fprintf(f, ",\"maxrss_kb\":%ld,\"minflt\":%ld,\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld,\"inblock\":%ld,\"oublock\":%ld",
+            j->usage.ru_maxrss, j->usage.ru_minflt, j->usage.ru_majflt, j->usage.ru_nvcsw, j->usage.ru_nivcsw, j->usage.ru_inblock, j->usage.ru_oublock);
+    for(int e = 0; e < PROFILE_EVENTS; e++){
+        if(j->counters[e] < 0){fprintf(f, ",\"%s\":null", names[e]);}
+        else{fprintf(f, ",\"%s\":%lld", names[e], j->counters[e]);}
+    }
+    fprintf(f, "}\n");
+}
+
+static void finishJob(struct jobtable *t, struct job *j){
+    struct timespec difftime;
+    double real = elapsedSince(&j->start, &difftime);
+    addUsage(&t->usage, &j->usage);
+    t->finished++;
+    if(j->background){fprintf(j->report, "[%d] Done (%d): %s\n", j->id, j->status, j->text);}
+    if(!j->quiet){fprintf(j->report, "Real: %ld.%.6lds User: %ld.%.6lds Sys: %ld.%.6lds\n", difftime.tv_sec, difftime.tv_nsec / 1000, j->usage.ru_utime.tv_sec, j->usage.ru_utime.tv_usec, j->usage.ru_stime.tv_sec, j->usage.ru_stime.tv_usec);}
+    if(t->profile){writeProfile(t, j, real);}
+    if(j->background){jobFree(t, j);} // Nobody is waiting on it, the foreground job is freed by whoever started it
+}
+
+// Collects p if it has exited. wait4 on the exact pid gives that child's own rusage.
+static void reapProc(struct jobtable *t, struct job *j, struct proc *p){
+    int status;
+    struct rusage rusg;
+    pid_t cpid;
+    if(p->done){return;}
+    if((cpid = wait4(p->pid, &status, WNOHANG, &rusg)) == 0){return;} // Still running
+    if(cpid < 0){
+        if(errno == EINTR){return;}
+        fprintf(stderr, "Error while attempting to wait for child: %s\n", strerror(errno));
+        errno = 0;
+        status = 0;
+        memset(&rusg, 0, sizeof(rusg));
+    }
+    p->done = 1;
+    if(p->pidfd >= 0){
+        close(p->pidfd); // Also takes it out of the epoll set
+        p->pidfd = -1;
+    }
+    int result = reportChild(j->quiet ? NULL : j->report, p->pid, status);
+    if(p->last){j->status = result;} // A pipeline's status is its last stage's
+    addUsage(&j->usage, &rusg);
+    profileCollect(p->perf, j->counters); // The counts are final now that it has been reaped
+    if(--j->running == 0){finishJob(t, j);}
+}
+
+static void reapPid(struct jobtable *t, pid_t pid){
+    for(int i = 0; i < t->capacity; i++){
+        struct job *j = t->jobs[i];
+        for(int k = 0; j && k < j->nprocs; k++){
+            if(j->procs[k].pid == pid){
+                reapProc(t, j, &j->procs[k]);
+                return;
+            }
+        }
+    }
+}
+
+// SIGCHLD says nothing about which child, so every running one gets a look
+static void reapAll(struct jobtable *t){
+    struct signalfd_siginfo info;
+    while(read(t->sigfd, &info, sizeof(info)) == sizeof(info)){} // Drain, several exits may have merged into one signal
+    errno = 0; // The last read ends in EAGAIN
+    for(int i = 0; i < t->capacity; i++){
+        struct job *j = t->jobs[i];
+        for(int k = 0; j && k < j->nprocs; k++){
+            reapProc(t, j, &j->procs[k]);
+            if(!t->jobs[i]){break;} // A finished background job frees itself
+        }
+    }
+}
+
+static int anyRunning(struct jobtable *t){
+    for(int i = 0; i < t->capacity; i++){
+        if(t->jobs[i] && t->jobs[i]->running){return 1;}
+    }
+    return 0;
+}
+
+// Handles epoll events until fg is done, any job finishes (any set), every job is done (block set) or, with none of
+// those, until nothing more has exited
+static void reapLoop(struct jobtable *t, struct job *fg, int block, int any){
+    struct epoll_event events[JOBS_MAX_EVENTS];
+    long finished = t->finished;
+    for(;;){
+        if(fg && fg->running == 0){return;}
+        if(any && t->finished != finished){return;}
+        if(!fg && !anyRunning(t)){return;}
+        int n = epoll_wait(t->epfd, events, JOBS_MAX_EVENTS, fg || block || any ? -1 : 0);
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            fprintf(stderr, "Error while attempting to wait for child: %s\n", strerror(errno));
+            errno = 0;
+            return;
+        }
+        if(n == 0){return;} // Only when polling: nothing has exited
+        for(int i = 0; i < n; i++){
+            if(events[i].data.u64 == SIGFD_TAG){reapAll(t);}
+            else{reapPid(t, (pid_t)events[i].data.u64);}
+        }
+    }
+}
+
+void jobsReap(struct jobtable *t, struct job *fg, int block){
+    reapLoop(t, fg, block, 0);
+}
+
+void jobsWaitAny(struct jobtable *t){
+    reapLoop(t, NULL, 0, 1);
+}
+
+void jobsList(struct jobtable *t){
+    for(int i = 0; i < t->capacity; i++){
+        struct job *j = t->jobs[i];
+        if(j && j->background){printf("[%d] Running (%d of %d processes): %s\n", j->id, j->running, j->nprocs, j->text);}
+    }
+}
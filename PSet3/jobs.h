@@ -0,0 +1,87 @@
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "profile.h"
+
+#define JOBS_MAX_EVENTS 32 // epoll events handled per wakeup
+
+struct proc{
+    pid_t pid;
+    int pidfd; // -1 when reaping through signalfd
+    int done;
+    int last; // Last stage of its pipeline, whose status becomes the job's
+    int perf[PROFILE_EVENTS]; // perf_event_open counters when profiling, -1 otherwise
+};
+
+// One command line: a single command or a pipeline, in the foreground or started with &
+struct job{
+    int id; // Job number printed for background jobs, 0 in the foreground
+    struct proc *procs;
+    int nprocs, running;
+    int background;
+    int status; // Exit status of the last stage, in lastexitstatus form
+    struct timespec start; // CLOCK_MONOTONIC
+    struct rusage usage; // Summed over every process in the job, see addUsage
+    long long counters[PROFILE_EVENTS]; // Summed perf counts, -1 where none were taken
+    long line; // Script line the job came from, for profile records
+    char *text; // The command line, for reporting background jobs
+    FILE *report; // Where the per-child lines and times go, stderr unless the caller changes it
+    int quiet; // Prints neither, like a utility run inside the shell, whose place this job is taking
+};
+
+struct jobtable{
+    struct job **jobs; // NULL for a free slot
+    int capacity;
+    int epfd;
+    int sigfd; // signalfd for SIGCHLD when the kernel has no pidfd_open, -1 otherwise
+    long finished; // Jobs that have completed so far
+    struct rusage usage; // Of every completed job
+    FILE *profile; // Gets an NDJSON record per finished job when not NULL
+    struct timespec epoch; // When the table was set up, profile records give start times from here
+};
+
+int jobsInit(struct jobtable *t);
+/* Sets up the epoll instance children are reaped through. Each child gets a
+* pidfd (pidfd_open, Linux 5.3+) that becomes readable when it exits; on
+* older kernels (or built with -DJOBS_NO_PIDFD) SIGCHLD is blocked and
+* read from a signalfd instead.
+* Returns 0, or -1 with errno set.
+*/
+
+struct job *jobStart(struct jobtable *t, const char *text, int background);
+/* Adds an empty job and starts its clock. Returns NULL if memory ran out.
+*/
+
+int jobAddProc(struct jobtable *t, struct job *j, pid_t pid, int last, int *perf);
+/* Records a launched process as part of j, last marking the pipeline's
+* final stage. perf is NULL or the counters profileAttach opened on it,
+* which the job takes over and reads once the process has been reaped.
+* Returns 0, or -1 if it could not be watched (it is then waited for on
+* the spot).
+*/
+
+void jobsReap(struct jobtable *t, struct job *fg, int block);
+/* Reaps every child that has exited, printing the usual per-child lines
+* and, when a job's last process is gone, its Real/User/Sys times (with
+* "[id] Done" in front for background jobs) and its profile record. If fg is not NULL it returns
+* once fg has finished; otherwise if block is set it waits for every job
+* and if not it only takes what is already there. A finished fg is left
+* in the table for the caller to read and pass to jobFree.
+*/
+
+void jobsWaitAny(struct jobtable *t);
+/* Blocks until at least one more job has finished, or returns at once if
+* none are running.
+*/
+
+void jobFree(struct jobtable *t, struct job *j);
+
+void jobsList(struct jobtable *t);
+/* Prints the background jobs still running, for the jobs builtin.
+*/
+
+#endif
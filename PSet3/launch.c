@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+
+# include "launch.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <spawn.h>
+# include <signal.h>
+# include <linux/limits.h>
+# include <sys/stat.h>
+
+extern char **environ;
+
+static const char *channelName(int fd){
+    switch(fd){
+        case 0:
+            return "standard input";
+        case 1:
+            return "standard output";
+        case 2:
+            return "standard error";
+        default:
+            return NULL;
+    }
+}
+
+// Used to redirect standard input, output, and error to files in child.
+int redirectStd(int oldfd, char *fname, int flags){
+    int newfd;
+    const char *channel = channelName(oldfd); // Mostly for printing an appropriate error
+    if(!channel){
+        fprintf(stderr, "Error: Tried to redirect non-standard file descriptor: %d\n", oldfd);
+        return -1;
+    }
+    if((newfd = open(fname,flags,0666)) < 0){
+        fprintf(stderr, "Error: Could not redirect %s to %s: %s\n", channel, fname, strerror(errno));
+        return -1;
+    }
+    if(dup2(newfd,oldfd) < 0){
+        fprintf(stderr, "Attempt to dup %s to %s failed: %s\n", fname, channel, strerror(errno)); // This should not happen normally with standard channels
+        return -1;
+    }
+    close(newfd);
+    return 0;
+}
+
+static int forkCommand(char **argv, const char *path, struct redirect *r, pid_t *pid){
+    sigset_t none;
+    sigemptyset(&none);
+    switch(*pid = fork()){
+        case -1:
+            fprintf(stderr, "Error occured while attempting to fork: %s\n", strerror(errno));
+            return 1;
+        case 0: // Child Process
+            sigprocmask(SIG_SETMASK, &none, NULL);
+            if(r->pipein >= 0 && dup2(r->pipein, 0) < 0){_exit(1);} // The pipe ends themselves are close-on-exec
+            if(r->pipeout >= 0 && dup2(r->pipeout, 1) < 0){_exit(1);}
+            if(r->infile && redirectStd(0, r->infile, O_RDONLY) < 0){_exit(1);}
+            if(r->outfile && redirectStd(1, r->outfile, O_WRONLY | O_CREAT | r->outflag) < 0){_exit(1);}
+            if(r->errfile && redirectStd(2, r->errfile, O_WRONLY | O_CREAT | r->errflag) < 0){_exit(1);}
+            if(r->gate >= 0){ // Whatever the parent wants to set up on us before exec
+                char go;
+                while(read(r->gate, &go, 1) < 0 && errno == EINTR){}
+            }
+            if(path){execve(path, argv, environ);} // Skips the walk down PATH
+            if(!path || errno == ENOENT || errno == ENOEXEC){execvp(argv[0],argv);} // execvp runs a script with no #! through /bin/sh
+            fprintf(stderr, "Error attempting to exec process %s: %s\n", argv[0], strerror(errno));
+            _exit(127); // _exit, so the child never flushes stdio buffers it shares with the shell
+        default:
+            return 0;
+    }
+}
+
+// The file posix_spawnp would have found for name, into buf: name itself if it has a slash, otherwise the first
+// executable regular file called name in a directory of PATH. Returns NULL if there is none.
+static const char *searchPath(const char *name, char *buf, size_t size){
+    const char *dirs = getenv("PATH");
+    struct stat st;
+    if(strchr(name, '/')){return name;}
+    if(!dirs){dirs = "/bin:/usr/bin";}
+    for(const char *dir = dirs, *end; ; dir = end + 1){
+        end = strchrnul(dir, ':');
+        if((size_t)snprintf(buf, size, "%.*s%s%s", (int)(end - dir), dir, end == dir ? "" : "/", name) < size &&
+           stat(buf, &st) == 0 && S_ISREG(st.st_mode) && access(buf, X_OK) == 0){return buf;}
+        if(!*end){return NULL;}
+    }
+}
+
+// glibc's posix_spawn does not fall back to /bin/sh the way execvp does when the kernel will not run a file, so a
+// script with no #! line is handed to it here. Returns 0 or an errno value, like posix_spawn.
+static int spawnScript(char **argv, const char *path, posix_spawn_file_actions_t *actions, posix_spawnattr_t *attr, pid_t *pid){
+    char found[PATH_MAX];
+    int argc = 0;
+    if(!path && !(path = searchPath(argv[0], found, sizeof(found)))){return ENOEXEC;}
+    while(argv[argc]){argc++;}
+    char *shargv[argc + 2];
+    shargv[0] = "/bin/sh";
+    shargv[1] = (char *)path;
+    memcpy(shargv + 2, argv + 1, argc * sizeof(char *)); // The rest of argv and its NULL
+    return posix_spawn(pid, "/bin/sh", actions, attr, shargv, environ);
+}
+
+// The parent opens the files (close-on-exec, so nothing else inherits them) and the child only has to dup2 them into
+// place, which posix_spawn can do in its vfork'd child without touching our address space.
+static int spawnCommand(char **argv, const char *path, struct redirect *r, pid_t *pid){
+    char *files[3] = {r->infile, r->outfile, r->errfile};
+    int flags[3] = {O_RDONLY, O_WRONLY | O_CREAT | r->outflag, O_WRONLY | O_CREAT | r->errflag};
+    int fds[3] = {-1, -1, -1};
+    int pipes[3] = {r->pipein, r->pipeout, -1};
+    int result = 0;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none;
+    sigemptyset(&none);
+    if((errno = posix_spawn_file_actions_init(&actions))){
+        fprintf(stderr, "Error occured while attempting to spawn: %s\n", strerror(errno));
+        return 1;
+    }
+    if((errno = posix_spawnattr_init(&attr))){
+        fprintf(stderr, "Error occured while attempting to spawn: %s\n", strerror(errno));
+        posix_spawn_file_actions_destroy(&actions);
+        return 1;
+    }
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    for(int i = 0; i < 2 && result == 0; i++){
+        if(pipes[i] >= 0 && !files[i] && (errno = posix_spawn_file_actions_adddup2(&actions, pipes[i], i))){
+            fprintf(stderr, "Attempt to dup pipe to %s failed: %s\n", channelName(i), strerror(errno));
+            result = 1;
+        }
+    }
+    for(int i = 0; i < 3 && result == 0; i++){
+        if(!files[i]){continue;}
+        if((fds[i] = open(files[i], flags[i] | O_CLOEXEC, 0666)) < 0){
+            fprintf(stderr, "Error: Could not redirect %s to %s: %s\n", channelName(i), files[i], strerror(errno));
+            result = 1;
+        }
+        else if((errno = posix_spawn_file_actions_adddup2(&actions, fds[i], i))){
+            fprintf(stderr, "Attempt to dup %s to %s failed: %s\n", files[i], channelName(i), strerror(errno));
+            result = 1;
+        }
+    }
+    if(result == 0 && (errno = path ? posix_spawn(pid, path, &actions, &attr, argv, environ) : posix_spawnp(pid, argv[0], &actions, &attr, argv, environ)) &&
+       (errno != ENOEXEC || (errno = spawnScript(argv, path, &actions, &attr, pid)))){
+        if(path && errno == ENOENT){result = LAUNCH_STALE;}
+        else{
+            fprintf(stderr, "Error attempting to exec process %s: %s\n", argv[0], strerror(errno));
+            result = 127;
+        }
+    }
+    for(int i = 0; i < 3; i++){
+        if(fds[i] >= 0){close(fds[i]);}
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    errno = 0;
+    return result;
+}
+
+int launchCommand(char **argv, const char *path, struct redirect *r, int method, pid_t *pid){
+    if(method == LAUNCH_FORK){return forkCommand(argv, path, r, pid);}
+    return spawnCommand(argv, path, r, pid);
+}
@@ -0,0 +1,39 @@
+#ifndef _LAUNCH_H
+#define _LAUNCH_H
+
+#include <sys/types.h>
+
+// How external commands are started
+#define LAUNCH_SPAWN 0 // posix_spawnp, which glibc runs on clone(CLONE_VM|CLONE_VFORK): no page tables are copied
+#define LAUNCH_FORK 1 // fork + execvp, the original path, kept for comparison and for systems where spawn misbehaves
+
+#define LAUNCH_STALE -1 // launchCommand was given a path that no longer exists
+
+// Redirections parsed from a command line, NULL file names mean the channel is left alone
+struct redirect{
+    char *infile, *outfile, *errfile;
+    int outflag, errflag; // O_TRUNC or O_APPEND
+    int pipein, pipeout; // Pipe ends for standard input and output in a pipeline, -1 for none. A file redirection wins.
+    int gate; // With LAUNCH_FORK, the read end of a pipe the child waits on for a byte before exec'ing, -1 for none
+};
+
+int launchCommand(char **argv, const char *path, struct redirect *r, int method, pid_t *pid);
+/* Starts path, or argv[0] searched for in PATH if path is NULL, with argv and r's redirections
+* applied to standard input, output and error, without waiting for it.
+* The child starts with an empty signal mask whatever the shell has blocked.
+* On success stores the child's pid in *pid and returns 0. Otherwise prints
+* the same messages myshell always has and returns the status the command
+* should be recorded with: 1 if a redirection could not be opened, 127 if
+* the command could not be run. With LAUNCH_FORK these failures happen in
+* the child instead, which then exits with that status like it used to.
+* If path does not exist LAUNCH_STALE is returned without printing
+* anything, so the caller can look again; a forked child searches PATH
+* itself in that case.
+*/
+
+int redirectStd(int oldfd, char *fname, int flags);
+/* Opens fname with flags and dup2's it onto oldfd (0, 1 or 2). Returns 0,
+* or -1 after printing why not.
+*/
+
+#endif
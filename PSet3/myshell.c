@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 # include <stdio.h>
 # include <stdlib.h>
 # include <string.h>
@@ -11,174 +13,402 @@
 # include <time.h>
 # include <sys/time.h>
 # include <sys/signal.h>
+# include <sys/mman.h>
+# include "launch.h"
+# include "jobs.h"
+# include "parse.h"
+# include "pathcache.h"
+# include "utils.h"
+# include "script.h"
 
 // myshell.c
 // By: Jeffrey Wong
 /* This program mimics some of the basic functionality of the UNIX shell.
 It accepts commands from a parent shell or shell scripts then executes line by line.
-I/O redirection is supported, as are the built-in commands cd, pwd, and exit.  */
+A script file is mapped into memory whole (see script.h), so lines can be any length and a line
+ending in \ carries on onto the next. With -C the whole script is parsed into a table of commands
+before the first one runs.
+I/O redirection is supported, as are the built-in commands cd, pwd, exit, wait, jobs and hash.
+Words can be quoted with '...' or "..." and characters escaped with \ (see parse.h).
+Commands can be joined into pipelines with | and run in the background with a trailing &.
+External commands are started with posix_spawn; -f makes myshell fork and exec them instead.
+Where a command lives in PATH is looked up once and remembered (hash lists, hash -r forgets).
+Children are reaped through pidfds on an epoll set (see jobs.c), so background jobs finish
+while later lines run; each job still reports its Real/User/Sys times when it is done.
+With -j N up to N script lines run at once. Each line's output is held in memory and written
+out in script order, so it reads the same as a serial run, and a summary of the whole script's
+wall and CPU time is printed at the end.
+With -p FILE every job also gets an NDJSON record in FILE: CLOCK_MONOTONIC timing, the wait4
+rusage fields and, where perf_event_open is allowed, cycles, instructions, cache misses and
+task clock. Profiled commands are forked rather than spawned so the counters are in place
+before they exec.
+echo, true, false, test, [, cat and sleep run inside myshell rather than as processes when they
+are a line of their own (see utils.h), with the line's redirections applied to the shell's own
+0, 1 and 2 while they run. -e turns that off and runs them from PATH like any other command. */
+
+struct pathcache pathcache; // Where each command name was last found in PATH, see the hash builtin
+
+int profiling = 0; // -p: commands are forked behind a gate so profileAttach can put counters on them before they exec
+
+int fastpaths = 1; // -e clears it: echo, test and friends are run from PATH instead of in the shell
 
-// Gets a null-terminated substring of length len starting from position pos from str
-char* substring(char *str, int pos, int len){
-    if(pos+len > strlen(str)){
-        fprintf(stderr, "Error while calling substring: Length requested exceeds available characters.");
-        return NULL;
+// Runs a utility in the shell with the stage's redirections dup2'd over 0, 1 and 2, then puts the shell's own back.
+// Returns its exit status, or 1 if a redirection failed, as a child that could not set it up would.
+int runUtility(const struct utility *u, struct stage *st){
+    struct redirect *r = &st->redir;
+    char *files[3] = {r->infile, r->outfile, r->errfile};
+    int flags[3] = {O_RDONLY, O_WRONLY | O_CREAT | r->outflag, O_WRONLY | O_CREAT | r->errflag};
+    int saved[3] = {-1, -1, -1};
+    int status = 0;
+    fflush(stdout); // Whatever the shell printed goes where 1 is now, not where the redirection sends it
+    for(int fd = 0; fd < 3 && !status; fd++){
+        if(!files[fd]){continue;}
+        if((saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 3)) < 0){
+            fprintf(stderr, "Error: Could not save file descriptor %d: %s\n", fd, strerror(errno));
+            status = 1;
+        }
+        else if(redirectStd(fd, files[fd], flags[fd]) < 0){status = 1;}
     }
-    char temp[4096];
-    memcpy(temp,str+pos,len);
-    temp[pos+len] = '\0';
-    char *result = strdup(temp); // This implicitly mallocs, make sure to free later
-    return result;
+    if(!status){status = u->run(st->argc, st->argv);}
+    for(int fd = 0; fd < 3; fd++){
+        if(saved[fd] < 0){continue;}
+        dup2(saved[fd], fd);
+        close(saved[fd]);
+    }
+    errno = 0;
+    return status;
 }
 
-// Used to redirect standard input, output, and error to files in child.
-int redirectStd(int oldfd, char *fname, int flags){
-    int newfd;
-    char *channel; // Mostly for printing an appropriate error
-    switch(oldfd){
-        case 0:
-            channel = "standard input";
-            break;
-        case 1:
-            channel = "standard output";
-            break;
-        case 2:
-            channel = "standard error";
-            break;
-        default:
-            fprintf(stderr, "Error: Tried to redirect non-standard file descriptor: %d\n", oldfd);
-            return -1;
+// Launches one stage from the path cache. A cached path that has gone away is forgotten and PATH searched again.
+// When profiling, perf gets the stage's counters.
+int launchStage(char **argv, struct redirect *r, int method, pid_t *pid, int *perf){
+    int gate[2] = {-1, -1};
+    if(profiling){
+        if(pipe2(gate, O_CLOEXEC) < 0){
+            fprintf(stderr, "Warning: Could not create pipe, %s runs unprofiled: %s\n", argv[0], strerror(errno));
+            errno = 0;
+        }
+        r->gate = gate[0];
+        method = LAUNCH_FORK; // A spawned child has exec'd before we get to attach anything
     }
-    if((newfd = open(fname,flags,0666)) < 0){
-        fprintf(stderr, "Error: Could not redirect %s to %s: %s\n", channel, fname, strerror(errno));
-        return -1;
+    const char *path = pathLookup(&pathcache, argv[0]);
+    int failed = path ? launchCommand(argv, path, r, method, pid) : LAUNCH_STALE;
+    if(failed == LAUNCH_STALE && path && !strchr(argv[0], '/')){
+        pathForget(&pathcache, argv[0]);
+        if((path = pathLookup(&pathcache, argv[0]))){failed = launchCommand(argv, path, r, method, pid);}
     }
-    if(dup2(newfd,oldfd) < 0){
-        fprintf(stderr, "Attempt to dup %s to %s failed: %s\n", fname, channel, strerror(errno)); // This should not happen normally with standard channels
-        return -1;
+    if(failed == LAUNCH_STALE){
+        fprintf(stderr, "Error attempting to exec process %s: %s\n", argv[0], strerror(path ? ENOENT : errno));
+        errno = 0;
+        failed = 127;
+    }
+    if(gate[0] >= 0){
+        if(!failed){profileAttach(*pid, perf);}
+        if(write(gate[1], "", 1) < 0){errno = 0;} // Lets the child exec. It is gone already if this fails.
+        close(gate[0]);
+        close(gate[1]);
+        r->gate = -1;
+    }
+    return failed;
+}
+
+// Starts every stage of a pipeline as part of job, connected stdout to stdin. Returns 0, or the status of the
+// last stage if that one could not be started. Stages that fail to start simply leave their neighbours a closed pipe.
+int launchPipeline(struct jobtable *jobs, struct job *job, struct cmdline *cl, int method){
+    int prevread = -1, result = 0, nstages = cl->nstages;
+    for(int s = 0; s < nstages; s++){
+        struct redirect *r = &cl->stages[s].redir;
+        int fds[2] = {-1, -1};
+        pid_t pid;
+        if(s < nstages-1 && pipe2(fds, O_CLOEXEC) < 0){ // Close-on-exec so only the stage that dup2's an end holds it
+            fprintf(stderr, "Error while attempting to create pipe: %s\n", strerror(errno));
+            errno = 0;
+            result = 1;
+            break;
+        }
+        r->pipein = prevread;
+        r->pipeout = fds[1];
+        int perf[PROFILE_EVENTS];
+        int failed = launchStage(cl->stages[s].argv, r, method, &pid, perf);
+        if(prevread >= 0){close(prevread);}
+        if(fds[1] >= 0){close(fds[1]);}
+        prevread = fds[0];
+        if(failed){
+            if(s == nstages-1){result = failed;}
+            continue;
+        }
+        jobAddProc(jobs, job, pid, s == nstages-1, profiling ? perf : NULL);
     }
-    close(newfd);
+    if(prevread >= 0){close(prevread);}
+    return result;
+}
+
+// A script line running under -j, whose output is held back until every line before it has been written out
+struct pendingline{
+    struct job *job; // NULL if none of its commands could be started
+    int status; // The launch failure status in that case
+    int outfd; // memfd holding the line's standard output
+    FILE *err; // memfd holding its standard error, which the shell's reports about the line also go to
+};
+
+// The lines of a -j run that have been started but not yet written out, oldest first
+struct window{
+    struct pendingline *lines; // Ring of max entries starting at head
+    int max, head, count;
+    int savedout, savederr; // The shell's own standard output and error while a line's are swapped in
+    long lines_run;
+    struct timespec start;
+};
+
+int windowInit(struct window *w, int max){
+    memset(w, 0, sizeof(*w));
+    clock_gettime(CLOCK_MONOTONIC, &w->start);
+    if(!max){return 0;}
+    if(!(w->lines = calloc(max, sizeof(*w->lines)))){return -1;}
+    w->max = max;
+    if((w->savedout = fcntl(1, F_DUPFD_CLOEXEC, 3)) < 0 || (w->savederr = fcntl(2, F_DUPFD_CLOEXEC, 3)) < 0){return -1;}
     return 0;
 }
 
-// Returns the temporal difference between two timespec structs pointers as a timespec struct pointer
-struct timeval* timediff(struct timeval starttime, struct timeval endtime){
-    time_t secs;
-    long usecs;
-    if(endtime.tv_usec < starttime.tv_usec){
-        secs = endtime.tv_sec - starttime.tv_sec - 1;
-        usecs = endtime.tv_usec - starttime.tv_usec + 1000000L;
+// Writes everything in fd out to outfd from the start
+void copyOut(int fd, int outfd){
+    char buf[65536];
+    ssize_t n;
+    off_t off = 0;
+    while((n = pread(fd, buf, sizeof(buf), off)) > 0){
+        for(ssize_t done = 0, w; done < n; done += w){
+            if((w = write(outfd, buf + done, n - done)) < 0){
+                if(errno == EINTR){
+                    w = 0;
+                    continue;
+                }
+                errno = 0;
+                return; // Nowhere left to report it
+            }
+        }
+        off += n;
     }
-    else{
-        secs = endtime.tv_sec - starttime.tv_sec;
-        usecs = endtime.tv_usec - starttime.tv_usec;
+}
+
+// Writes out the oldest lines as long as they are finished, or until the window is empty if drain is set. Each one
+// written out becomes lastexitstatus, so it always follows script order.
+void windowFlush(struct jobtable *jobs, struct window *w, int drain, int *lastexitstatus){
+    while(w->count){
+        struct pendingline *l = &w->lines[w->head];
+        if(l->job){
+            if(l->job->running){
+                if(!drain){return;}
+                jobsReap(jobs, l->job, 1);
+            }
+            l->status = l->job->status;
+            jobFree(jobs, l->job);
+        }
+        fflush(stdout);
+        copyOut(l->outfd, 1);
+        copyOut(fileno(l->err), 2);
+        close(l->outfd);
+        fclose(l->err);
+        *lastexitstatus = l->status;
+        w->head = (w->head + 1) % w->max;
+        w->count--;
     }
-    struct timeval *result;
-    result->tv_sec = secs;
-    result->tv_usec = usecs;
-    return result;
+}
+
+// Starts a foreground line with standard output and error sent to memfds, waiting for the oldest line to finish first
+// if max are already running. A line that is a utility u is run there and then, straight into its memfds.
+// Returns -1 if the capture could not be set up, and the line should run normally.
+int windowLaunch(struct jobtable *jobs, struct window *w, struct job *job, struct cmdline *cl, int method, const struct utility *u, int *lastexitstatus){
+    int outfd = memfd_create("myshell-stdout", MFD_CLOEXEC);
+    int errfd = memfd_create("myshell-stderr", MFD_CLOEXEC);
+    FILE *err = errfd < 0 ? NULL : fdopen(errfd, "w");
+    if(outfd < 0 || !err){
+        fprintf(stderr, "Warning: Could not buffer output of line, running it on its own: %s\n", strerror(errno));
+        errno = 0;
+        if(outfd >= 0){close(outfd);}
+        if(err){fclose(err);}
+        else if(errfd >= 0){close(errfd);}
+        return -1;
+    }
+    setvbuf(err, NULL, _IONBF, 0); // Shares its file offset with the children's standard error, so it must not hold anything back
+    if(w->count == w->max){windowFlush(jobs, w, 0, lastexitstatus);}
+    while(w->count == w->max){ // Only the oldest line finishing makes room
+        jobsReap(jobs, w->lines[w->head].job, 1);
+        windowFlush(jobs, w, 0, lastexitstatus);
+    }
+    // The children inherit the shell's own 1 and 2, and anything launching prints about them lands in the line's output too
+    fflush(stdout);
+    dup2(outfd, 1);
+    dup2(errfd, 2);
+    job->report = err;
+    parseReport(cl);
+    int failed = u ? runUtility(u, &cl->stages[0]) : launchPipeline(jobs, job, cl, method);
+    dup2(w->savedout, 1);
+    dup2(w->savederr, 2);
+
+    struct pendingline *l = &w->lines[(w->head + w->count++) % w->max];
+    l->job = job;
+    l->status = failed;
+    l->outfd = outfd;
+    l->err = err;
+    job->status = failed;
+    if(job->nprocs == 0){
+        jobFree(jobs, job);
+        l->job = NULL;
+    }
+    w->lines_run++;
+    return 0;
+}
+
+// Whole-script totals for -j: wall time against the CPU time of every job
+void printSummary(struct jobtable *jobs, struct window *w){
+    struct timespec difftime;
+    double real = elapsedSince(&w->start, &difftime);
+    double cpu = jobs->usage.ru_utime.tv_sec + jobs->usage.ru_utime.tv_usec / 1e6 + jobs->usage.ru_stime.tv_sec + jobs->usage.ru_stime.tv_usec / 1e6;
+    fprintf(stderr, "Script: %ld lines run %d at a time. Real: %ld.%.6lds User: %ld.%.6lds Sys: %ld.%.6lds (%.2f CPUs busy)\n", w->lines_run, w->max, difftime.tv_sec, difftime.tv_nsec / 1000, jobs->usage.ru_utime.tv_sec, jobs->usage.ru_utime.tv_usec, jobs->usage.ru_stime.tv_sec, jobs->usage.ru_stime.tv_usec, real > 0 ? cpu / real : 0);
+}
+
+int isBuiltin(char *name){
+    return !strcmp(name,"cd") || !strcmp(name,"pwd") || !strcmp(name,"exit") || !strcmp(name,"wait") || !strcmp(name,"jobs") || !strcmp(name,"hash");
 }
 
 int main(int argc, char* argv[]){
-    FILE *scriptfile; // By default we read from stdin, we only read from file if it is specified
+    char *scriptname = NULL; // By default we read from stdin, we only read from file if it is specified
+    struct script script;
+    int compile = 0; // -C: parse the whole script before running any of it
+    struct commandtable table;
+    size_t next = 0; // The command in table to run next
     int lastexitstatus = 0;
-    if(argc > 2){
+    int launchmethod = LAUNCH_SPAWN;
+    struct jobtable jobs;
+    struct window window;
+    long parallel = 0; // Lines run at once with -j, 0 runs them one by one as always
+    char *end;
+    int c;
+    FILE *profile = NULL;
+    long lineno = 0;
+    while((c = getopt(argc, argv, "Cefj:p:")) >= 0){
+        switch(c){
+            case 'C':
+                compile = 1;
+                break;
+            case 'e':
+                fastpaths = 0;
+                break;
+            case 'f':
+                launchmethod = LAUNCH_FORK;
+                break;
+            case 'j':
+                parallel = strtol(optarg, &end, 10);
+                if(*end || parallel < 1 || parallel > 4096){
+                    fprintf(stderr, "Error: -j takes a number of lines from 1 to 4096\n");
+                    return -1;
+                }
+                break;
+            case 'p':
+                if(!(profile = fopen(optarg, "ae"))){
+                    fprintf(stderr, "Error attempting to open file %s for appending: %s\n", optarg, strerror(errno));
+                    return -1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: myshell [-C] [-e] [-f] [-j N] [-p profile.ndjson] [script]\n");
+                return -1;
+        }
+    }
+    if(argc - optind > 1){
         fprintf(stderr, "Too many arguments passed to myshell. Fallback to default behavior: read from terminal\n");
     }
-    else if(argc == 2){
-        if((scriptfile = fopen(argv[1], "r"))<0){
-            fprintf(stderr, "Error attempting to open file %s for reading: %s\n", argv[1], strerror(errno));
+    else if(argc - optind == 1){
+        scriptname = argv[optind];
+    }
+    if(scriptOpen(&script, scriptname) < 0){
+        fprintf(stderr, "Error attempting to open file %s for reading: %s\n", scriptname, strerror(errno));
+        return -1;
+    }
+    if(compile){
+        int failed = scriptCompile(&script, &table);
+        scriptClose(&script); // Everything the table needs has been copied out of it
+        if(failed){
+            fprintf(stderr, "Error while trying to read from shell script %s: %s\n", scriptname ? scriptname : "standard input", strerror(errno));
             return -1;
         }
     }
+    if(jobsInit(&jobs) < 0){
+        fprintf(stderr, "Error while setting up child reaping: %s\n", strerror(errno));
+        return -1;
+    }
+    if(profile){
+        jobs.profile = profile;
+        if((profiling = profileInit() > 0) == 0){
+            fprintf(stderr, "Warning: perf_event_open is not permitted here, profile records will have no counters\n");
+        }
+    }
+    if(windowInit(&window, parallel) < 0){
+        fprintf(stderr, "Error while setting up parallel mode: %s\n", strerror(errno));
+        return -1;
+    }
 
-    char cmdline[4096]; // Each command will process up to 4095 characters at once. If you need more, tough luck.
+    const char *line;
+    ssize_t linelen;
+    struct arena arena;
+    struct cmdline cl;
+    arenaInit(&arena);
     while(1){
-        // fgets returns NULL and breaks loop if EOF encountered or if there is an error
-        if(argc == 2){
-            if(!fgets(cmdline, 4096, scriptfile)){break;}
+        jobsReap(&jobs, NULL, 0); // Report background jobs that finished while the last line ran
+        windowFlush(&jobs, &window, 0, &lastexitstatus);
+        int parsed;
+        if(compile){
+            if(next == table.count){break;}
+            parsed = commandParsed(&table.commands[next], &arena, &cl);
+            lineno = table.commands[next++].line;
         }
-        else if(!fgets(cmdline, 4096, stdin)){break;}
-
-        if(strlen(cmdline) < 1){continue;} // Ignore empty lines
-        if(cmdline[0]=='#'){continue;} // # denotes a comment, we ignore lines with comments
-        // Track # arguments, whether standard channels should be redirected, and whether to truncate or append output or error
-        int internalargc = 1, redir_in = 0, redir_out = 0, redir_err = 0, outflag, errflag;
-        char *infile = (char *)NULL, *outfile = (char *)NULL, *errfile = (char *)NULL, *curarg; // Track names of files to redirect to as well as current argument for tokenization
-        if((curarg = strtok(cmdline, " \n")) == NULL){continue;} // If our first strtok retuns null then the line has no tokens, ignore it
-        char **internalargv = malloc(2*sizeof(infile)); // We will dynamically add arguments to this array during tokenization
-        internalargv[0] = curarg;
-        while((curarg = strtok(NULL, " \n")) != NULL){
-            // Redirect standard input
-            if(!strncmp(curarg,"<",1)){
-                if(redir_in){
-                    fprintf(stderr, "Warning: Cannot redirect stdin twice! Second redirection ignored.\n");
-                    continue;
-                }
-                infile = substring(curarg,1,strlen(curarg)-1);
-                redir_in = 1;
-            }
-            // Redirect standard output
-            else if(!strncmp(curarg,">",1)){
-                if(redir_out){
-                    fprintf(stderr, "Warning: Cannot redirect stdout twice! Second redirection ignored.\n");
-                    continue;
-                }
-                if(!strncmp(curarg,">>",2)){
-                    outfile = substring(curarg,2,strlen(curarg)-2);
-                    outflag = O_APPEND;
-                }
-                else{
-                    outfile = substring(curarg,1,strlen(curarg)-1);
-                    outflag = O_TRUNC;
-                }
-                redir_out = 1;
-            }
-            // Redirect standard error
-            else if(!strncmp(curarg,"2>",2)){
-                if(redir_err){
-                    fprintf(stderr, "Warning: Cannot redirect stderr twice! Second redirection ignored.\n");
-                    continue;
-                }
-                if(!strncmp(curarg,"2>>",3)){
-                    errfile = substring(curarg,3,strlen(curarg)-3);
-                    errflag = O_APPEND;
-                }
-                else{
-                    errfile = substring(curarg,2,strlen(curarg)-2);
-                    errflag = O_TRUNC;
-                }
-                redir_err = 1;
-            }
-            else{
-                internalargv = realloc(internalargv, (internalargc+2)*sizeof(*internalargv));
-                internalargv[internalargc] = curarg;
-                internalargc++;
-            }
+        else{
+            // scriptNext returns -1 and breaks loop if EOF encountered or if there is an error
+            if((linelen = scriptNext(&script, &line)) < 0){break;}
+            lineno = script.lineno;
+            parsed = parseLine(&arena, line, linelen, &cl);
+        }
+        if(parsed == PARSE_EMPTY){
+            parseReport(&cl);
+            continue; // Blank lines and comments are ignored
         }
-        internalargv[internalargc] = (char *)NULL; // argv must be null-terminated
+        if(parsed == PARSE_ERROR){
+            windowFlush(&jobs, &window, 1, &lastexitstatus); // Written out in order, like any other line
+            parseReport(&cl);
+            lastexitstatus = PARSE_ERROR;
+            continue;
+        }
+        int background = cl.background;
+        int internalargc = cl.stages[0].argc;
+        char **internalargv = cl.stages[0].argv;
+        int builtin = cl.nstages == 1 && !background && isBuiltin(internalargv[0]);
+        const struct utility *utility;
+        // Under -j only plain foreground commands overlap. Builtins (cd and exit above all) and background jobs wait
+        // for every earlier line, so they see the state and lastexitstatus a serial run would have given them.
+        if(builtin || background){windowFlush(&jobs, &window, 1, &lastexitstatus);}
+        if(!window.max || builtin || background){parseReport(&cl);} // Otherwise the warnings go into the line's buffered output
 
-        // Built-in commands
-        if(!strcmp(internalargv[0],"cd")){
+        // Built-in commands, which only run on their own in the foreground
+        if(builtin && !strcmp(internalargv[0],"cd")){
             switch(internalargc){
                 case 2:
                     if(chdir(internalargv[1])<0){
                         fprintf(stderr, "Error: Could not cd to directory %s: %s\n",internalargv[1],strerror(errno));
                         errno = 0;
                     }
-                    continue;
+                    break;
                 case 1:
                     if(chdir(getenv("HOME"))<0){
                         fprintf(stderr, "Error: Could not cd to directory %s: %s\n",getenv("HOME"),strerror(errno));
                         errno = 0;
                     }
-                    continue;
+                    break;
                 default:
                     fprintf(stderr, "Error: Too many arguments passed to command cd\n");
-                    continue;
+                    break;
             }
         }
-        else if(!strcmp(internalargv[0],"pwd")){
+        else if(builtin && !strcmp(internalargv[0],"pwd")){
             if(internalargc > 1){
                 fprintf(stderr, "Error: Too many arguments passed to command pwd\n");
                 errno = 0;
@@ -188,92 +418,120 @@ int main(int argc, char* argv[]){
                 if((getcwd(cwdname, PATH_MAX))==NULL){
                     fprintf(stderr,"Error: Call to getcwd failed: %s\n", strerror(errno));
                     errno = 0;
-                    continue;
                 }
-                printf("%s\n",cwdname);    
+                else{
+                    printf("%s\n",cwdname);
+                }
             }
-            continue;
         }
-        else if(!strcmp(internalargv[0],"exit")){
+        else if(builtin && !strcmp(internalargv[0],"exit")){
             switch(internalargc){
                 case 2:
                     errno = 0;
                     long rval = strtol(internalargv[1],NULL,10);
                     if(errno){
                         fprintf(stderr, "Error: Could not convert exit argument to long using strtol.\n");
-                        continue;
+                        break;
                     }
+                    jobsReap(&jobs, NULL, 1); // Background jobs still get their report
+                    if(window.max){printSummary(&jobs, &window);}
                     return (int)rval;
                 case 1:
+                    jobsReap(&jobs, NULL, 1);
+                    if(window.max){printSummary(&jobs, &window);}
                     return lastexitstatus;
                 default:
                     fprintf(stderr, "Error: Too many arguments passed to command exit\n");
-                    continue;
+                    break;
             }
         }
-        else{
-            int pid;
-            // Used to track real time
-            struct timeval starttime;
-            gettimeofday(&starttime, NULL);
-            switch(pid = fork()){
-                case -1:
-                    fprintf(stderr, "Error occured while attempting to fork: %s\n", strerror(errno));
-                    continue;
-                case 0: // Child Process
-                    if(argc == 2){fclose(scriptfile);} // Scriptfile is not needed in child if opened previously
-                    int infd = 0, outfd = 1, errfd = 2;
-                    if(redir_in && (infd = redirectStd(0, infile, O_RDONLY)) < 0){exit(1);}
-                    if(redir_out && (outfd = redirectStd(1, outfile, O_WRONLY | O_CREAT | outflag)) < 0){exit(1);}
-                    if(redir_err && (errfd = redirectStd(2, errfile, O_WRONLY | O_CREAT | errflag)) < 0){exit(1);}
-                    if(execvp(internalargv[0],internalargv) < 0){
-                        fprintf(stderr, "Error attempting to exec process %s: %s\n", internalargv[0], strerror(errno));
-                        free(internalargv);
-                        exit(127);
-                    }
-                    break;
-                default: // Parent Process
-                    free(infile);
-                    free(outfile);
-                    free(errfile);
-                    free(internalargv); // We only need internalargv and redirected files for child, free immediately to minimize leaks
-                    struct rusage rusg;
-                    unsigned status;
-                    int cpid;
-                    if((cpid = wait3(&status, 0, &rusg)) < 0){
-                        fprintf(stderr, "Error while attempting to wait for child: %s\n", strerror(errno));
+        else if(builtin && !strcmp(internalargv[0],"wait")){
+            if(internalargc > 1){
+                fprintf(stderr, "Error: Too many arguments passed to command wait\n");
+            }
+            else{
+                jobsReap(&jobs, NULL, 1);
+                lastexitstatus = 0;
+            }
+        }
+        else if(builtin && !strcmp(internalargv[0],"jobs")){
+            jobsList(&jobs);
+        }
+        else if(builtin && !strcmp(internalargv[0],"hash")){
+            lastexitstatus = 0;
+            if(internalargc == 1){pathCachePrint(&pathcache, stdout);}
+            else if(!strcmp(internalargv[1],"-r")){
+                if(internalargc > 2){fprintf(stderr, "Error: Too many arguments passed to command hash -r\n");}
+                pathCacheClear(&pathcache);
+            }
+            else{
+                for(int i = 1; i < internalargc; i++){ // Looks the names up now so later lines hit
+                    if(!pathLookup(&pathcache, internalargv[i])){
+                        fprintf(stderr, "Error: hash: %s: not found\n", internalargv[i]);
                         errno = 0;
-                        continue;
-                    }
-                    if(status != 0){
-                        if(WIFSIGNALED(status)){
-                            fprintf(stderr, "Child process %d exited with signal %d: %s\n", cpid, WTERMSIG(status), strsignal(WTERMSIG(status)));
-                            lastexitstatus = WTERMSIG(status)+128; // Need to add 128 to denote exit caused by signal
-                        }
-                        else{
-                            fprintf(stderr, "Child process %d exited with exit code %d\n", cpid, WEXITSTATUS(status));
-                            lastexitstatus = WEXITSTATUS(status);
-                        }
+                        lastexitstatus = 1;
                     }
-                    else{
-                        fprintf(stderr, "Child process %d exited normally\n", cpid);
-                        lastexitstatus = 0;
-                    }
-                    struct timeval endtime, *difftime;
-                    gettimeofday(&endtime, NULL);
-                    difftime = timediff(starttime, endtime);
-                    fprintf(stderr, "Real: %ld.%.6lds User: %ld.%.6lds Sys: %ld.%.6lds\n", difftime->tv_sec, difftime->tv_usec, rusg.ru_utime.tv_sec, rusg.ru_utime.tv_usec, rusg.ru_stime.tv_sec, rusg.ru_stime.tv_usec);
-
-                    break;
+                }
+            }
+        }
+        else if(fastpaths && cl.nstages == 1 && !background && (utility = utilityFind(internalargv[0])) && !(window.max && utility->blocks)){
+            // Without -j it can simply run here. Under -j it is captured like any other line, except for cat and sleep,
+            // which are left to run as processes so they overlap with the lines around them.
+            struct job *job = window.max ? jobStart(&jobs, cl.text, 0) : NULL;
+            if(job && windowLaunch(&jobs, &window, job, &cl, launchmethod, utility, &lastexitstatus) == 0){continue;}
+            if(job){
+                jobFree(&jobs, job);
+                parseReport(&cl);
+            }
+            lastexitstatus = runUtility(utility, &cl.stages[0]);
+        }
+        else{
+            struct job *job = jobStart(&jobs, cl.text, background);
+            if(!job){
+                fprintf(stderr, "Error: Could not allocate job: %s\n", strerror(errno));
+                errno = 0;
+                continue;
+            }
+            job->line = lineno;
+            // cat or sleep left to run as a process under -j, which says no more than it would have in the shell
+            job->quiet = window.max && fastpaths && cl.nstages == 1 && !background && (utility = utilityFind(internalargv[0])) && utility->blocks;
+            // Like sh, a background job does not get to read the shell's standard input, which may be the script itself
+            if(background && !cl.stages[0].redir.infile){cl.stages[0].redir.infile = "/dev/null";}
+            if(window.max && !background && windowLaunch(&jobs, &window, job, &cl, launchmethod, NULL, &lastexitstatus) == 0){continue;}
+            if(window.max && !background){parseReport(&cl);} // The line could not be buffered after all
+            fflush(stdout); // Anything builtins printed has to come out before what the children write
+            int failed = launchPipeline(&jobs, job, &cl, launchmethod);
+            if(job->nprocs == 0){
+                lastexitstatus = failed;
+                jobFree(&jobs, job);
+            }
+            else if(background){
+                job->status = failed;
+                fprintf(stderr, "[%d] %d\n", job->id, job->procs[job->nprocs-1].pid);
+                lastexitstatus = 0;
+            }
+            else{
+                job->status = failed;
+                jobsReap(&jobs, job, 1);
+                lastexitstatus = job->status;
+                jobFree(&jobs, job);
             }
         }
     }
+    int readerr = errno;
+    if(compile){commandTableFree(&table);}
+    else{scriptClose(&script);}
+    arenaFree(&arena);
+    pathCacheFree(&pathcache);
+    windowFlush(&jobs, &window, 1, &lastexitstatus);
+    errno = readerr;
     if(errno){
-        fprintf(stderr, "Error while trying to read from shell script %s: %s\n", "standard input", strerror(errno));
+        fprintf(stderr, "Error while trying to read from shell script %s: %s\n", scriptname ? scriptname : "standard input", strerror(errno));
     }
     else{
         fprintf(stderr, "End of file read, exiting shell with exit code %d\n", lastexitstatus);
     }
-    if(argc == 2){fclose(scriptfile);} // Scriptfile is not needed in child if opened previously
+    jobsReap(&jobs, NULL, 1); // Background jobs still get their report
+    if(window.max){printSummary(&jobs, &window);}
     return lastexitstatus;
-}
\ No newline at end of file
+}
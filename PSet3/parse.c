@@ -0,0 +1,330 @@
+# include "parse.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <fcntl.h>
+
+#define ARENA_MIN 4096
+#define ARENA_BLOCK (1 << 20) // Smallest block a kept arena starts
+#define ARENA_ALIGN 16
+
+// Redirection waiting for its file name
+#define PENDING_NONE 0
+#define PENDING_IN 1
+#define PENDING_OUT 2
+#define PENDING_ERR 3
+
+void arenaInit(struct arena *a){
+    memset(a, 0, sizeof(*a));
+}
+
+// A kept arena's blocks each start with a pointer to the one filled before it
+void arenaFree(struct arena *a){
+    while(a->keep && a->base){
+        char *previous = *(char **)a->base;
+        free(a->base);
+        a->base = previous;
+    }
+    free(a->base);
+    memset(a, 0, sizeof(*a));
+}
+
+void arenaKeep(struct arena *a){
+    arenaFree(a);
+    a->keep = 1;
+}
+
+// Makes sure n more bytes fit after what the lines before have used
+static int keepReserve(struct arena *a, size_t n){
+    if(a->base && a->used + n <= a->size){return 0;}
+    size_t newsize = n + ARENA_ALIGN > ARENA_BLOCK ? n + ARENA_ALIGN : ARENA_BLOCK;
+    char *block = malloc(newsize);
+    if(!block){return -1;}
+    *(char **)block = a->base;
+    a->base = block;
+    a->size = newsize;
+    a->used = ARENA_ALIGN;
+    a->grows++;
+    return 0;
+}
+
+// Empties the arena and makes sure n bytes fit. Only done before anything of the new line has been handed out,
+// which is what makes growing with realloc safe.
+static int arenaReserve(struct arena *a, size_t n){
+    if(a->keep){return keepReserve(a, n);}
+    a->used = 0;
+    if(n <= a->size){return 0;}
+    size_t newsize = a->size ? a->size : ARENA_MIN;
+    while(newsize < n){newsize *= 2;}
+    char *grown = realloc(a->base, newsize);
+    if(!grown){return -1;}
+    a->base = grown;
+    a->size = newsize;
+    a->grows++;
+    return 0;
+}
+
+static void *arenaAlloc(struct arena *a, size_t n){
+    size_t start = (a->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    a->used = start + n;
+    return a->base + start;
+}
+
+static int isBlank(char c){
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Ends a word without quotes around it
+static int isSpecial(char c){
+    return isBlank(c) || c == '|' || c == '&' || c == '<' || c == '>';
+}
+
+static void warn(struct cmdline *cl, const char *msg){
+    if(cl->nwarnings < PARSE_MAX_WARNINGS){cl->warnings[cl->nwarnings] = msg;}
+    cl->nwarnings++;
+}
+
+static void setRedirect(struct cmdline *cl, struct redirect *r, int which, int flag, char *file){
+    switch(which){
+        case PENDING_IN:
+            if(r->infile){
+                warn(cl, "Warning: Cannot redirect stdin twice! Second redirection ignored.");
+                return;
+            }
+            r->infile = file;
+            return;
+        case PENDING_OUT:
+            if(r->outfile){
+                warn(cl, "Warning: Cannot redirect stdout twice! Second redirection ignored.");
+                return;
+            }
+            r->outfile = file;
+            r->outflag = flag;
+            return;
+        case PENDING_ERR:
+            if(r->errfile){
+                warn(cl, "Warning: Cannot redirect stderr twice! Second redirection ignored.");
+                return;
+            }
+            r->errfile = file;
+            r->errflag = flag;
+            return;
+    }
+}
+
+static int syntaxError(struct cmdline *cl, const char *msg){
+    cl->error = msg;
+    return PARSE_ERROR;
+}
+
+void parseReport(struct cmdline *cl){
+    for(int i = 0; i < cl->nwarnings && i < PARSE_MAX_WARNINGS; i++){fprintf(stderr, "%s\n", cl->warnings[i]);}
+    if(cl->error){fprintf(stderr, "Error: %s\n", cl->error);}
+}
+
+int parseLine(struct arena *a, const char *line, size_t len, struct cmdline *cl){
+    size_t maxstages = 1;
+    for(const char *p = line; (p = memchr(p, '|', len - (p - line))); p++){maxstages++;}
+    // Words never take more room than the line plus a terminator each, and there are fewer words than characters,
+    // so this is enough for any line of this length however it is split up
+    size_t need = 3 * len + 2 + (2 * len + maxstages + 1) * sizeof(char *) + maxstages * sizeof(struct stage) + 4 * ARENA_ALIGN;
+    memset(cl, 0, sizeof(*cl));
+    if(arenaReserve(a, need) < 0){return syntaxError(cl, "Out of memory while parsing");}
+    char **slots = arenaAlloc(a, (len + maxstages + 1) * sizeof(char *)); // Every stage's argv, one after another
+    struct stage *stages = arenaAlloc(a, maxstages * sizeof(struct stage));
+    char *out = arenaAlloc(a, 2 * len + 1); // Word text
+    size_t nslots = 0, textstart = len, textend = 0;
+    int pending = PENDING_NONE, flag = 0;
+    memset(stages, 0, sizeof(*stages));
+    stages[0].argv = slots;
+    stages[0].redir.pipein = stages[0].redir.pipeout = stages[0].redir.gate = -1;
+    cl->stages = stages;
+    cl->nstages = 1;
+
+    size_t i = 0;
+    while(i < len){
+        char c = line[i];
+        struct stage *st = &stages[cl->nstages-1];
+        if(isBlank(c)){
+            i++;
+            continue;
+        }
+        if(textstart == len){textstart = i;}
+        if(c == '#'){break;} // Only reached at the start of a word
+        if(c == '|' || c == '&' || c == '<' || c == '>' || (c == '2' && i+1 < len && line[i+1] == '>')){
+            if(pending){return syntaxError(cl, "Missing file name after redirection");}
+            if(c == '|'){
+                if(st->argc == 0){return syntaxError(cl, "Empty command in pipeline");}
+                slots[nslots++] = NULL;
+                st = &stages[cl->nstages++];
+                memset(st, 0, sizeof(*st));
+                st->argv = slots + nslots;
+                st->redir.pipein = st->redir.pipeout = st->redir.gate = -1;
+                i++;
+                continue;
+            }
+            if(c == '&'){
+                size_t j = i+1;
+                while(j < len && isBlank(line[j])){j++;}
+                if(j < len && line[j] != '#'){return syntaxError(cl, "& is only supported at the end of a line");}
+                cl->background = 1;
+                break;
+            }
+            if(c == '2'){i++;}
+            pending = c == '<' ? PENDING_IN : c == '>' ? PENDING_OUT : PENDING_ERR;
+            flag = O_TRUNC;
+            if(c != '<' && i+1 < len && line[i+1] == '>'){
+                flag = O_APPEND;
+                i++;
+            }
+            i++;
+            textend = i;
+            continue;
+        }
+
+        // A word, possibly made of several quoted and unquoted pieces
+        char *word = out;
+        while(i < len && !isSpecial(line[i])){
+            c = line[i];
+            if(c == '\\'){
+                if(i+1 < len){*out++ = line[i+1];}
+                i += 2;
+            }
+            else if(c == '\''){
+                const char *close = memchr(line + i + 1, '\'', len - i - 1);
+                if(!close){return syntaxError(cl, "Unterminated ' quote");}
+                size_t n = close - (line + i + 1);
+                memcpy(out, line + i + 1, n);
+                out += n;
+                i += n + 2;
+            }
+            else if(c == '"'){
+                for(i++; i < len && line[i] != '"'; i++){
+                    if(line[i] == '\\' && i+1 < len && (line[i+1] == '"' || line[i+1] == '\\')){i++;}
+                    *out++ = line[i];
+                }
+                if(i >= len){return syntaxError(cl, "Unterminated \" quote");}
+                i++;
+            }
+            else{
+                *out++ = c;
+                i++;
+            }
+        }
+        if(i > len){i = len;} // A backslash as the very last character
+        *out++ = '\0';
+        textend = i;
+        if(pending){
+            setRedirect(cl, &st->redir, pending, flag, word);
+            pending = PENDING_NONE;
+        }
+        else{
+            slots[nslots++] = word;
+            st->argc++;
+        }
+    }
+    if(pending){return syntaxError(cl, "Missing file name after redirection");}
+    slots[nslots] = NULL;
+    struct stage *last = &stages[cl->nstages-1];
+    if(last->argc == 0){
+        if(cl->nstages > 1){return syntaxError(cl, "Empty command in pipeline");}
+        if(cl->background){return syntaxError(cl, "Empty command in background job");}
+        if(last->redir.infile || last->redir.outfile || last->redir.errfile){return syntaxError(cl, "Missing command before redirection");}
+        return PARSE_EMPTY;
+    }
+    if(textend < textstart){textend = textstart;}
+    cl->text = arenaAlloc(a, textend - textstart + 1);
+    memcpy(cl->text, line + textstart, textend - textstart);
+    cl->text[textend - textstart] = '\0';
+    return PARSE_OK;
+}
+
+static char *copyString(char **out, const char *s){
+    if(!s){return NULL;}
+    size_t n = strlen(s) + 1;
+    char *copy = memcpy(*out, s, n);
+    *out += n;
+    return copy;
+}
+
+struct cmdline *cmdlineKeep(struct arena *a, const struct cmdline *cl){
+    size_t chars = cl->text ? strlen(cl->text) + 1 : 0, nslots = 0;
+    for(int s = 0; s < cl->nstages; s++){
+        struct stage *st = &cl->stages[s];
+        char *files[3] = {st->redir.infile, st->redir.outfile, st->redir.errfile};
+        nslots += st->argc + 1;
+        for(int i = 0; i < st->argc; i++){chars += strlen(st->argv[i]) + 1;}
+        for(int f = 0; f < 3; f++){chars += files[f] ? strlen(files[f]) + 1 : 0;}
+    }
+    if(keepReserve(a, sizeof(*cl) + cl->nstages * sizeof(struct stage) + nslots * sizeof(char *) + chars + 4 * ARENA_ALIGN) < 0){return NULL;}
+    struct cmdline *kept = arenaAlloc(a, sizeof(*cl));
+    struct stage *stages = arenaAlloc(a, cl->nstages * sizeof(struct stage));
+    char **slots = arenaAlloc(a, nslots * sizeof(char *));
+    char *out = arenaAlloc(a, chars);
+    for(int s = 0; s < cl->nstages; s++){
+        struct stage *st = &stages[s];
+        *st = cl->stages[s];
+        st->argv = slots;
+        for(int i = 0; i < st->argc; i++){slots[i] = copyString(&out, cl->stages[s].argv[i]);}
+        slots[st->argc] = NULL;
+        slots += st->argc + 1;
+        st->redir.infile = copyString(&out, st->redir.infile);
+        st->redir.outfile = copyString(&out, st->redir.outfile);
+        st->redir.errfile = copyString(&out, st->redir.errfile);
+    }
+    *kept = *cl;
+    kept->stages = cl->nstages ? stages : NULL;
+    kept->text = copyString(&out, cl->text);
+    return kept;
+}
+
+char *arenaString(struct arena *a, const char *s, size_t len){
+    if(keepReserve(a, len + 1 + ARENA_ALIGN) < 0){return NULL;}
+    char *copy = a->base + a->used; // Strings need no alignment, so they are packed end to end
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    a->used += len + 1;
+    return copy;
+}
+
+// What parsePlain makes of each character: 1 a blank, 2 one parseLine treats specially
+static const char plainClass[256] = {
+    [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\r'] = 1,
+    ['\0'] = 2, ['\''] = 2, ['"'] = 2, ['\\'] = 2, ['|'] = 2, ['&'] = 2, ['<'] = 2, ['>'] = 2, ['#'] = 2
+};
+
+int parsePlain(const char *line, size_t len, size_t *start, size_t *end){
+    char classes = 0;
+    for(size_t i = 0; i < len; i++){classes |= plainClass[(unsigned char)line[i]];} // No branch per character
+    if(classes & 2){return 0;}
+    size_t first = 0, last = len;
+    while(first < last && plainClass[(unsigned char)line[first]]){first++;}
+    while(last > first && plainClass[(unsigned char)line[last - 1]]){last--;}
+    *start = first;
+    *end = last;
+    return 1;
+}
+
+int parseWords(struct arena *a, char *text, struct cmdline *cl){
+    size_t len = strlen(text);
+    memset(cl, 0, sizeof(*cl));
+    if(arenaReserve(a, len + 1 + (len / 2 + 2) * sizeof(char *) + sizeof(struct stage) + 3 * ARENA_ALIGN) < 0){
+        return syntaxError(cl, "Out of memory while parsing");
+    }
+    char **slots = arenaAlloc(a, (len / 2 + 2) * sizeof(char *)); // Words need a character and a blank each
+    struct stage *st = arenaAlloc(a, sizeof(*st));
+    char *out = memcpy(arenaAlloc(a, len + 1), text, len + 1);
+    memset(st, 0, sizeof(*st));
+    st->argv = slots;
+    st->redir.pipein = st->redir.pipeout = st->redir.gate = -1;
+    for(char *end = out + len; out < end;){ // Trimmed, so every run of blanks is followed by a word
+        slots[st->argc++] = out;
+        while(out < end && !plainClass[(unsigned char)*out]){out++;}
+        while(out < end && plainClass[(unsigned char)*out]){*out++ = '\0';}
+    }
+    slots[st->argc] = NULL;
+    cl->stages = st;
+    cl->nstages = 1;
+    cl->text = text;
+    return PARSE_OK;
+}
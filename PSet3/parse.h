@@ -0,0 +1,91 @@
+#ifndef _PARSE_H
+#define _PARSE_H
+
+#include <stddef.h>
+#include "launch.h"
+
+// parseLine results
+#define PARSE_OK 0
+#define PARSE_EMPTY 1 // Nothing but blanks or a comment
+#define PARSE_ERROR 2 // Syntax error. Also the status the line is recorded with, as in sh.
+
+#define PARSE_MAX_WARNINGS 8 // Warnings kept per line, any more are counted but not repeated
+
+// Bump allocator that everything parsed from one line lives in. Reset for every line and only grown when a line
+// longer than any before it comes along, so parsing allocates nothing once the shell has warmed up.
+struct arena{
+    char *base;
+    size_t size, used;
+    long grows; // Times base had to be reallocated, or a new block started when keeping
+    int keep; // See arenaKeep
+};
+
+// One command of a pipeline
+struct stage{
+    char **argv; // Null-terminated
+    int argc;
+    struct redirect redir; // pipein, pipeout and gate are -1, launching fills them in
+};
+
+struct cmdline{
+    struct stage *stages;
+    int nstages;
+    int background; // Ended in &
+    char *text; // The line as written, without the &, a comment or surrounding blanks, for job reports
+    const char *error; // Why the line is a syntax error, NULL if it is not
+    const char *warnings[PARSE_MAX_WARNINGS]; // Redirections that were ignored
+    int nwarnings;
+};
+
+void arenaInit(struct arena *a);
+void arenaFree(struct arena *a);
+
+void arenaKeep(struct arena *a);
+/* Makes a hold on to everything put in it until arenaFree, instead of being
+* reset for each line. Full blocks are chained, never moved, so nothing in
+* them is invalidated. For holding a whole parsed script (see cmdlineKeep).
+*/
+
+int parseLine(struct arena *a, const char *line, size_t len, struct cmdline *cl);
+/* Splits line (len bytes, need not be null-terminated, any length) into
+* pipeline stages with their arguments and redirections in a single pass.
+* Words are separated by blanks; | separates stages, a trailing & puts the
+* line in the background and # at the start of a word comments out the rest.
+* <file, >file, >>file, 2>file and 2>>file redirect standard input, output
+* and error, with or without a blank before the file name. Inside '...'
+* every character is literal, inside "..." a backslash only escapes " and
+* itself, and elsewhere a backslash escapes any character. Everything cl
+* points to is in a and stays valid until a is used for the next line, or
+* until arenaFree if a is kept.
+* Returns PARSE_OK, PARSE_EMPTY, or PARSE_ERROR. Nothing is printed, so
+* that under -j the messages can come out in script order: see parseReport.
+*/
+
+struct cmdline *cmdlineKeep(struct arena *a, const struct cmdline *cl);
+/* Copies cl and everything it points to into kept arena a, taking only the
+* room it needs rather than what parseLine reserved for the worst case.
+* Returns the copy, or NULL if memory ran out.
+*/
+
+char *arenaString(struct arena *a, const char *s, size_t len);
+/* Copies len bytes of s into kept arena a and null-terminates them. Returns
+* the copy, or NULL if memory ran out.
+*/
+
+int parsePlain(const char *line, size_t len, size_t *start, size_t *end);
+/* Whether line is nothing but words and blanks: no quotes, backslashes,
+* redirections, pipes, & or #, so parseWords gives what parseLine would.
+* Sets *start and *end around it without the blanks either side.
+*/
+
+int parseWords(struct arena *a, char *text, struct cmdline *cl);
+/* Splits null-terminated text that parsePlain accepted, trimmed, into cl's
+* single stage in a, which is reset for it as by parseLine. cl->text is text
+* itself, so it must outlive cl. Returns PARSE_OK.
+*/
+
+void parseReport(struct cmdline *cl);
+/* Prints the warnings and error parseLine left in cl to stderr.
+*/
+
+#endif
@@ -0,0 +1,163 @@
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <time.h>
+# include "parse.h"
+
+// parsebench.c
+// By: Jeffrey Wong
+/* Benchmark for myshell's command line parsing. Parses a mix of typical script lines (1M by default,
+pass a count to override) with the strtok tokenizer myshell used before parse.c (one malloc plus a
+realloc per argument, a strdup per redirection) and with parseLine's arena, and reports lines/s and
+heap allocations per line for each. Allocations are counted by wrapping malloc, calloc and realloc. */
+
+#define BENCH_LONG_LINE 100000 // A line this long is parsed once at the end, the old parser stopped at 4095 characters
+
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t n);
+
+long allocs = 0;
+
+void *malloc(size_t n){
+    allocs++;
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size){
+    allocs++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n){
+    allocs++;
+    return __libc_realloc(p, n);
+}
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+const char *corpus[] = {
+    "ls -l /usr/bin\n",
+    "gcc -O2 -Wall -I. -o myshell.exe myshell.c launch.c jobs.c parse.c\n",
+    "sort -u <words.txt >sorted.txt 2>>errors.log\n",
+    "cat /var/log/syslog | grep -i error | wc -l\n",
+    "echo done\n",
+    "find . -name *.c -newer makefile\n",
+    "tar -czf backup.tgz src include docs >/dev/null 2>/dev/null\n",
+    "# A comment line\n",
+    "./wordgen 100000 | ./wordsearch words.txt | ./pager\n",
+    "cp -r build/output/release/bin /opt/tools/bin\n",
+};
+#define CORPUS_LINES (sizeof(corpus) / sizeof(*corpus))
+
+// ---------------------------------------------------------------------------------------------
+// myshell's parsing before parse.c, minus the messages. substring ends its copy where it meant to.
+
+char *substring(char *str, int pos, int len){
+    if(pos+len > strlen(str)){return NULL;}
+    char temp[4096];
+    memcpy(temp,str+pos,len);
+    temp[len] = '\0';
+    return strdup(temp);
+}
+
+int originalParse(char *cmdline, long *words){
+    char *infile = NULL, *outfile = NULL, *errfile = NULL, *curarg;
+    int internalargc = 1;
+    if(cmdline[0]=='#'){return 0;}
+    char *text = strdup(cmdline); // myshell kept the line for job reports
+    int nstages = 1;
+    for(char *p = cmdline; (p = strchr(p, '|')); p++){nstages++;}
+    char **stagesargv[nstages];
+    char *stage = cmdline;
+    for(int s = 0; s < nstages; s++){
+        char *bar = strchr(stage, '|');
+        if(bar){*bar = '\0';}
+        stagesargv[s] = NULL;
+        if((curarg = strtok(stage, " \t\n")) == NULL){continue;}
+        char **internalargv = malloc(2*sizeof(*internalargv));
+        internalargv[0] = curarg;
+        internalargc = 1;
+        while((curarg = strtok(NULL, " \t\n")) != NULL){
+            if(!strncmp(curarg,"<",1)){infile = substring(curarg,1,strlen(curarg)-1);}
+            else if(!strncmp(curarg,">>",2)){outfile = substring(curarg,2,strlen(curarg)-2);}
+            else if(!strncmp(curarg,">",1)){outfile = substring(curarg,1,strlen(curarg)-1);}
+            else if(!strncmp(curarg,"2>>",3)){errfile = substring(curarg,3,strlen(curarg)-3);}
+            else if(!strncmp(curarg,"2>",2)){errfile = substring(curarg,2,strlen(curarg)-2);}
+            else{
+                internalargv = realloc(internalargv, (internalargc+2)*sizeof(*internalargv));
+                internalargv[internalargc++] = curarg;
+            }
+        }
+        internalargv[internalargc] = NULL;
+        stagesargv[s] = internalargv;
+        *words += internalargc;
+        if(bar){stage = bar+1;}
+    }
+    for(int s = 0; s < nstages; s++){free(stagesargv[s]);}
+    free(infile);
+    free(outfile);
+    free(errfile);
+    free(text);
+    return 1;
+}
+
+// ---------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[]){
+    long lines = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+    if(lines < 1){
+        fprintf(stderr, "ERROR: Line count must be positive.\n");
+        return -1;
+    }
+    size_t lens[CORPUS_LINES];
+    for(size_t i = 0; i < CORPUS_LINES; i++){lens[i] = strlen(corpus[i]);}
+
+    // Both parsers work on a copy of the line, the way myshell reads each one into its buffer
+    char buf[4096];
+    long words = 0, before = allocs;
+    double start = now();
+    for(long n = 0; n < lines; n++){
+        memcpy(buf, corpus[n % CORPUS_LINES], lens[n % CORPUS_LINES] + 1);
+        originalParse(buf, &words);
+    }
+    double elapsed = now() - start;
+    long oldwords = words;
+    printf("%ld lines, %zu distinct:\n", lines, CORPUS_LINES);
+    printf("  %-18s %12.0f lines/s %8.2f allocations/line\n", "strtok (original)", lines / elapsed, (double)(allocs - before) / lines);
+
+    struct arena a;
+    struct cmdline cl;
+    arenaInit(&a);
+    words = 0;
+    before = allocs;
+    start = now();
+    for(long n = 0; n < lines; n++){
+        memcpy(buf, corpus[n % CORPUS_LINES], lens[n % CORPUS_LINES] + 1);
+        if(parseLine(&a, buf, lens[n % CORPUS_LINES], &cl) != PARSE_OK){continue;}
+        for(int s = 0; s < cl.nstages; s++){words += cl.stages[s].argc;}
+    }
+    elapsed = now() - start;
+    printf("  %-18s %12.0f lines/s %8.2f allocations/line (%ld arena growths)\n", "parseLine arena", lines / elapsed, (double)(allocs - before) / lines, a.grows);
+    if(words != oldwords){
+        fprintf(stderr, "MISMATCH: parseLine saw %ld words, the original parser %ld\n", words, oldwords);
+        return 1;
+    }
+
+    char *longline = malloc(BENCH_LONG_LINE + 1);
+    for(int i = 0; i < BENCH_LONG_LINE; i++){longline[i] = i % 8 == 7 ? ' ' : 'a' + i % 26;}
+    longline[BENCH_LONG_LINE] = '\0';
+    start = now();
+    if(parseLine(&a, longline, BENCH_LONG_LINE, &cl) != PARSE_OK || cl.stages[0].argc != BENCH_LONG_LINE / 8){
+        fprintf(stderr, "MISMATCH: %d character line did not parse into %d words\n", BENCH_LONG_LINE, BENCH_LONG_LINE / 8);
+        return 1;
+    }
+    printf("  one %d character line: %d words in %.1f us\n", BENCH_LONG_LINE, cl.stages[0].argc, (now() - start) * 1e6);
+    free(longline);
+    arenaFree(&a);
+    return 0;
+}
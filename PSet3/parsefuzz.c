@@ -0,0 +1,151 @@
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <fcntl.h>
+# include "parse.h"
+
+// parsefuzz.c
+// By: Jeffrey Wong
+/* Fuzz test for parse.c, built with AddressSanitizer and UBSan by the makefile. Feeds parseLine random
+lines (1M by default, pass a count and a seed to override) mixing plain characters with the ones it treats
+specially, and checks every line it accepts: argv is null-terminated and agrees with argc, everything
+points into the arena, and writing the result back out fully quoted and parsing that again gives the
+same stages, words, redirections and & back. Lines it rejects have to say why. Lines parsePlain accepts
+have to split into the same words and text with parseWords (which -C runs them with) as with parseLine. */
+
+#define FUZZ_MAX_LEN 160
+
+const char plain[] = "ab2 ";
+const char special[] = "\t\\'\"|&<>#\n";
+
+// Appends s in single quotes, the one form in which nothing is special
+char *quoteWord(char *out, const char *s){
+    *out++ = '\'';
+    for(; *s; s++){
+        if(*s == '\''){
+            memcpy(out, "'\\''", 4);
+            out += 4;
+        }
+        else{
+            *out++ = *s;
+        }
+    }
+    *out++ = '\'';
+    return out;
+}
+
+char *quoteRedirect(char *out, const char *op, const char *file){
+    if(!file){return out;}
+    out += sprintf(out, " %s", op);
+    return quoteWord(out, file);
+}
+
+size_t unparse(struct cmdline *cl, char *out){
+    char *start = out;
+    for(int s = 0; s < cl->nstages; s++){
+        struct redirect *r = &cl->stages[s].redir;
+        if(s){out += sprintf(out, " |");}
+        for(int k = 0; k < cl->stages[s].argc; k++){
+            *out++ = ' ';
+            out = quoteWord(out, cl->stages[s].argv[k]);
+        }
+        out = quoteRedirect(out, "<", r->infile);
+        out = quoteRedirect(out, r->outflag == O_APPEND ? ">>" : ">", r->outfile);
+        out = quoteRedirect(out, r->errflag == O_APPEND ? "2>>" : "2>", r->errfile);
+    }
+    if(cl->background){out += sprintf(out, " &");}
+    return out - start;
+}
+
+int inArena(struct arena *a, const void *p){
+    return (const char *)p >= a->base && (const char *)p < a->base + a->used;
+}
+
+int sameString(const char *x, const char *y){
+    return (!x && !y) || (x && y && !strcmp(x, y));
+}
+
+// Returns NULL if cl is consistent and matches again, which may be NULL, otherwise what is wrong
+const char *check(struct arena *a, struct cmdline *cl, struct cmdline *again){
+    if(cl->nstages < 1 || !inArena(a, cl->stages) || !inArena(a, cl->text)){return "stages or text outside arena";}
+    for(int s = 0; s < cl->nstages; s++){
+        struct stage *st = &cl->stages[s];
+        struct redirect *r = &st->redir;
+        if(st->argc < 1 || st->argv[st->argc]){return "argv not null-terminated at argc";}
+        if(r->pipein != -1 || r->pipeout != -1 || r->gate != -1){return "pipe ends or gate not -1";}
+        for(int k = 0; k < st->argc; k++){
+            if(!inArena(a, st->argv[k])){return "word outside arena";}
+        }
+        if((r->infile && !inArena(a, r->infile)) || (r->outfile && !inArena(a, r->outfile)) || (r->errfile && !inArena(a, r->errfile))){return "file name outside arena";}
+        if(!again){continue;}
+        struct stage *st2 = &again->stages[s];
+        if(s >= again->nstages || st2->argc != st->argc){return "stage or word count differs after round trip";}
+        for(int k = 0; k < st->argc; k++){
+            if(strcmp(st->argv[k], st2->argv[k])){return "word differs after round trip";}
+        }
+        if(!sameString(r->infile, st2->redir.infile) || !sameString(r->outfile, st2->redir.outfile) || !sameString(r->errfile, st2->redir.errfile)){return "redirection differs after round trip";}
+        if((r->outfile && r->outflag != st2->redir.outflag) || (r->errfile && r->errflag != st2->redir.errflag)){return "redirection mode differs after round trip";}
+    }
+    if(again && (again->nstages != cl->nstages || again->background != cl->background)){return "stages or & differ after round trip";}
+    return NULL;
+}
+
+// Returns NULL if parseWords agrees with what parseLine made of line, which parsePlain accepted, otherwise what is wrong
+const char *checkPlain(struct arena *b, struct cmdline *cl, int result, const char *line, size_t start, size_t end){
+    char words[FUZZ_MAX_LEN];
+    struct cmdline split;
+    if(start == end){return result == PARSE_EMPTY ? NULL : "plain line of blanks not empty";}
+    if(result != PARSE_OK){return "plain line did not parse";}
+    memcpy(words, line + start, end - start);
+    words[end - start] = '\0';
+    if(parseWords(b, words, &split) != PARSE_OK || split.nstages != 1 || cl->nstages != 1){return "plain line not one stage";}
+    if(split.stages[0].argc != cl->stages[0].argc || split.stages[0].argv[split.stages[0].argc]){return "plain word count differs";}
+    for(int k = 0; k < cl->stages[0].argc; k++){
+        if(strcmp(split.stages[0].argv[k], cl->stages[0].argv[k])){return "plain word differs";}
+    }
+    return strcmp(split.text, cl->text) ? "plain text differs" : NULL;
+}
+
+int main(int argc, char *argv[]){
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+    unsigned seed = argc > 2 ? strtoul(argv[2], NULL, 10) : 357;
+    struct arena a, b;
+    struct cmdline cl, again;
+    char line[FUZZ_MAX_LEN];
+    size_t start, end;
+    char out[FUZZ_MAX_LEN * 5 + 64]; // Quoting can grow a word to 5 times its length, plus the operators
+    long counts[3] = {0, 0, 0};
+    srand(seed);
+    arenaInit(&a);
+    arenaInit(&b);
+    for(long n = 0; n < iterations; n++){
+        size_t len = rand() % FUZZ_MAX_LEN;
+        for(size_t i = 0; i < len; i++){
+            // Now and then any byte at all, including NUL, since the line is passed with its length
+            int pick = rand() % 16;
+            line[i] = pick == 0 ? (char)rand() : pick < 4 ? special[rand() % (sizeof(special) - 1)] : plain[rand() % (sizeof(plain) - 1)];
+        }
+        int result = parseLine(&a, line, len, &cl);
+        counts[result]++;
+        const char *problem = NULL;
+        if(result == PARSE_ERROR && !cl.error){problem = "rejected without a reason";}
+        else if(result == PARSE_OK){
+            if(!(problem = check(&a, &cl, NULL))){
+                size_t outlen = unparse(&cl, out);
+                if(parseLine(&b, out, outlen, &again) != PARSE_OK){problem = "round trip did not parse";}
+                else{problem = check(&a, &cl, &again);}
+            }
+        }
+        if(!problem && parsePlain(line, len, &start, &end)){problem = checkPlain(&b, &cl, result, line, start, end);}
+        if(problem){
+            printf("FAIL after %ld lines (seed %u): %s\n  line: ", n, seed, problem);
+            for(size_t i = 0; i < len; i++){printf(line[i] >= 32 && line[i] < 127 ? "%c" : "\\x%02x", (unsigned char)line[i]);}
+            printf("\n");
+            return 1;
+        }
+    }
+    printf("%ld lines: %ld parsed, %ld empty, %ld rejected, no failures\n", iterations, counts[PARSE_OK], counts[PARSE_EMPTY], counts[PARSE_ERROR]);
+    arenaFree(&a);
+    arenaFree(&b);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+
+# include "pathcache.h"
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <unistd.h>
+# include <sys/stat.h>
+
+void pathCacheInit(struct pathcache *c){
+    memset(c, 0, sizeof(*c));
+}
+
+void pathCacheClear(struct pathcache *c){
+    for(size_t i = 0; i < c->capacity; i++){
+        free(c->slots[i].name);
+        free(c->slots[i].path);
+    }
+    free(c->slots);
+    c->slots = NULL;
+    c->capacity = c->count = 0;
+}
+
+void pathCacheFree(struct pathcache *c){
+    pathCacheClear(c);
+    free(c->pathvar);
+    c->pathvar = NULL;
+}
+
+// FNV-1a
+static size_t hashName(const char *name){
+    size_t h = 14695981039346656037ULL;
+    for(; *name; name++){
+        h ^= (unsigned char)*name;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// The slot name is in, or the empty one it would go in
+static struct pathentry *findSlot(struct pathentry *slots, size_t capacity, const char *name){
+    size_t i = hashName(name) & (capacity - 1);
+    while(slots[i].name && strcmp(slots[i].name, name)){i = (i + 1) & (capacity - 1);}
+    return &slots[i];
+}
+
+static int grow(struct pathcache *c){
+    size_t newcap = c->capacity ? c->capacity * 2 : PATHCACHE_MIN;
+    struct pathentry *grown = calloc(newcap, sizeof(*grown));
+    if(!grown){return -1;}
+    for(size_t i = 0; i < c->capacity; i++){
+        if(c->slots[i].name){*findSlot(grown, newcap, c->slots[i].name) = c->slots[i];}
+    }
+    free(c->slots);
+    c->slots = grown;
+    c->capacity = newcap;
+    return 0;
+}
+
+// Searches PATH for name the way execvp does, except that candidates are checked with stat and access rather than
+// by trying to exec each one. Returns a malloc'd path or NULL.
+static char *search(const char *pathvar, const char *name){
+    size_t namelen = strlen(name);
+    const char *dir = pathvar;
+    for(;;){
+        const char *end = strchrnul(dir, ':');
+        size_t dirlen = end - dir;
+        char *candidate = malloc(dirlen + namelen + 2);
+        if(!candidate){return NULL;}
+        if(dirlen == 0){strcpy(candidate, name);} // An empty element is the current directory
+        else{
+            memcpy(candidate, dir, dirlen);
+            candidate[dirlen] = '/';
+            memcpy(candidate + dirlen + 1, name, namelen + 1);
+        }
+        struct stat st;
+        if(stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0){return candidate;}
+        free(candidate);
+        if(!*end){return NULL;}
+        dir = end + 1;
+    }
+}
+
+const char *pathLookup(struct pathcache *c, const char *name){
+    if(strchr(name, '/')){return name;}
+    const char *pathvar = getenv("PATH");
+    if(!pathvar){pathvar = PATHCACHE_DEFAULT_PATH;}
+    if(!c->pathvar || strcmp(c->pathvar, pathvar)){
+        pathCacheClear(c);
+        free(c->pathvar);
+        if(!(c->pathvar = strdup(pathvar))){return NULL;}
+    }
+    if((c->count + 1) * 2 > c->capacity && grow(c) < 0){return NULL;} // Kept at most half full
+    struct pathentry *e = findSlot(c->slots, c->capacity, name);
+    if(e->path){
+        c->hits++;
+        e->hits++;
+        return e->path;
+    }
+    c->misses++;
+    char *found = search(pathvar, name);
+    if(!found){
+        errno = ENOENT;
+        return NULL;
+    }
+    if(!e->name){
+        if(!(e->name = strdup(name))){
+            free(found);
+            return NULL;
+        }
+        c->count++;
+    }
+    e->path = found;
+    e->hits = 1;
+    return found;
+}
+
+void pathForget(struct pathcache *c, const char *name){
+    if(!c->capacity || strchr(name, '/')){return;}
+    struct pathentry *e = findSlot(c->slots, c->capacity, name);
+    free(e->path);
+    e->path = NULL;
+}
+
+void pathCachePrint(struct pathcache *c, FILE *f){
+    int any = 0;
+    for(size_t i = 0; i < c->capacity; i++){
+        if(!c->slots[i].path){continue;}
+        if(!any){fprintf(f, "hits\tcommand\n");}
+        fprintf(f, "%4ld\t%s\n", c->slots[i].hits, c->slots[i].path);
+        any = 1;
+    }
+    if(!any){fprintf(f, "hash: hash table empty\n");}
+    fprintf(f, "%ld hits, %ld misses\n", c->hits, c->misses);
+}
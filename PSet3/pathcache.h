@@ -0,0 +1,47 @@
+#ifndef _PATHCACHE_H
+#define _PATHCACHE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define PATHCACHE_MIN 64 // Initial slots, always a power of two
+#define PATHCACHE_DEFAULT_PATH "/bin:/usr/bin" // Searched when PATH is unset, as execvp does
+
+struct pathentry{
+    char *name; // NULL for an empty slot
+    char *path; // NULL once forgotten, the slot is kept and filled again on the next lookup
+    long hits;
+};
+
+// Command name to absolute path, the way sh's hash builtin remembers them
+struct pathcache{
+    struct pathentry *slots; // Open addressing, linear probing
+    size_t capacity, count;
+    char *pathvar; // The PATH the entries were resolved against
+    long hits, misses;
+};
+
+void pathCacheInit(struct pathcache *c);
+void pathCacheFree(struct pathcache *c);
+
+const char *pathLookup(struct pathcache *c, const char *name);
+/* Returns the file name would be run from: name itself if it contains a
+* slash, otherwise the first executable regular file called name in a
+* directory of PATH. Found paths are remembered, so only the first lookup
+* of a name stats anything. Everything is forgotten if PATH has changed
+* since. Returns NULL with errno set to ENOENT if there is no such command.
+*/
+
+void pathForget(struct pathcache *c, const char *name);
+/* Drops name's path, after running it failed with ENOENT.
+*/
+
+void pathCacheClear(struct pathcache *c);
+/* Forgets every path, for hash -r. The hit and miss counters are kept.
+*/
+
+void pathCachePrint(struct pathcache *c, FILE *f);
+/* Lists the remembered commands with their hits, then the totals.
+*/
+
+#endif
@@ -0,0 +1,99 @@
+# include "profile.h"
+# include <string.h>
+# include <errno.h>
+# include <unistd.h>
+# include <sys/time.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+
+int profileEvents[PROFILE_EVENTS];
+
+static const struct{
+    unsigned type;
+    unsigned long long config;
+} events[PROFILE_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+static int openEvent(int e, pid_t pid, int onexec){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[e].type;
+    attr.config = events[e].config;
+    attr.exclude_kernel = 1; // What the command itself does, and all an unprivileged user may count
+    attr.exclude_hv = 1;
+    attr.inherit = 1; // Includes whatever the command starts, a script's children for instance
+    attr.disabled = onexec;
+    attr.enable_on_exec = onexec; // Not the shell's side of the fork
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+int profileInit(void){
+    int available = 0;
+    for(int e = 0; e < PROFILE_EVENTS; e++){
+        int fd = openEvent(e, 0, 0);
+        if((profileEvents[e] = fd >= 0)){
+            close(fd);
+            available++;
+        }
+    }
+    errno = 0;
+    return available;
+}
+
+void profileAttach(pid_t pid, int fds[PROFILE_EVENTS]){
+    for(int e = 0; e < PROFILE_EVENTS; e++){
+        fds[e] = profileEvents[e] ? openEvent(e, pid, 1) : -1;
+    }
+    errno = 0;
+}
+
+void profileCollect(int fds[PROFILE_EVENTS], long long sums[PROFILE_EVENTS]){
+    for(int e = 0; e < PROFILE_EVENTS; e++){
+        long long count;
+        if(fds[e] < 0){continue;}
+        if(read(fds[e], &count, sizeof(count)) == sizeof(count)){sums[e] = sums[e] < 0 ? count : sums[e] + count;}
+        close(fds[e]);
+        fds[e] = -1;
+    }
+}
+
+double elapsedSince(struct timespec *start, struct timespec *diff){
+    struct timespec now, d;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    d.tv_sec = now.tv_sec - start->tv_sec;
+    d.tv_nsec = now.tv_nsec - start->tv_nsec;
+    if(d.tv_nsec < 0){
+        d.tv_sec--;
+        d.tv_nsec += 1000000000L;
+    }
+    if(diff){*diff = d;}
+    return d.tv_sec + d.tv_nsec / 1e9;
+}
+
+void addUsage(struct rusage *sum, struct rusage *ru){
+    timeradd(&sum->ru_utime, &ru->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &ru->ru_stime, &sum->ru_stime);
+    if(ru->ru_maxrss > sum->ru_maxrss){sum->ru_maxrss = ru->ru_maxrss;}
+    sum->ru_minflt += ru->ru_minflt;
+    sum->ru_majflt += ru->ru_majflt;
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+    sum->ru_inblock += ru->ru_inblock;
+    sum->ru_oublock += ru->ru_oublock;
+}
+
+void jsonString(FILE *f, const char *s){
+    putc('"', f);
+    for(; *s; s++){
+        unsigned char c = *s;
+        if(c == '"' || c == '\\'){fprintf(f, "\\%c", c);}
+        else if(c < 0x20){fprintf(f, "\\u%04x", c);}
+        else{putc(c, f);}
+    }
+    putc('"', f);
+}
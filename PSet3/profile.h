@@ -0,0 +1,49 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Counters attached to every profiled process, in this order
+#define PROFILE_CYCLES 0
+#define PROFILE_INSTRUCTIONS 1
+#define PROFILE_CACHE_MISSES 2
+#define PROFILE_TASK_CLOCK 3 // Software: CPU time in ns, there even where the hardware counters are not
+#define PROFILE_EVENTS 4
+
+extern int profileEvents[PROFILE_EVENTS];
+/* 1 for each counter perf_event_open allowed when profileInit probed it.
+*/
+
+int profileInit(void);
+/* Checks which counters this process may open (user-space only, so
+* perf_event_paranoid up to 2 is enough). Returns how many are available.
+*/
+
+void profileAttach(pid_t pid, int fds[PROFILE_EVENTS]);
+/* Opens the available counters on pid and its future children, stopped
+* until pid execs. pid must not have exec'd yet: launch it with a gate (see
+* struct redirect). Counters that could not be opened are left at -1.
+*/
+
+void profileCollect(int fds[PROFILE_EVENTS], long long sums[PROFILE_EVENTS]);
+/* Adds the final counts of an exited process to sums and closes the
+* counters. A sum that is still -1 (nothing counted yet) is set instead.
+*/
+
+double elapsedSince(struct timespec *start, struct timespec *diff);
+/* CLOCK_MONOTONIC time since start, in seconds, and in *diff if not NULL.
+*/
+
+void addUsage(struct rusage *sum, struct rusage *ru);
+/* Accumulates ru into sum: times and counts are added, ru_maxrss is the
+* largest seen.
+*/
+
+void jsonString(FILE *f, const char *s);
+/* Writes s as a quoted JSON string.
+*/
+
+#endif
@@ -0,0 +1,211 @@
+# include "script.h"
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+
+#define TABLE_MIN 256
+
+// Makes room for at least SCRIPT_CHUNK more bytes after data[size]
+static int reserve(struct script *s){
+    if(s->cap - s->size >= SCRIPT_CHUNK){return 0;}
+    size_t newcap = s->cap ? s->cap * 2 : SCRIPT_CHUNK;
+    while(newcap - s->size < SCRIPT_CHUNK){newcap *= 2;}
+    char *grown = realloc(s->data, newcap);
+    if(!grown){return -1;}
+    s->data = grown;
+    s->cap = newcap;
+    return 0;
+}
+
+// Reads what there is of a stream into data after the unreturned part, which is moved to the front first.
+// Returns the bytes read, 0 at the end, or -1.
+static ssize_t fill(struct script *s){
+    if(s->pos){
+        memmove(s->data, s->data + s->pos, s->size - s->pos);
+        s->size -= s->pos;
+        s->pos = 0;
+    }
+    if(reserve(s) < 0){return -1;}
+    ssize_t n;
+    while((n = read(0, s->data + s->size, s->cap - s->size)) < 0 && errno == EINTR){}
+    if(n == 0){s->eof = 1;}
+    if(n > 0){s->size += n;}
+    return n;
+}
+
+int scriptOpen(struct script *s, const char *path){
+    memset(s, 0, sizeof(*s));
+    if(!path){
+        s->mode = SCRIPT_STREAM;
+        return 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0){return -1;}
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+        void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped != MAP_FAILED){
+            madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+            s->mode = SCRIPT_MAPPED;
+            s->data = mapped;
+            s->size = st.st_size;
+            close(fd);
+            return 0;
+        }
+    }
+    // Pipes, devices and process substitutions cannot be mapped, so they are read until they end
+    s->mode = SCRIPT_SLURPED;
+    for(;;){
+        ssize_t n;
+        if(reserve(s) < 0){break;}
+        if((n = read(fd, s->data + s->size, s->cap - s->size)) < 0){
+            if(errno == EINTR){continue;}
+            break;
+        }
+        if(n == 0){
+            close(fd);
+            errno = 0;
+            return 0;
+        }
+        s->size += n;
+    }
+    int readerr = errno;
+    close(fd);
+    scriptClose(s);
+    errno = readerr;
+    return -1;
+}
+
+// The next line as it is in the script. Returns its length, or -1 at the end (errno 0) or if reading failed.
+static ssize_t physicalLine(struct script *s, const char **line){
+    for(;;){
+        char *start = s->data + s->pos;
+        char *newline = s->pos < s->size ? memchr(start, '\n', s->size - s->pos) : NULL;
+        if(newline || s->mode != SCRIPT_STREAM || s->eof){
+            if(s->pos == s->size){
+                errno = 0;
+                return -1;
+            }
+            char *end = newline ? newline : s->data + s->size; // The last line need not have a newline
+            *line = start;
+            s->pos = newline ? (size_t)(newline + 1 - s->data) : s->size;
+            s->lines++;
+            return end - start;
+        }
+        if(fill(s) < 0){return -1;}
+    }
+}
+
+// Ends in a backslash that is not escaped itself
+static int continues(const char *line, size_t len){
+    size_t backslashes = 0;
+    while(backslashes < len && line[len - 1 - backslashes] == '\\'){backslashes++;}
+    return backslashes % 2;
+}
+
+// Appends len bytes to the joined line, which has used bytes so far
+static int join(struct script *s, size_t used, const char *line, size_t len){
+    if(used + len + 1 > s->joinedcap){
+        size_t newcap = s->joinedcap ? s->joinedcap : 4096;
+        while(newcap < used + len + 1){newcap *= 2;}
+        char *grown = realloc(s->joined, newcap);
+        if(!grown){return -1;}
+        s->joined = grown;
+        s->joinedcap = newcap;
+    }
+    memcpy(s->joined + used, line, len);
+    return 0;
+}
+
+ssize_t scriptNext(struct script *s, const char **line){
+    ssize_t len = physicalLine(s, line);
+    if(len < 0){return -1;}
+    s->lineno = s->lines;
+    if(!continues(*line, len)){return len;} // The usual case, handed out straight from the script
+    // A stream's buffer can move while the next line is read, so each piece is copied before that happens
+    size_t used = 0;
+    while(len >= 0 && continues(*line, len)){
+        if(join(s, used, *line, len - 1) < 0){return -1;}
+        used += len - 1;
+        len = physicalLine(s, line);
+    }
+    if(len >= 0){
+        if(join(s, used, *line, len) < 0){return -1;}
+        used += len;
+    }
+    else if(errno){return -1;} // Otherwise the script ended on a continuation, which joins on nothing
+    *line = s->joined;
+    return used;
+}
+
+void scriptClose(struct script *s){
+    if(s->mode == SCRIPT_MAPPED){munmap(s->data, s->size);}
+    else{free(s->data);}
+    free(s->joined);
+    memset(s, 0, sizeof(*s));
+}
+
+int scriptCompile(struct script *s, struct commandtable *t){
+    struct arena scratch; // parseLine reserves for the worst case, so only the copy that fits is kept
+    struct cmdline cl;
+    const char *line;
+    ssize_t len;
+    size_t start, end;
+    memset(t, 0, sizeof(*t));
+    arenaKeep(&t->arena);
+    arenaInit(&scratch);
+    if(s->mode != SCRIPT_STREAM){ // All there already, so the table can be sized once instead of doubled up to it
+        size_t lines = 1;
+        for(const char *p = s->data + s->pos; (p = memchr(p, '\n', s->data + s->size - p)); p++){lines++;}
+        if((t->commands = malloc(lines * sizeof(*t->commands)))){t->cap = lines;}
+    }
+    while((len = scriptNext(s, &line)) >= 0){
+        if(t->count == t->cap){
+            size_t newcap = t->cap ? t->cap * 2 : TABLE_MIN;
+            struct command *grown = realloc(t->commands, newcap * sizeof(*grown));
+            if(!grown){break;}
+            t->commands = grown;
+            t->cap = newcap;
+        }
+        struct command *c = &t->commands[t->count];
+        c->line = s->lineno;
+        c->cl = NULL;
+        c->words = NULL;
+        c->parsed = PARSE_OK;
+        if(parsePlain(line, len, &start, &end)){
+            if(start == end){continue;}
+            if(!(c->words = arenaString(&t->arena, line + start, end - start))){break;}
+            t->count++;
+            continue;
+        }
+        c->parsed = parseLine(&scratch, line, len, &cl);
+        if(c->parsed == PARSE_EMPTY && !cl.nwarnings){continue;}
+        if(c->parsed != PARSE_OK){ // Only the messages are needed from these
+            cl.stages = NULL;
+            cl.nstages = 0;
+            cl.text = NULL;
+        }
+        if(!(c->cl = cmdlineKeep(&t->arena, &cl))){break;}
+        t->count++;
+    }
+    int readerr = len < 0 ? errno : ENOMEM;
+    arenaFree(&scratch);
+    errno = readerr;
+    return readerr ? -1 : 0;
+}
+
+int commandParsed(struct command *c, struct arena *a, struct cmdline *cl){
+    if(!c->cl){return parseWords(a, c->words, cl);}
+    *cl = *c->cl;
+    return c->parsed;
+}
+
+void commandTableFree(struct commandtable *t){
+    free(t->commands);
+    arenaFree(&t->arena);
+    memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,74 @@
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "parse.h"
+
+// How a script's text is held
+#define SCRIPT_MAPPED 0 // A regular file, mmap'd whole
+#define SCRIPT_SLURPED 1 // Any other file, read whole into memory
+#define SCRIPT_STREAM 2 // Standard input, read as lines arrive so a terminal or parent shell can feed it
+
+#define SCRIPT_CHUNK 65536 // Read size for slurping and streaming
+
+struct script{
+    int mode;
+    char *data; // The script, or for a stream what has been read and not yet returned
+    size_t size, pos; // Bytes in data, and where the next line starts
+    size_t cap; // Room in data when it is malloc'd
+    int eof; // A stream has reached its end
+    char *joined; // Lines spliced together by continuations
+    size_t joinedcap;
+    long lineno; // Line the last one returned started on
+    long lines; // Lines read so far
+};
+
+int scriptOpen(struct script *s, const char *path);
+/* Opens path, or standard input if path is NULL, for scriptNext. A file is
+* mapped or read in whole and its descriptor closed straight away, so no
+* command ever inherits it. A mapped script that a command truncates while
+* it runs kills the shell with SIGBUS when it reads past the new end;
+* scriptCompile and scriptClose before running anything avoids that.
+* Returns 0, or -1 with errno set.
+*/
+
+ssize_t scriptNext(struct script *s, const char **line);
+/* Sets *line to the next line and returns its length, without the newline.
+* Lines can be any length. A backslash at the very end of a line (one that is
+* not itself escaped by another) joins the next line on in its place,
+* wherever it is. The line stays valid until the next call. Returns -1 at
+* the end of the script, with errno set if reading failed.
+*/
+
+void scriptClose(struct script *s);
+
+// A script parsed in full before any of it runs. Most lines are plain words (see parsePlain), and only their
+// text is kept, to be split as they run; that costs less than the room a whole cmdline takes for each.
+struct command{
+    struct cmdline *cl; // Kept parse, NULL for a plain line
+    char *words; // A plain line's text
+    long line; // Where it started in the script
+    int parsed; // parseLine's result
+};
+
+struct commandtable{
+    struct command *commands;
+    size_t count, cap;
+    struct arena arena; // Kept, holds every command's parse
+};
+
+int scriptCompile(struct script *s, struct commandtable *t);
+/* Reads the rest of s and parses every line into t, in order. Blank lines
+* and comments are left out unless parsing them gave warnings. Returns 0,
+* or -1 with errno set if the script could not be read or memory ran out.
+*/
+
+int commandParsed(struct command *c, struct arena *a, struct cmdline *cl);
+/* Fills cl with c's parse, splitting a plain line in scratch arena a, and
+* returns what parseLine returned for it.
+*/
+
+void commandTableFree(struct commandtable *t);
+
+#endif
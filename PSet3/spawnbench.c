@@ -0,0 +1,190 @@
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <spawn.h>
+# include <time.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/wait.h>
+# include "launch.h"
+
+// spawnbench.c
+// By: Jeffrey Wong
+/* Benchmark for myshell's launch paths. Runs a script of /bin/true lines (10k by default, pass a
+count to override and the path to myshell after it) through myshell with fork and with posix_spawn
+and reports commands/s for each. First it checks that both methods still run a script with no #! line
+through /bin/sh, as execvp always has, by path and by name through PATH. Since the cost of fork grows with the parent's page tables, it then
+launches /bin/true straight from this process with both methods while holding 0, 256 MB and 1 GB of
+touched memory, which is what a shell that has grown large looks like to the kernel. */
+
+#define BALLAST_RUNS 2000 // Launches per method and ballast size in the in-process part
+
+extern char **environ;
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs myshell on script with its output thrown away and returns the wall time, or -1 if it could not be run
+double runShell(char *shell, char *flag, char *script){
+    char *argv[4];
+    int n = 0;
+    argv[n++] = shell;
+    if(flag){argv[n++] = flag;}
+    argv[n++] = script;
+    argv[n] = NULL;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    int status;
+    double start = now();
+    if((errno = posix_spawn(&pid, shell, &actions, NULL, argv, environ))){
+        fprintf(stderr, "ERROR: Could not run %s: %s\n", shell, strerror(errno));
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+    waitpid(pid, &status, 0);
+    double elapsed = now() - start;
+    posix_spawn_file_actions_destroy(&actions);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "ERROR: %s exited with status %d\n", shell, status);
+        return -1;
+    }
+    return elapsed;
+}
+
+// Launches /bin/true runs times with method and returns commands/s
+double launchRate(int method, int runs){
+    char *argv[] = {"/bin/true", NULL};
+    struct redirect r;
+    memset(&r, 0, sizeof(r));
+    r.pipein = r.pipeout = r.gate = -1;
+    double start = now();
+    for(int i = 0; i < runs; i++){
+        pid_t pid;
+        int status;
+        if(launchCommand(argv, NULL, &r, method, &pid) != 0){return -1;}
+        waitpid(pid, &status, 0);
+    }
+    return runs / (now() - start);
+}
+
+// Launches argv with method and returns its exit status, or -1 if it could not be launched or was killed
+int launchStatus(char **argv, int method){
+    struct redirect r;
+    pid_t pid;
+    int status;
+    memset(&r, 0, sizeof(r));
+    r.pipein = r.pipeout = r.gate = -1;
+    if(launchCommand(argv, NULL, &r, method, &pid) != 0){return -1;}
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// A script without #! must come back with the status it exits with, whichever method starts it. Returns the failures.
+int checkScripts(void){
+    char dir[] = "/tmp/spawnbenchXXXXXX", script[64], *path = getenv("PATH"), *name;
+    int failures = 0;
+    if(!mkdtemp(dir)){
+        fprintf(stderr, "ERROR: Could not create directory for the script check: %s\n", strerror(errno));
+        return 1;
+    }
+    snprintf(script, sizeof(script), "%s/noshebang", dir);
+    name = strrchr(script, '/') + 1;
+    FILE *f = fopen(script, "w");
+    if(!f){
+        fprintf(stderr, "ERROR: Could not create %s: %s\n", script, strerror(errno));
+        rmdir(dir);
+        return 1;
+    }
+    fputs("exit 42\n", f);
+    fclose(f);
+    chmod(script, 0755);
+    char searched[strlen(dir) + (path ? strlen(path) : 0) + 2];
+    sprintf(searched, "%s%s%s", dir, path ? ":" : "", path ? path : "");
+    setenv("PATH", searched, 1);
+    const char *names[] = {"fork", "posix_spawn"};
+    int methods[] = {LAUNCH_FORK, LAUNCH_SPAWN};
+    for(int m = 0; m < 2; m++){
+        char *byname[] = {name, NULL}, *bypath[] = {script, NULL};
+        int statuses[2] = {launchStatus(bypath, methods[m]), launchStatus(byname, methods[m])};
+        for(int i = 0; i < 2; i++){
+            if(statuses[i] != 42){
+                fprintf(stderr, "FAIL: %s did not run a script without #! by %s (status %d)\n", names[m], i ? "name" : "path", statuses[i]);
+                failures++;
+            }
+        }
+    }
+    if(path){setenv("PATH", path, 1);}
+    else{unsetenv("PATH");}
+    unlink(script);
+    rmdir(dir);
+    if(!failures){printf("Scripts without #! run through /bin/sh with fork and posix_spawn\n");}
+    return failures;
+}
+
+int main(int argc, char *argv[]){
+    long lines = argc > 1 ? strtol(argv[1], NULL, 10) : 10000;
+    char *shell = argc > 2 ? argv[2] : "./myshell.exe";
+    char script[] = "/tmp/spawnbenchXXXXXX";
+    int failures = 0;
+    if(lines < 1){
+        fprintf(stderr, "ERROR: Line count must be positive.\n");
+        return -1;
+    }
+
+    failures += checkScripts();
+    int fd = mkstemp(script);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "w");
+    if(!f){
+        fprintf(stderr, "ERROR: Could not create script: %s\n", strerror(errno));
+        return -1;
+    }
+    for(long i = 0; i < lines; i++){fputs("/bin/true\n", f);}
+    fclose(f);
+
+    printf("%ld /bin/true lines through %s:\n", lines, shell);
+    char *flags[] = {"-f", NULL};
+    const char *names[] = {"fork", "posix_spawn"};
+    for(int m = 0; m < 2; m++){
+        double elapsed = runShell(shell, flags[m], script);
+        if(elapsed < 0){
+            failures++;
+            continue;
+        }
+        printf("  %-12s %10.0f commands/s  (%.3f s)\n", names[m], lines / elapsed, elapsed);
+    }
+    unlink(script);
+
+    long sizes[] = {0, 256, 1024};
+    printf("Launching /bin/true %d times from a process holding:\n", BALLAST_RUNS);
+    for(int s = 0; s < 3; s++){
+        size_t len = (size_t)sizes[s] << 20;
+        char *ballast = len ? mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0) : NULL;
+        if(ballast == MAP_FAILED){
+            printf("  %5ld MB: could not allocate\n", sizes[s]);
+            continue;
+        }
+        if(len){
+            madvise(ballast, len, MADV_NOHUGEPAGE); // Ordinary 4K pages, the way a heap built up from small allocations ends up
+            memset(ballast, 1, len); // Touch every page so it really is mapped
+        }
+        double forkrate = launchRate(LAUNCH_FORK, BALLAST_RUNS);
+        double spawnrate = launchRate(LAUNCH_SPAWN, BALLAST_RUNS);
+        if(forkrate < 0 || spawnrate < 0){
+            failures++;
+        }
+        else{
+            printf("  %5ld MB: fork %8.0f/s  posix_spawn %8.0f/s  (%.1fx)\n", sizes[s], forkrate, spawnrate, spawnrate / forkrate);
+        }
+        if(len){munmap(ballast, len);}
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,407 @@
+# include "utils.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <time.h>
+# include <unistd.h>
+# include <sys/stat.h>
+
+#define UTIL_BUFSIZE 65536
+
+static const struct utility utilities[] = {
+    {"echo", utilEcho, 0},
+    {"true", utilTrue, 0},
+    {"false", utilFalse, 0},
+    {"test", utilTest, 0},
+    {"[", utilTest, 0},
+    {"cat", utilCat, 1},
+    {"sleep", utilSleep, 1},
+};
+
+const struct utility *utilityFind(const char *name){
+    for(size_t i = 0; i < sizeof(utilities) / sizeof(*utilities); i++){
+        if(!strcmp(utilities[i].name, name)){return &utilities[i];}
+    }
+    return NULL;
+}
+
+// Writes all of buf, returns -1 on failure
+static int writeAll(int fd, const char *buf, size_t len){
+    while(len){
+        ssize_t n = write(fd, buf, len);
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Messages go out the same way, through whatever fd 2 is at the moment
+static void utilError(const char *name, const char *what, const char *why){
+    char msg[1024];
+    int n = why ? snprintf(msg, sizeof(msg), "%s: %s: %s\n", name, what, why) : snprintf(msg, sizeof(msg), "%s: %s\n", name, what);
+    if(n > (int)sizeof(msg) - 1){n = sizeof(msg) - 1;}
+    writeAll(2, msg, n);
+}
+
+// ---------------------------------------------------------------------------------------------
+// echo
+
+// Appends to the output buffer, flushing it to stdout when full
+struct outbuf{
+    char buf[UTIL_BUFSIZE];
+    size_t len;
+    int failed;
+};
+
+static void put(struct outbuf *o, char c){
+    if(o->len == sizeof(o->buf)){
+        if(writeAll(1, o->buf, o->len) < 0){o->failed = 1;}
+        o->len = 0;
+    }
+    o->buf[o->len++] = c;
+}
+
+// Handles the escape at s (just past the backslash), returns how many characters it used or -1 for \c
+static int escape(struct outbuf *o, const char *s){
+    int value = 0, used = 1;
+    switch(*s){
+        case 'a': put(o, '\a'); return 1;
+        case 'b': put(o, '\b'); return 1;
+        case 'c': return -1;
+        case 'e': put(o, 27); return 1;
+        case 'f': put(o, '\f'); return 1;
+        case 'n': put(o, '\n'); return 1;
+        case 'r': put(o, '\r'); return 1;
+        case 't': put(o, '\t'); return 1;
+        case 'v': put(o, '\v'); return 1;
+        case '\\': put(o, '\\'); return 1;
+        case '0':
+            for(; used < 4 && s[used] >= '0' && s[used] <= '7'; used++){value = value * 8 + s[used] - '0';}
+            put(o, value);
+            return used;
+        case 'x':
+            for(; used < 3; used++){
+                char h = s[used];
+                int digit = h >= '0' && h <= '9' ? h - '0' : h >= 'a' && h <= 'f' ? h - 'a' + 10 : h >= 'A' && h <= 'F' ? h - 'A' + 10 : -1;
+                if(digit < 0){break;}
+                value = value * 16 + digit;
+            }
+            if(used == 1){ // No digits: printed as is
+                put(o, '\\');
+                put(o, 'x');
+                return 1;
+            }
+            put(o, value);
+            return used;
+        default:
+            put(o, '\\');
+            return 0;
+    }
+}
+
+int utilEcho(int argc, char **argv){
+    static struct outbuf o; // Too big for a comfortable stack frame, and the shell only runs one at a time
+    int newline = 1, escapes = 0, i;
+    o.len = 0;
+    o.failed = 0;
+    // Like coreutils, only arguments made entirely of n, e and E count as options
+    for(i = 1; i < argc && argv[i][0] == '-' && argv[i][1] && strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1); i++){
+        for(char *f = argv[i] + 1; *f; f++){
+            if(*f == 'n'){newline = 0;}
+            else{escapes = *f == 'e';}
+        }
+    }
+    for(int first = i; i < argc; i++){
+        if(i > first){put(&o, ' ');}
+        for(const char *s = argv[i]; *s; s++){
+            if(escapes && *s == '\\' && s[1]){
+                int used = escape(&o, s + 1);
+                if(used < 0){ // \c: nothing more at all
+                    newline = 0;
+                    i = argc;
+                    break;
+                }
+                s += used;
+            }
+            else{
+                put(&o, *s);
+            }
+        }
+    }
+    if(newline){put(&o, '\n');}
+    if(writeAll(1, o.buf, o.len) < 0 || o.failed){
+        utilError("echo", "write error", strerror(errno));
+        errno = 0;
+        return 1;
+    }
+    return 0;
+}
+
+int utilTrue(int argc, char **argv){
+    return 0;
+}
+
+int utilFalse(int argc, char **argv){
+    return 1;
+}
+
+// ---------------------------------------------------------------------------------------------
+// test and [
+
+struct testparse{
+    char **argv;
+    int pos, end;
+    int error;
+};
+
+static int isUnary(const char *op){
+    return op[0] == '-' && op[1] && !op[2] && strchr("bcdefghLnprsStuwxz", op[1]);
+}
+
+static int isBinary(const char *op){
+    static const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+    for(int i = 0; ops[i]; i++){
+        if(!strcmp(op, ops[i])){return 1;}
+    }
+    return 0;
+}
+
+static int testError(struct testparse *p, const char *what, const char *arg){
+    if(!p->error){utilError("test", what, arg);}
+    p->error = 1;
+    return 0;
+}
+
+static long long toInteger(struct testparse *p, const char *s){
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    while(*end == ' ' || *end == '\t'){end++;}
+    if(end == s || *end || errno){
+        errno = 0;
+        testError(p, "integer expression expected", s);
+    }
+    return v;
+}
+
+static int unary(struct testparse *p, char op, const char *arg){
+    struct stat st;
+    switch(op){
+        case 'n': return arg[0] != '\0';
+        case 'z': return arg[0] == '\0';
+        case 't': return isatty(toInteger(p, arg));
+        case 'h':
+        case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+    }
+    int exists = stat(arg, &st) == 0;
+    errno = 0;
+    if(!exists){return 0;}
+    switch(op){
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'e': return 1;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+    }
+    return 0;
+}
+
+static int binary(struct testparse *p, const char *a, const char *op, const char *b){
+    if(!strcmp(op, "=") || !strcmp(op, "==")){return !strcmp(a, b);}
+    if(!strcmp(op, "!=")){return strcmp(a, b) != 0;}
+    if(!strcmp(op, "<")){return strcmp(a, b) < 0;}
+    if(!strcmp(op, ">")){return strcmp(a, b) > 0;}
+    if(op[1] == 'n' || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')){
+        struct stat sa, sb;
+        int ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+        errno = 0;
+        if(!strcmp(op, "-ef")){return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;}
+        // A file that does not exist is older than one that does
+        int newer = ha && (!hb || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec || (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec));
+        int older = hb && (!ha || sb.st_mtim.tv_sec > sa.st_mtim.tv_sec || (sb.st_mtim.tv_sec == sa.st_mtim.tv_sec && sb.st_mtim.tv_nsec > sa.st_mtim.tv_nsec));
+        return !strcmp(op, "-nt") ? newer : older;
+    }
+    long long x = toInteger(p, a), y = toInteger(p, b);
+    if(!strcmp(op, "-eq")){return x == y;}
+    if(!strcmp(op, "-ne")){return x != y;}
+    if(!strcmp(op, "-lt")){return x < y;}
+    if(!strcmp(op, "-le")){return x <= y;}
+    if(!strcmp(op, "-gt")){return x > y;}
+    return x >= y;
+}
+
+static int orExpr(struct testparse *p);
+
+static int primary(struct testparse *p){
+    char **a = p->argv;
+    int left = p->end - p->pos;
+    if(left <= 0){return testError(p, "argument expected", NULL);}
+    if(!strcmp(a[p->pos], "!")){
+        p->pos++;
+        return !primary(p);
+    }
+    if(!strcmp(a[p->pos], "(") && left > 1){
+        p->pos++;
+        int v = orExpr(p);
+        if(p->pos >= p->end || strcmp(a[p->pos], ")")){return testError(p, "')' expected", NULL);}
+        p->pos++;
+        return v;
+    }
+    if(left >= 3 && isBinary(a[p->pos + 1])){
+        p->pos += 3;
+        return binary(p, a[p->pos - 3], a[p->pos - 2], a[p->pos - 1]);
+    }
+    if(left >= 2 && isUnary(a[p->pos])){
+        p->pos += 2;
+        return unary(p, a[p->pos - 2][1], a[p->pos - 1]);
+    }
+    return a[p->pos++][0] != '\0';
+}
+
+static int andExpr(struct testparse *p){
+    int v = primary(p);
+    while(p->pos < p->end && !strcmp(p->argv[p->pos], "-a")){
+        p->pos++;
+        v = primary(p) && v;
+    }
+    return v;
+}
+
+static int orExpr(struct testparse *p){
+    int v = andExpr(p);
+    while(p->pos < p->end && !strcmp(p->argv[p->pos], "-o")){
+        p->pos++;
+        v = andExpr(p) || v;
+    }
+    return v;
+}
+
+// POSIX decides by argument count up to four, which is what keeps things like [ "(" ] and [ ! = x ] unambiguous
+static int evaluate(struct testparse *p, int start, int n){
+    char **a = p->argv + start;
+    switch(n){
+        case 0:
+            return 0;
+        case 1:
+            return a[0][0] != '\0';
+        case 2:
+            if(!strcmp(a[0], "!")){return !evaluate(p, start + 1, 1);}
+            if(isUnary(a[0])){return unary(p, a[0][1], a[1]);}
+            return testError(p, a[0], "unary operator expected");
+        case 3:
+            if(isBinary(a[1])){return binary(p, a[0], a[1], a[2]);}
+            if(!strcmp(a[1], "-a")){return a[0][0] && a[2][0];}
+            if(!strcmp(a[1], "-o")){return a[0][0] || a[2][0];}
+            if(!strcmp(a[0], "!")){return !evaluate(p, start + 1, 2);}
+            if(!strcmp(a[0], "(") && !strcmp(a[2], ")")){return evaluate(p, start + 1, 1);}
+            return testError(p, a[1], "binary operator expected");
+        case 4:
+            if(!strcmp(a[0], "!")){return !evaluate(p, start + 1, 3);}
+            if(!strcmp(a[0], "(") && !strcmp(a[3], ")")){return evaluate(p, start + 1, 2);}
+    }
+    p->pos = start;
+    int v = orExpr(p);
+    if(p->pos < p->end){testError(p, p->argv[p->pos], "unexpected argument");}
+    return v;
+}
+
+int utilTest(int argc, char **argv){
+    struct testparse p = {argv, 1, argc, 0};
+    if(!strcmp(argv[0], "[")){
+        if(strcmp(argv[argc - 1], "]")){
+            utilError("[", "missing ']'", NULL);
+            return 2;
+        }
+        p.end--;
+    }
+    int v = evaluate(&p, 1, p.end - 1);
+    return p.error ? 2 : !v;
+}
+
+// ---------------------------------------------------------------------------------------------
+// cat
+
+static int catFd(int fd, const char *name){
+    static char buf[UTIL_BUFSIZE];
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) != 0){
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            utilError("cat", name, strerror(errno));
+            errno = 0;
+            return 1;
+        }
+        if(writeAll(1, buf, n) < 0){
+            utilError("cat", "write error", strerror(errno));
+            errno = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int utilCat(int argc, char **argv){
+    int status = 0, files = 0;
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-u")){continue;} // Unbuffered is all we do
+        files++;
+        if(!strcmp(argv[i], "-")){
+            status |= catFd(0, "-");
+            continue;
+        }
+        int fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+        if(fd < 0){
+            utilError("cat", argv[i], strerror(errno));
+            errno = 0;
+            status = 1;
+            continue;
+        }
+        status |= catFd(fd, argv[i]);
+        close(fd);
+    }
+    if(!files){status = catFd(0, "-");}
+    return status;
+}
+
+// ---------------------------------------------------------------------------------------------
+// sleep
+
+int utilSleep(int argc, char **argv){
+    double total = 0;
+    if(argc < 2){
+        utilError("sleep", "missing operand", NULL);
+        return 1;
+    }
+    for(int i = 1; i < argc; i++){
+        char *end;
+        double v = strtod(argv[i], &end);
+        double scale = !*end || !strcmp(end, "s") ? 1 : !strcmp(end, "m") ? 60 : !strcmp(end, "h") ? 3600 : !strcmp(end, "d") ? 86400 : -1;
+        if(end == argv[i] || scale < 0 || v < 0 || v != v){
+            utilError("sleep", "invalid time interval", argv[i]);
+            errno = 0;
+            return 1;
+        }
+        total += v * scale;
+    }
+    struct timespec req, rem;
+    req.tv_sec = total > 1e9 ? 1000000000 : (time_t)total;
+    req.tv_nsec = (long)((total - req.tv_sec) * 1e9);
+    if(req.tv_nsec < 0 || req.tv_nsec >= 1000000000L){req.tv_nsec = 0;}
+    while(nanosleep(&req, &rem) < 0 && errno == EINTR){req = rem;}
+    errno = 0;
+    return 0;
+}
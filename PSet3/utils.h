@@ -0,0 +1,35 @@
+#ifndef _UTILS_H
+#define _UTILS_H
+
+// Small utilities myshell runs in-process instead of launching /bin ones: echo, true, false, test, [, cat, sleep
+
+typedef int (*utilityfn)(int argc, char **argv);
+
+struct utility{
+    const char *name;
+    utilityfn run;
+    int blocks; // Can wait on something else (a pipe, a timer), so never run where it would hold up other lines
+};
+
+const struct utility *utilityFind(const char *name);
+/* Returns the utility called name, or NULL if it has to be run from PATH.
+*/
+
+/* Each one behaves like its coreutils counterpart for the options below,
+* writes with write(2) straight to file descriptors 1 and 2 (so it sees
+* whatever has been dup2'd there) and returns the exit status: 0 for
+* success or true, 1 for failure or false, 2 for a test usage error.
+*   echo [-neE] args    -e turns on \\ \a \b \c \e \f \n \r \t \v \0nnn \xHH
+*   test expr, [ expr ] the POSIX unary file and string tests, = != < >,
+*                       -eq -ne -lt -le -gt -ge, -nt -ot -ef, !, -a, -o, ( )
+*   cat [-u] [file|-]...
+*   sleep N[smhd]...    N may have a fraction
+*/
+int utilEcho(int argc, char **argv);
+int utilTrue(int argc, char **argv);
+int utilFalse(int argc, char **argv);
+int utilTest(int argc, char **argv);
+int utilCat(int argc, char **argv);
+int utilSleep(int argc, char **argv);
+
+#endif
@@ -0,0 +1,142 @@
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <spawn.h>
+# include <time.h>
+# include <sys/wait.h>
+# include "words.h"
+
+// acbench.c
+// By: Jeffrey Wong
+/* Benchmark for wordsearch -s. Writes dictionaries of 1k, 100k and 1M random words as wordgen makes
+them, and two inputs of 64MB (or the size in MB given as an argument): "words", wordgen's own output,
+where matches are everywhere, and "log", lowercase log lines with one dictionary word in each, where
+they are rare. Each dictionary is run once on empty input to time building the automaton, and then
+on each input, with the matches thrown away; the input's MB/s leaves out the build time. Runs from
+the directory wordsearch is built in. */
+
+#define BENCH_SEED 12345
+
+extern char **environ;
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs wordsearch -s dict with stdin from in. Returns the wall time, or -1 if it could not be run.
+double runSearch(char *dict, char *in){
+    char *argv[] = {"./wordsearch", "-s", dict, NULL};
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, in, O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    int status;
+    double start = now();
+    errno = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(errno){
+        fprintf(stderr, "ERROR: Could not run %s: %s\n", argv[0], strerror(errno));
+        return -1;
+    }
+    waitpid(pid, &status, 0);
+    double elapsed = now() - start;
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "ERROR: wordsearch exited with status %d\n", status);
+        return -1;
+    }
+    return elapsed;
+}
+
+int writeDict(const char *path, long words){
+    char word[WORD_MAX + 1];
+    struct wordrng rng;
+    FILE *f = fopen(path, "w");
+    if(!f){
+        fprintf(stderr, "ERROR: Could not create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    wordSeed(&rng, BENCH_SEED, 0);
+    for(long i = 0; i < words; i++){
+        randomWord(&rng, word);
+        fprintf(f, "%s\n", word);
+    }
+    fclose(f);
+    return 0;
+}
+
+// Writes about bytes of input in the given style, words from the same generator as the dictionaries
+int writeInput(const char *path, long bytes, int log){
+    char word[WORD_MAX + 1];
+    struct wordrng rng;
+    FILE *f = fopen(path, "w");
+    long written = 0;
+    if(!f){
+        fprintf(stderr, "ERROR: Could not create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    wordSeed(&rng, BENCH_SEED, 1);
+    for(long line = 0; written < bytes; line++){
+        randomWord(&rng, word);
+        if(log){
+            written += fprintf(f, "2024-01-01T00:00:%02ld request %ld from client host%ld took %ldms status ok user %s\n",
+                line % 60, line, line % 977, line % 3001, word);
+        }
+        else{written += fprintf(f, "%s\n", word);}
+    }
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+    long mb = argc > 1 ? strtol(argv[1], NULL, 10) : 64;
+    long sizes[] = {1000, 100000, 1000000};
+    const char *styles[] = {"words", "log"};
+    char dict[64], inputs[2][64], empty[64];
+    int failures = 0;
+
+    if(access("./wordsearch", X_OK) < 0){
+        fprintf(stderr, "ERROR: Run from the directory wordsearch was built in (make acbench builds it): %s\n", strerror(errno));
+        return -1;
+    }
+    snprintf(dict, sizeof(dict), "/tmp/acbench.%d.dict", (int)getpid());
+    snprintf(empty, sizeof(empty), "/tmp/acbench.%d.empty", (int)getpid());
+    close(open(empty, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    for(int s = 0; s < 2; s++){
+        snprintf(inputs[s], sizeof(inputs[s]), "/tmp/acbench.%d.%s", (int)getpid(), styles[s]);
+        if(writeInput(inputs[s], mb << 20, s) < 0){return -1;}
+    }
+    for(int d = 0; d < 3; d++){
+        if(writeDict(dict, sizes[d]) < 0){
+            failures++;
+            break;
+        }
+        double build = runSearch(dict, empty);
+        if(build < 0){
+            failures++;
+            continue;
+        }
+        printf("%ld words: build %.3f s\n", sizes[d], build);
+        for(int s = 0; s < 2; s++){
+            double elapsed = runSearch(dict, inputs[s]);
+            if(elapsed < 0){
+                failures++;
+                continue;
+            }
+            double scan = elapsed > build ? elapsed - build : elapsed;
+            printf("  %-6s %8.1f MB/s  (%.3f s)\n", styles[s], mb / scan, scan);
+        }
+        fflush(stdout);
+    }
+    unlink(dict);
+    unlink(empty);
+    unlink(inputs[0]);
+    unlink(inputs[1]);
+    return failures ? 1 : 0;
+}
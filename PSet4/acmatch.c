@@ -0,0 +1,153 @@
+# include "acmatch.h"
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+
+// A dictionary word as a pattern: without the newline it was read with
+struct pattern{
+    const char *text;
+    uint32_t len;
+};
+
+static int patternCompare(const void *a, const void *b){
+    const struct pattern *pa = a, *pb = b;
+    int c = memcmp(pa->text, pb->text, pa->len < pb->len ? pa->len : pb->len);
+    if(c){return c;}
+    return (pa->len > pb->len) - (pa->len < pb->len);
+}
+
+// The state after s on byte c. Failure links always lead to a lower state, so this ends at a dense one at worst.
+static inline uint32_t acStep(struct acmatch *m, uint32_t s, unsigned char c){
+    while(s >= m->ndense){
+        const struct acnode *n = &m->nodes[s];
+        const unsigned char *labels = m->labels + n->first;
+        for(int i = 0; i < n->nchild; i++){
+            if(labels[i] == c){return n->first + i;}
+        }
+        s = n->fail;
+    }
+    return m->dense[s][c];
+}
+
+int acBuild(struct acmatch *m, struct dict *d){
+    struct pattern *patterns;
+    uint32_t *lo = NULL, *hi = NULL; // Building: the words under each state are patterns[lo, hi)
+    uint16_t *depth = NULL;
+    size_t npatterns = 0, bound = 1;
+    memset(m, 0, sizeof(*m));
+    m->strings = d->strings;
+    if((patterns = malloc((d->entries + 1) * sizeof(*patterns))) == NULL){goto nomem;}
+    for(size_t at = 1; at < d->stringsize; ){
+        size_t len = strlen(d->strings + at), next = at + len + 1;
+        if(len && d->strings[at + len - 1] == '\n'){len--;}
+        if(len){
+            patterns[npatterns].text = d->strings + at;
+            patterns[npatterns++].len = len;
+            bound += len; // Every byte of every word adds a state at most
+        }
+        at = next;
+    }
+    qsort(patterns, npatterns, sizeof(*patterns), patternCompare);
+
+    m->nodes = calloc(bound, sizeof(*m->nodes));
+    m->labels = malloc(bound);
+    lo = malloc(bound * sizeof(*lo));
+    hi = malloc(bound * sizeof(*hi));
+    depth = malloc(bound * sizeof(*depth));
+    if(!m->nodes || !m->labels || !lo || !hi || !depth){goto nomem;}
+    // Breadth first, so each state's words are split by their next byte into its children, appended in order
+    m->nnodes = 1;
+    lo[0] = 0;
+    hi[0] = npatterns;
+    depth[0] = 0;
+    for(size_t u = 0; u < m->nnodes; u++){
+        size_t i = lo[u];
+        if(depth[u] > 0 && i < hi[u] && patterns[i].len == depth[u]){ // Sorted before every longer word it begins
+            m->nodes[u].word = patterns[i].text - d->strings;
+            m->nodes[u].len = depth[u];
+            m->words++;
+            while(i < hi[u] && patterns[i].len == depth[u]){i++;} // "WORD\n" and a last line "WORD" are the same
+        }
+        m->nodes[u].first = m->nnodes;
+        while(i < hi[u]){
+            unsigned char c = patterns[i].text[depth[u]];
+            m->labels[m->nnodes] = c;
+            lo[m->nnodes] = i;
+            while(i < hi[u] && (unsigned char)patterns[i].text[depth[u]] == c){i++;}
+            hi[m->nnodes] = i;
+            depth[m->nnodes++] = depth[u] + 1;
+        }
+        m->nodes[u].nchild = m->nnodes - m->nodes[u].first;
+    }
+    free(lo);
+    free(hi);
+    free(depth);
+    free(patterns);
+    lo = hi = NULL;
+    depth = NULL;
+    patterns = NULL;
+    // Words sharing prefixes leave the bound well short of used
+    struct acnode *nodes = realloc(m->nodes, m->nnodes * sizeof(*m->nodes));
+    unsigned char *labels = realloc(m->labels, m->nnodes);
+    if(nodes){m->nodes = nodes;}
+    if(labels){m->labels = labels;}
+
+    // Failure links, each from the parent's, which being breadth first is always already known
+    m->ndense = m->nnodes < AC_DENSE_STATES ? m->nnodes : AC_DENSE_STATES;
+    if((m->dense = malloc(m->ndense * sizeof(*m->dense))) == NULL){goto nomem;}
+    for(uint32_t u = 0; u < m->nnodes; u++){
+        struct acnode *n = &m->nodes[u];
+        if(u < m->ndense){
+            for(int c = 0; c < 256; c++){m->dense[u][c] = u ? m->dense[n->fail][c] : 0;}
+            for(int i = 0; i < n->nchild; i++){m->dense[u][m->labels[n->first + i]] = n->first + i;}
+        }
+        for(uint32_t v = n->first; v < n->first + n->nchild; v++){
+            m->nodes[v].fail = u ? acStep(m, n->fail, m->labels[v]) : 0;
+            m->nodes[v].match = m->nodes[v].len ? v : m->nodes[m->nodes[v].fail].match;
+        }
+    }
+    return 0;
+nomem:
+    fprintf(stderr, "Error: Could not allocate memory to build matcher\n");
+    free(lo);
+    free(hi);
+    free(depth);
+    free(patterns);
+    acFree(m);
+    errno = 0;
+    return -1;
+}
+
+// "offset word\n", formatted by hand: printf costs more than finding the match when they are dense
+static void writeMatch(FILE *out, unsigned long long offset, const char *word, size_t len){
+    char line[24 + WORD_LINE + 1], *p = line + 24;
+    do{
+        *--p = '0' + offset % 10;
+        offset /= 10;
+    }while(offset);
+    memcpy(line + 24, " ", 1);
+    memcpy(line + 25, word, len);
+    line[25 + len] = '\n';
+    fwrite(p, 1, line + 26 + len - p, out);
+}
+
+long long acScan(struct acmatch *m, uint32_t *state, const char *buf, size_t len, unsigned long long offset, FILE *out){
+    long long found = 0;
+    uint32_t s = *state;
+    for(size_t i = 0; i < len; i++){
+        s = acStep(m, s, buf[i]);
+        for(uint32_t t = m->nodes[s].match; t; t = m->nodes[m->nodes[t].fail].match){
+            writeMatch(out, offset + i + 1 - m->nodes[t].len, m->strings + m->nodes[t].word, m->nodes[t].len);
+            found++;
+        }
+    }
+    *state = s;
+    return found;
+}
+
+void acFree(struct acmatch *m){
+    free(m->nodes);
+    free(m->labels);
+    free(m->dense);
+    memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,44 @@
+#ifndef _ACMATCH_H
+#define _ACMATCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "words.h"
+
+#define AC_DENSE_STATES 4096 // States nearest the root given a full row of 256 transitions
+
+// State of an Aho-Corasick automaton over the dictionary words. The trie is numbered breadth first, so a state's
+// children are consecutive and every failure link points to a lower number.
+struct acnode{
+    uint32_t first; // First child
+    uint32_t fail; // Longest proper suffix that is also a state
+    uint32_t match; // This state if it ends a word, otherwise fail's match: 0 if no word ends here
+    uint32_t word; // Offset into the dictionary's strings of the word ending here
+    uint16_t nchild;
+    uint16_t len; // Length of that word, without its newline
+};
+
+struct acmatch{
+    struct acnode *nodes;
+    unsigned char *labels; // Byte on the edge into each state
+    uint32_t (*dense)[256]; // Complete transitions for the first ndense states, which most of the time is spent in
+    size_t nnodes, ndense;
+    const char *strings;
+    int words;
+};
+
+int acBuild(struct acmatch *m, struct dict *d);
+/* Builds an automaton finding d's words (without their newlines) anywhere
+* in a stream. d must outlive m. Returns 0, or -1 after printing why not.
+*/
+
+long long acScan(struct acmatch *m, uint32_t *state, const char *buf, size_t len, unsigned long long offset, FILE *out);
+/* Feeds len bytes of the stream, which start offset bytes into it, through
+* the automaton from *state, leaving the state to continue from in *state
+* (0 to begin a stream). Each word found is written to out as the offset it
+* starts at and the word. Returns the number found.
+*/
+
+void acFree(struct acmatch *m);
+
+#endif
@@ -8,109 +8,276 @@
 # include <sys/types.h>
 # include <sys/wait.h>
 # include <sys/signal.h>
+# include <getopt.h>
+# include <pthread.h>
+# include <time.h>
+# include <inttypes.h>
+# include "words.h"
+# include "spsc.h"
+# include "pipeline.h"
 
 // launcher.c
 // By: Jeffrey Wong
 /* This program executes wordgen, wordsearch, and pager, and establishes
 two pipes from wordgen to wordsearch and from wordsearch to pager. The program
-accepts a single argument which is the number of words to be generated by wordgen */
+accepts a single argument which is the number of words to be generated by wordgen.
+--seed N is passed on to wordgen so that runs can be repeated.
+With -t (--threads) the three stages run instead as threads of this process, passing
+batches of words through lock-free single-producer/single-consumer rings (see spsc.h)
+rather than a line at a time through pipes. They share their code with the programs
+(see words.h), so for the same seed the output is the same as the processes'.
+Each pipe is grown to --pipe-size bytes (1MB by default, 0 leaves them alone). Every
+--interval ms (100 by default) the launcher samples how full each pipe is (FIONREAD)
+and each process's I/O, CPU time and whether it is running (/proc), and when all three
+have exited it reports each stage's throughput and each pipe's stalls on stderr.
+--headless replaces the pager with a sink that only counts what reaches it, so runs
+need no terminal. -r K (--replicas) runs K copies of wordsearch, each dealt whole lines
+by a splitter in turn, whose matches a merger passes on to the pager as they come (so
+not in wordgen's order). Instead of the three programs, any pipeline can be given after
+--, its stages separated by ::, e.g.
+    launcher -H -- ./wordgen 1000000 :: +4 ./wordsearch words.txt :: @sink
+where +K runs K replicas of a stage and @sink is the counting sink (see pipeline.h).
+If any process fails, the launcher terminates the rest at once. */
 
-int main(int argc, char **argv){
-    // Capture argument for wordgen
-    long numwords = 0, candidate, wordsgenerated = 0;
-    if(argc > 1){
-        candidate = strtol(argv[1], NULL, 10);
-        if(errno){
-            fprintf(stderr, "Error: Argument to wordgen invalid: %s", strerror(errno));
-            return -1;
-        }
-        numwords = candidate > 0 ? candidate : 0;
-    }
+#define BATCH_BYTES 65536
+#define BATCHES 16 // In flight between each pair of stages
 
-    // Set up pipes for processes- Structure based on code at https://stackoverflow.com/questions/32839904/piping-between-processes-in-c
-    int genToSearchfds[2];
-    int searchToPagerfds[2];
-    if(pipe(genToSearchfds) < 0){
-        fprintf(stderr, "Cannot create pipe between wordgen and wordsearch: %s", strerror(errno));
-        return -1;
-    }
-    if(pipe(searchToPagerfds) < 0){
-        fprintf(stderr, "Cannot create pipe between wordsearch and pager: %s", strerror(errno));
-        return -1;
+// Words, a line each, on their way from one stage to the next
+struct batch{
+    size_t len;
+    char data[BATCH_BYTES];
+};
+
+// What one pipe does between processes: full batches go forward, and empty ones come back to be filled again
+struct link{
+    struct spsc full, empty;
+    struct batch *batches;
+};
+
+// Everything the three stage threads share
+struct threaded{
+    long numwords; // 0 generates until the pager quits
+    struct wordrng rng;
+    struct dict dictionary;
+    struct link gentosearch, searchtopager;
+};
+
+int linkInit(struct link *l){
+    spscInit(&l->full);
+    spscInit(&l->empty);
+    if((l->batches = malloc(BATCHES * sizeof(struct batch))) == NULL){return -1;}
+    for(int i = 0; i < BATCHES; i++){spscPush(&l->empty, &l->batches[i]);}
+    return 0;
+}
+
+// Like closing the read end of a pipe: the stage feeding it fails to push or to get an empty batch, and stops
+void linkClose(struct link *l){
+    spscClose(&l->full);
+    spscClose(&l->empty);
+}
+
+// wordgen. A consumer that has gone away stops it without a word, as SIGPIPE would.
+void *generatorThread(void *arg){
+    struct threaded *t = arg;
+    long wordsgenerated = 0;
+    while(t->numwords == 0 || wordsgenerated < t->numwords){
+        struct batch *b = spscPop(&t->gentosearch.empty);
+        if(!b){return NULL;}
+        wordsgenerated += randomLines(&t->rng, b->data, BATCH_BYTES, t->numwords ? t->numwords - wordsgenerated : BATCH_BYTES, &b->len);
+        if(spscPush(&t->gentosearch.full, b) < 0){return NULL;}
     }
-    int wordgenpid = fork();
-    switch(wordgenpid){
-        case -1:
-            fprintf(stderr, "Error occured while attempting to fork wordgen: %s\n", strerror(errno));
-            return -1;
-        case 0:
-            // Close unnecessary fds and redirect std i/o
-            close(searchToPagerfds[0]); // 0 represents the read side, 1 represents the write side
-            close(searchToPagerfds[1]);
-            close(genToSearchfds[0]);
-            dup2(genToSearchfds[1],1);
-            close(genToSearchfds[1]);
-            char *wordcount;
-            sprintf(wordcount, "%ld", numwords);
-            if(execlp("./wordgen", "./wordgen", wordcount, (char *)NULL) < 0){
-                fprintf(stderr,"Error occured while attempting to exec wordgen: %s\n", strerror(errno));
-                exit(127);
+    spscClose(&t->gentosearch.full);
+    fprintf(stderr, "Finished generating %ld candidate words\n", wordsgenerated);
+    return NULL;
+}
+
+// wordsearch. Matches are passed on at the end of every batch they turn up in, so the pager is never kept waiting.
+void *matcherThread(void *arg){
+    struct threaded *t = arg;
+    struct batch *in, *out = NULL;
+    char candidate[WORD_LINE];
+    int numMatches = 0, stopped = 0;
+    while(!stopped && (in = spscPop(&t->gentosearch.full))){
+        for(char *line = in->data, *end = in->data + in->len; line < end && !stopped;){
+            char *newline = memchr(line, '\n', end - line);
+            size_t len = (newline ? newline + 1 : end) - line;
+            if(len >= WORD_LINE){len = WORD_LINE - 1;} // Split just as fgets would split it
+            memcpy(candidate, line, len);
+            candidate[len] = '\0';
+            line += len;
+            if(!dictFind(&t->dictionary, candidate)){continue;}
+            numMatches++;
+            if(out && out->len + len > BATCH_BYTES){
+                if(spscPush(&t->searchtopager.full, out) < 0){stopped = 1;}
+                out = NULL;
+            }
+            if(!out && !stopped){
+                if((out = spscPop(&t->searchtopager.empty))){out->len = 0;}
+                else{stopped = 1;}
+            }
+            if(out){
+                memcpy(out->data + out->len, candidate, len);
+                out->len += len;
             }
-            break;
-        default:
-            close(genToSearchfds[1]);
-            break;
+        }
+        spscPush(&t->gentosearch.empty, in);
+        if(out && !stopped){
+            if(spscPush(&t->searchtopager.full, out) < 0){stopped = 1;}
+            out = NULL;
+        }
     }
+    if(stopped){linkClose(&t->gentosearch);} // The pager quit, so wordgen goes too
+    else{spscClose(&t->searchtopager.full);}
+    fprintf(stderr, "Matched %d words\n", numMatches);
+    return NULL;
+}
 
-    int wordsearchpid = fork();
-    switch(wordsearchpid){
-        case -1:
-            fprintf(stderr, "Error occured while attempting to fork wordsearch: %s\n", strerror(errno));
-            return -1;
-        case 0:
-            // Close unnecessary fds and redirect std i/o
-            close(searchToPagerfds[0]); 
-            dup2(searchToPagerfds[1],1);
-            close(searchToPagerfds[1]);
-            dup2(genToSearchfds[0],0);
-            close(genToSearchfds[0]);
-            if(execlp("./wordsearch", "./wordsearch", "words.txt", (char *)NULL)<0){
-                fprintf(stderr,"Error occured while attempting to exec wordsearch: %s\n", strerror(errno));
-                exit(127);
+// pager, on the calling thread since it is the one that talks to the terminal
+void pagerStage(struct threaded *t){
+    struct pager p;
+    struct batch *b;
+    char nextline[WORD_LINE];
+    int quit = 0;
+    pagerInit(&p);
+    while(!quit && (b = spscPop(&t->searchtopager.full))){
+        if(!p.term){fwrite(b->data, 1, b->len, stdout);} // Straight through, so there is no need to look at the lines
+        else{
+            for(char *line = b->data, *end = b->data + b->len; line < end && !quit;){
+                char *newline = memchr(line, '\n', end - line);
+                size_t len = (newline ? newline + 1 : end) - line;
+                memcpy(nextline, line, len);
+                nextline[len] = '\0';
+                line += len;
+                quit = pagerLine(&p, nextline);
             }
-            break;
-        default:
-            close(searchToPagerfds[1]);
-            close(genToSearchfds[0]);
-            break;
+        }
+        if(ferror(stdout)){quit = 1;} // Whatever was reading our output is gone, as SIGPIPE would have told the process
+        spscPush(&t->searchtopager.empty, b);
     }
+    if(quit){linkClose(&t->searchtopager);}
+    else{printf("\n");}
+    if(p.term){fclose(p.term);}
+}
 
-    int pagerpid = fork();
-    switch(pagerpid){
-        case -1:
-            fprintf(stderr, "Error occured while attempting to fork pager: %s\n", strerror(errno));
-            return -1;
-        case 0:
-            // Close unnecessary fds and redirect std i/o
-            dup2(searchToPagerfds[0],0);
-            close(searchToPagerfds[0]);  
-            if(execlp("./pager", "./pager", (char *)NULL)<0){
-                fprintf(stderr,"Error occured while attempting to exec pager: %s\n", strerror(errno));
-                exit(127);
-            }
-            break;
-        default:
-            close(searchToPagerfds[0]); 
-            break;
+// --headless: the pager's place, counting what reaches it
+void sinkStage(struct threaded *t){
+    struct batch *b;
+    long long lines = 0, bytes = 0;
+    while((b = spscPop(&t->searchtopager.full))){
+        bytes += b->len;
+        for(char *p = b->data, *end = b->data + b->len; (p = memchr(p, '\n', end - p)); p++){lines++;}
+        spscPush(&t->searchtopager.empty, b);
     }
-    unsigned status;
-    int cpid;
-    while((cpid = wait(&status)) > 0){
-        printf("Child %d exited with %d\n", cpid, status);
+    printf("Counted %lld lines (%lld bytes)\n", lines, bytes);
+}
+
+int runThreaded(long numwords, uint64_t seed, int headless){
+    struct threaded t;
+    pthread_t generator, matcher;
+    t.numwords = numwords;
+    if(dictLoad(&t.dictionary, "words.txt") < 0){return -1;}
+    if(linkInit(&t.gentosearch) < 0 || linkInit(&t.searchtopager) < 0){
+        fprintf(stderr, "Error: Could not allocate batches: %s\n", strerror(errno));
+        return -1;
     }
-    if(errno != 0 && errno != ECHILD){ // An ECHILD is fine, that means all our child processes have exited.
-        fprintf(stderr, "Error while attempting to wait for child: %s\n", strerror(errno));
+    wordSeed(&t.rng, seed, 0); // wordgen's first stream, which is all of it with one thread
+    signal(SIGPIPE, SIG_IGN); // A closed stdout shows up as a write error in pagerStage instead of killing every stage at once
+    if((errno = pthread_create(&generator, NULL, generatorThread, &t)) || (errno = pthread_create(&matcher, NULL, matcherThread, &t))){
+        fprintf(stderr, "Error occured while attempting to start thread: %s\n", strerror(errno));
         return -1;
     }
+    if(headless){sinkStage(&t);}
+    else{pagerStage(&t);}
+    pthread_join(generator, NULL);
+    pthread_join(matcher, NULL);
+    fflush(stdout);
+    dictFree(&t.dictionary);
+    free(t.gentosearch.batches);
+    free(t.searchtopager.batches);
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char **argv){
+    // Capture argument for wordgen
+    long numwords = 0, candidate;
+    uint64_t seed = time(NULL); // Chosen here so both modes can be told it
+    int threads = 0, headless = 0, pipesize = PIPE_SIZE_DEFAULT, interval = SAMPLE_MS_DEFAULT, replicas = 1, c;
+    struct stagespec *specs;
+    static struct option options[] = {
+        {"threads", no_argument, NULL, 't'},
+        {"seed", required_argument, NULL, 's'},
+        {"headless", no_argument, NULL, 'H'},
+        {"pipe-size", required_argument, NULL, 'P'},
+        {"interval", required_argument, NULL, 'i'},
+        {"replicas", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0}
+    };
+    while((c = getopt_long(argc, argv, "ts:HP:i:r:", options, NULL)) >= 0){
+        switch(c){
+            case 't':
+                threads = 1;
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'H':
+                headless = 1;
+                break;
+            case 'P':
+                pipesize = atoi(optarg);
+                break;
+            case 'i':
+                if((interval = atoi(optarg)) < 1){
+                    fprintf(stderr, "Error: Sampling interval must be at least 1 ms\n");
+                    return -1;
+                }
+                break;
+            case 'r':
+                if((replicas = atoi(optarg)) < 1 || replicas > MAX_REPLICAS){
+                    fprintf(stderr, "Error: Replicas must be 1 to %d\n", MAX_REPLICAS);
+                    return -1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: launcher [-t] [--seed N] [--headless] [--pipe-size BYTES] [--interval MS] [-r K] [numwords | -- pipeline]\n");
+                return -1;
+        }
+    }
+    int custom = optind > 1 && !strcmp(argv[optind - 1], "--"); // Everything after it describes the pipeline
+    if(custom && (threads || argc == optind)){
+        fprintf(stderr, "Error: %s\n", threads ? "-t runs only the three stages, not a pipeline given after --" : "No pipeline after --");
+        return -1;
+    }
+    if(threads && replicas > 1){
+        fprintf(stderr, "Warning: -r only applies to processes, so -t runs one matcher thread\n");
+    }
+    if(argc > optind && !custom){
+        char *end;
+        errno = 0;
+        candidate = strtol(argv[optind], &end, 10);
+        if(!errno && (end == argv[optind] || *end)){errno = EINVAL;} // Not a number at all, which strtol does not say
+        if(errno){
+            fprintf(stderr, "Error: Argument to wordgen invalid: %s\n", strerror(errno));
+            return -1;
+        }
+        numwords = candidate > 0 ? candidate : 0;
+    }
+    if(threads){return runThreaded(numwords, seed, headless);}
+
+    // The three programs, or whatever pipeline was described after --
+    if(custom){
+        int nstages = pipelineParse(argv + optind, argc - optind, &specs);
+        if(nstages < 0){return -1;}
+        int result = pipelineRun(specs, nstages, pipesize, interval);
+        free(specs);
+        return result;
+    }
+    char wordcount[32], seedarg[32];
+    char *wordgen[] = {"./wordgen", "--seed", seedarg, wordcount, NULL};
+    char *wordsearch[] = {"./wordsearch", "words.txt", NULL};
+    char *pager[] = {headless ? "@sink" : "./pager", NULL};
+    struct stagespec defaults[3] = {{wordgen, 1}, {wordsearch, replicas}, {pager, 1}};
+    sprintf(wordcount, "%ld", numwords);
+    sprintf(seedarg, "%" PRIu64, seed);
+    return pipelineRun(defaults, 3, pipesize, interval);
+}
@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <spawn.h>
+# include <time.h>
+# include <sys/wait.h>
+
+// launcherbench.c
+// By: Jeffrey Wong
+/* Benchmark for launcher's two modes. Runs ./launcher over 1M and 100M words (or the counts given
+as arguments) as three processes joined by pipes and as three threads joined by rings, with the same
+seed, and reports words/s for each and whether their output was the same. It runs from the directory
+launcher is built in and uses words.txt there; if there is none, a dictionary of 32 three-letter
+words is written for the run and removed afterwards. launcher is started in a new session, so the
+pager has no terminal to prompt on and passes everything through. */
+
+#define BENCH_SEED "12345"
+#define BENCH_DICT_WORDS 32
+
+extern char **environ;
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs launcher with stdout sent to out and stderr thrown away. Returns the wall time, or -1 if it could not be run.
+double runLauncher(char *words, int threads, char *out){
+    char *argv[] = {"./launcher", "--seed", BENCH_SEED, words, NULL, NULL};
+    if(threads){
+        argv[3] = "-t";
+        argv[4] = words;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID); // No controlling terminal, so no /dev/tty for the pager
+    pid_t pid;
+    int status;
+    double start = now();
+    errno = posix_spawn(&pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if(errno){
+        fprintf(stderr, "ERROR: Could not run %s: %s\n", argv[0], strerror(errno));
+        return -1;
+    }
+    waitpid(pid, &status, 0);
+    double elapsed = now() - start;
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "ERROR: launcher exited with status %d\n", status);
+        return -1;
+    }
+    return elapsed;
+}
+
+// 1 if the two outputs are the same apart from the "Child ... exited" lines only process mode prints
+int sameOutput(const char *processes, const char *threads){
+    FILE *fp = fopen(processes, "r"), *ft = fopen(threads, "r");
+    char lp[4096], lt[4096];
+    int same = fp && ft;
+    while(same){
+        char *gp, *gt;
+        while((gp = fgets(lp, sizeof(lp), fp)) && !strncmp(lp, "Child ", 6)){}
+        gt = fgets(lt, sizeof(lt), ft);
+        if(!gp || !gt){
+            same = !gp && !gt;
+            break;
+        }
+        same = !strcmp(lp, lt);
+    }
+    if(fp){fclose(fp);}
+    if(ft){fclose(ft);}
+    return same;
+}
+
+int main(int argc, char *argv[]){
+    char *defaults[] = {"1000000", "100000000"};
+    char **counts = argc > 1 ? argv + 1 : defaults;
+    int ncounts = argc > 1 ? argc - 1 : 2;
+    char outs[2][64];
+    int madedict = 0, failures = 0;
+
+    if(access("./launcher", X_OK) < 0){
+        fprintf(stderr, "ERROR: Run from the directory launcher was built in (make launcherbench builds it): %s\n", strerror(errno));
+        return -1;
+    }
+    if(access("words.txt", R_OK) < 0){
+        FILE *f = fopen("words.txt", "w");
+        if(!f){
+            fprintf(stderr, "ERROR: Could not create words.txt: %s\n", strerror(errno));
+            return -1;
+        }
+        srand(1);
+        for(int i = 0; i < BENCH_DICT_WORDS; i++){fprintf(f, "%c%c%c\n", 'a' + rand() % 26, 'a' + rand() % 26, 'a' + rand() % 26);}
+        fclose(f);
+        madedict = 1;
+    }
+    for(int m = 0; m < 2; m++){snprintf(outs[m], sizeof(outs[m]), "/tmp/launcherbench.%d.%d", (int)getpid(), m);}
+
+    const char *names[] = {"processes", "threads"};
+    for(int c = 0; c < ncounts; c++){
+        long words = strtol(counts[c], NULL, 10);
+        double elapsed[2];
+        printf("%ld words:\n", words);
+        for(int m = 0; m < 2; m++){
+            elapsed[m] = runLauncher(counts[c], m, outs[m]);
+            if(elapsed[m] < 0){
+                failures++;
+                continue;
+            }
+            printf("  %-10s %12.0f words/s  (%.3f s)\n", names[m], words / elapsed[m], elapsed[m]);
+        }
+        if(elapsed[0] > 0 && elapsed[1] > 0){
+            int same = sameOutput(outs[0], outs[1]);
+            printf("  speedup %.1fx, output %s\n", elapsed[0] / elapsed[1], same ? "identical" : "DIFFERS");
+            failures += !same;
+        }
+        fflush(stdout);
+    }
+    unlink(outs[0]);
+    unlink(outs[1]);
+    if(madedict){unlink("words.txt");}
+    return failures ? 1 : 0;
+}
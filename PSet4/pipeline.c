@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+
+# include "pipeline.h"
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <poll.h>
+# include <signal.h>
+# include <time.h>
+# include <linux/limits.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <sys/wait.h>
+
+#define NAME_BYTES 72
+
+enum{RUN_EXEC, RUN_SINK, RUN_SPLIT, RUN_MERGE}; // What a spawned process runs
+
+// One process of the pipeline, as the sampler sees it
+struct process{
+    char name[NAME_BYTES];
+    pid_t pid; // 0 once reaped
+    int pidfd;
+    unsigned long long rchar, wchar; // Bytes read and written through system calls, as of the last sample
+    double cpu; // Seconds, as of the last sample
+    double lifetime; // From the launch until it exited
+    long samples, running; // Samples taken of it, and in how many it was running or ready to
+};
+
+// A pipe between processes. The launcher keeps its own copy of the read end, for FIONREAD to look into, until the
+// process reading it exits.
+struct pipestat{
+    char name[2 * NAME_BYTES + 2];
+    int fd, size;
+    int reader; // Index of the process reading it, -1 until it is started
+    long samples, full, empty;
+    unsigned long long depth; // Summed over samples
+};
+
+struct pipeline{
+    struct process *procs;
+    int nprocs;
+    struct pipestat *pipes;
+    int npipes;
+    int pipesize;
+    double started;
+};
+
+int pipelineParse(char **words, int nwords, struct stagespec **specs){
+    int nstages = 1;
+    for(int i = 0; i < nwords; i++){nstages += !strcmp(words[i], "::");}
+    // Each stage's argv is the run of words up to its "::", which is replaced by the NULL that ends it
+    if((*specs = calloc(nstages, sizeof(**specs))) == NULL){
+        fprintf(stderr, "Error: Could not allocate memory for the pipeline\n");
+        return -1;
+    }
+    for(int s = 0, i = 0; s < nstages; s++, i++){
+        struct stagespec *spec = &(*specs)[s];
+        spec->replicas = 1;
+        if(i < nwords && words[i][0] == '+'){
+            char *end;
+            spec->replicas = strtol(words[i] + 1, &end, 10);
+            if(*end || spec->replicas < 1 || spec->replicas > MAX_REPLICAS){
+                fprintf(stderr, "Error: Replicas must be +1 to +%d, not %s\n", MAX_REPLICAS, words[i]);
+                free(*specs);
+                return -1;
+            }
+            i++;
+        }
+        spec->argv = words + i;
+        while(i < nwords && strcmp(words[i], "::")){i++;}
+        if(spec->argv == words + i){
+            fprintf(stderr, "Error: Stage %d of the pipeline has no program\n", s + 1);
+            free(*specs);
+            return -1;
+        }
+        if(i < nwords){words[i] = NULL;}
+    }
+    return nstages;
+}
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int pidfdOpen(pid_t pid){
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Signals a process through its pidfd where there is one, which cannot reach some other process that reused the pid
+static void signalProcess(struct process *p, int sig){
+#ifdef SYS_pidfd_send_signal
+    if(p->pidfd >= 0 && syscall(SYS_pidfd_send_signal, p->pidfd, sig, NULL, 0) == 0){return;}
+#endif
+    kill(p->pid, sig);
+}
+
+// Grows a pipe to limit bytes, or as near below it as the system allows (unprivileged, up to fs.pipe-max-size).
+// Returns the size it ended up, or -1.
+static int sizePipe(int fd, int limit){
+    for(int size = limit; size >= PIPE_BUF && fcntl(fd, F_SETPIPE_SZ, size) < 0; size /= 2){}
+    return fcntl(fd, F_GETPIPE_SZ);
+}
+
+static int writeAll(int fd, const char *buf, size_t len){
+    while(len > 0){
+        ssize_t n = write(fd, buf, len);
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// For a built-in whose write failed: a reader that has gone away (with SIGPIPE ignored, as it may be inherited)
+// is the normal end of a run, as it is for wordgen. Returns what the built-in should.
+static int writeFailed(const char *who){
+    if(errno == EPIPE){return 0;}
+    fprintf(stderr, "Error in %s when writing: %s\n", who, strerror(errno));
+    return -1;
+}
+
+// Where the whole lines in buf end, 0 if there are none
+static size_t lineCut(const char *buf, size_t len){
+    while(len > 0 && buf[len - 1] != '\n'){len--;}
+    return len;
+}
+
+// The built-in sink: counts what reaches standard input instead of showing it
+static int countingSink(void){
+    static char buf[PIPELINE_BLOCK];
+    long long lines = 0, bytes = 0;
+    ssize_t n;
+    while((n = read(STDIN_FILENO, buf, sizeof(buf))) != 0){
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            fprintf(stderr, "Error in sink when reading: %s\n", strerror(errno));
+            return -1;
+        }
+        bytes += n;
+        for(char *p = buf, *end = buf + n; (p = memchr(p, '\n', end - p)); p++){lines++;}
+    }
+    printf("Counted %lld lines (%lld bytes)\n", lines, bytes);
+    return 0;
+}
+
+// The splitter in front of replicas: deals whole lines from standard input to outs in turn, as many as each read
+// brings. A line too long for the buffer goes out in parts, all to the same replica.
+static int splitLines(int *outs, int n){
+    static char buf[PIPELINE_BLOCK];
+    size_t len = 0;
+    int k = 0;
+    ssize_t got;
+    while((got = read(STDIN_FILENO, buf + len, sizeof(buf) - len)) != 0){
+        if(got < 0){
+            if(errno == EINTR){continue;}
+            fprintf(stderr, "Error in splitter when reading: %s\n", strerror(errno));
+            return -1;
+        }
+        len += got;
+        size_t cut = lineCut(buf, len);
+        if(cut == 0 && len < sizeof(buf)){continue;}
+        if(writeAll(outs[k], buf, cut ? cut : len) < 0){return writeFailed("splitter");}
+        if(cut == 0){
+            len = 0;
+            continue;
+        }
+        k = (k + 1) % n;
+        memmove(buf, buf + cut, len - cut);
+        len -= cut;
+    }
+    if(len && writeAll(outs[k], buf, len) < 0){return writeFailed("splitter");}
+    return 0;
+}
+
+// The merger behind replicas: passes the whole lines each of ins writes on to standard output as they come
+static int mergeLines(int *ins, int n){
+    struct mergein{
+        size_t len;
+        char buf[PIPELINE_BLOCK];
+    } *in = calloc(n, sizeof(*in));
+    struct pollfd *pollfds = calloc(n, sizeof(*pollfds));
+    int open = n;
+    if(!in || !pollfds){
+        fprintf(stderr, "Error: Could not allocate memory for merger\n");
+        return -1;
+    }
+    for(int i = 0; i < n; i++){pollfds[i] = (struct pollfd){.fd = ins[i], .events = POLLIN};}
+    while(open > 0){
+        if(poll(pollfds, n, -1) < 0){
+            if(errno == EINTR){continue;}
+            fprintf(stderr, "Error in merger when polling: %s\n", strerror(errno));
+            return -1;
+        }
+        for(int i = 0; i < n; i++){
+            if(pollfds[i].fd < 0 || !pollfds[i].revents){continue;}
+            struct mergein *m = &in[i];
+            ssize_t got = read(pollfds[i].fd, m->buf + m->len, sizeof(m->buf) - m->len);
+            if(got < 0){
+                if(errno == EINTR){continue;}
+                fprintf(stderr, "Error in merger when reading: %s\n", strerror(errno));
+                return -1;
+            }
+            m->len += got;
+            size_t cut = got == 0 || m->len == sizeof(m->buf) ? m->len : lineCut(m->buf, m->len); // All of it at the end, or if too long a line
+            if(writeAll(STDOUT_FILENO, m->buf, cut) < 0){return writeFailed("merger");}
+            memmove(m->buf, m->buf + cut, m->len - cut);
+            m->len -= cut;
+            if(got == 0){
+                close(pollfds[i].fd);
+                pollfds[i].fd = -1; // poll skips it from now on
+                open--;
+            }
+        }
+    }
+    return 0;
+}
+
+// Makes a pipe, grown and watched, named for the processes at each end. fds are close-on-exec so that no process
+// inherits another's, or the launcher's copies.
+static int makePipe(struct pipeline *p, int fds[2], const char *from, const char *to){
+    if(pipe2(fds, O_CLOEXEC) < 0){
+        fprintf(stderr, "Cannot create pipe between %s and %s: %s\n", from, to, strerror(errno));
+        return -1;
+    }
+    struct pipestat *ps = &p->pipes[p->npipes++];
+    snprintf(ps->name, sizeof(ps->name), "%s->%s", from, to);
+    ps->fd = fds[0];
+    ps->reader = -1;
+    if(p->pipesize > 0 && (ps->size = sizePipe(fds[0], p->pipesize)) < p->pipesize){
+        fprintf(stderr, "Warning: %s could only be made %d bytes\n", ps->name, ps->size);
+    }
+    else if(p->pipesize <= 0){ps->size = fcntl(fds[0], F_GETPIPE_SZ);}
+    errno = 0;
+    return 0;
+}
+
+// Starts a process with in as its standard input and out as its standard output (-1 keeps the launcher's),
+// running argv or one of the built-ins, which also get the n fds in extra as fds 3 onwards. Returns 0, or -1.
+static int spawn(struct pipeline *p, const char *name, int run, char **argv, int in, int out, int *extra, int n){
+    struct process *proc = &p->procs[p->nprocs];
+    fflush(stdout); // A built-in, which does not exec, would write out anything left in the buffer again
+    pid_t pid = fork();
+    if(pid < 0){
+        fprintf(stderr, "Error occured while attempting to fork %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    if(pid == 0){
+        if(in >= 0){dup2(in, STDIN_FILENO);}
+        if(out >= 0){dup2(out, STDOUT_FILENO);}
+        if(run == RUN_EXEC){
+            execvp(argv[0], argv);
+            fprintf(stderr, "Error occured while attempting to exec %s: %s\n", argv[0], strerror(errno));
+            exit(127);
+        }
+        // Nothing is closed for a built-in by exec, so everything but its own fds is closed here
+        int moved[MAX_REPLICAS];
+        for(int i = 0; i < n; i++){moved[i] = fcntl(extra[i], F_DUPFD, 3 + n);}
+        for(int i = 0; i < n; i++){dup2(moved[i], 3 + i);}
+        close_range(3 + n, ~0U, 0);
+        int fds[MAX_REPLICAS];
+        for(int i = 0; i < n; i++){fds[i] = 3 + i;}
+        if(run == RUN_SINK){exit(countingSink() < 0 ? 1 : 0);}
+        if(run == RUN_SPLIT){exit(splitLines(fds, n) < 0 ? 1 : 0);}
+        exit(mergeLines(fds, n) < 0 ? 1 : 0);
+    }
+    memset(proc, 0, sizeof(*proc));
+    snprintf(proc->name, sizeof(proc->name), "%s", name);
+    proc->pid = pid;
+    proc->pidfd = pidfdOpen(pid);
+    for(int i = 0; i < p->npipes; i++){ // The pipes it reads are watched until it exits
+        if(p->pipes[i].fd == in){p->pipes[i].reader = p->nprocs;}
+        for(int j = 0; run == RUN_MERGE && j < n; j++){
+            if(p->pipes[i].fd == extra[j]){p->pipes[i].reader = p->nprocs;}
+        }
+    }
+    p->nprocs++;
+    return 0;
+}
+
+// A stage's name, its program's without the directory, into name (NAME_BYTES). helper is added after it if the
+// stage has replicas, so that the pipes to and from them are named for the splitter and merger.
+static void stageName(struct stagespec *spec, char *name, const char *helper){
+    const char *program = spec->argv[0], *base = strrchr(program, '/');
+    if(base){program = base + 1;}
+    else if(program[0] == '@'){program++;}
+    snprintf(name, NAME_BYTES, "%.60s%s", program, spec->replicas > 1 ? helper : "");
+}
+
+// Starts a stage reading in and writing out: as one process, or as a splitter, its replicas and a merger. The
+// launcher closes each write end once its writer has it, so that every reader sees end of file when it should.
+static int startStage(struct pipeline *p, struct stagespec *spec, const char *name, int in, int out){
+    int K = spec->replicas, run = strcmp(spec->argv[0], "@sink") ? RUN_EXEC : RUN_SINK;
+    if(K == 1){return spawn(p, name, run, spec->argv, in, out, NULL, 0);}
+    int replicain[MAX_REPLICAS], tosplit[MAX_REPLICAS], mergein[MAX_REPLICAS], replicaout[MAX_REPLICAS], fds[2];
+    char replica[MAX_REPLICAS][NAME_BYTES], split[NAME_BYTES], merge[NAME_BYTES];
+    snprintf(split, sizeof(split), "%s-split", name);
+    snprintf(merge, sizeof(merge), "%s-merge", name);
+    for(int k = 0; k < K; k++){
+        snprintf(replica[k], sizeof(replica[k]), "%s#%d", name, k + 1);
+        if(makePipe(p, fds, split, replica[k]) < 0){return -1;}
+        replicain[k] = fds[0];
+        tosplit[k] = fds[1];
+        if(makePipe(p, fds, replica[k], merge) < 0){return -1;}
+        mergein[k] = fds[0];
+        replicaout[k] = fds[1];
+    }
+    int started = spawn(p, split, RUN_SPLIT, NULL, in, -1, tosplit, K);
+    for(int k = 0; k < K; k++){close(tosplit[k]);}
+    if(started < 0){return -1;}
+    for(int k = 0; k < K; k++){
+        started = spawn(p, replica[k], run, spec->argv, replicain[k], replicaout[k], NULL, 0);
+        close(replicaout[k]);
+        if(started < 0){return -1;}
+    }
+    return spawn(p, merge, RUN_MERGE, NULL, -1, out, mergein, K);
+}
+
+static void sampleProcess(struct process *s, int counting){
+    char path[64], buf[1024], state;
+    unsigned long utime, stime;
+    FILE *f;
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)s->pid);
+    if((f = fopen(path, "re"))){
+        while(fgets(buf, sizeof(buf), f)){
+            sscanf(buf, "rchar: %llu", &s->rchar);
+            sscanf(buf, "wchar: %llu", &s->wchar);
+        }
+        fclose(f);
+    }
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)s->pid);
+    if((f = fopen(path, "re"))){
+        char *fields;
+        if(fgets(buf, sizeof(buf), f) && (fields = strrchr(buf, ')')) &&
+           sscanf(fields + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &state, &utime, &stime) == 3){
+            s->cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+            if(counting){
+                s->samples++;
+                s->running += state == 'R';
+            }
+        }
+        fclose(f);
+    }
+    errno = 0;
+}
+
+static void samplePipe(struct pipestat *p){
+    int depth;
+    if(p->fd < 0 || ioctl(p->fd, FIONREAD, &depth) < 0){return;}
+    p->samples++;
+    p->depth += depth;
+    if(depth == 0){p->empty++;}
+    else if(depth >= p->size / 8 * 7){p->full++;} // Near enough full that the writer is being held up
+}
+
+// part of whole as a percentage, or "-" if there were no samples at all
+static const char *percent(char *buf, long part, long whole){
+    if(!whole){return "-";}
+    sprintf(buf, "%.0f%%", 100.0 * part / whole);
+    return buf;
+}
+
+static void printReport(struct pipeline *p){
+    char b1[16], b2[16];
+    int busiest = -1;
+    fprintf(stderr, "\n%-16s %10s %10s %11s %11s %7s %8s\n", "process", "read MB", "written MB", "read MB/s", "write MB/s", "CPU s", "running");
+    for(int i = 0; i < p->nprocs; i++){
+        struct process *s = &p->procs[i];
+        double mb = 1 << 20, elapsed = s->lifetime > 0 ? s->lifetime : 1e-9;
+        fprintf(stderr, "%-16s %10.1f %10.1f %11.1f %11.1f %7.2f %8s\n", s->name, s->rchar / mb, s->wchar / mb,
+            s->rchar / mb / elapsed, s->wchar / mb / elapsed, s->cpu, percent(b1, s->running, s->samples));
+        if(s->samples && (busiest < 0 || s->running * p->procs[busiest].samples > p->procs[busiest].running * s->samples)){busiest = i;}
+    }
+    fprintf(stderr, "%-32s %9s %11s %7s %7s\n", "pipe", "size KB", "avg KB", "full", "empty");
+    for(int i = 0; i < p->npipes; i++){
+        struct pipestat *ps = &p->pipes[i];
+        fprintf(stderr, "%-32s %9d %11.1f %7s %7s\n", ps->name, ps->size >> 10, ps->samples ? ps->depth / 1024.0 / ps->samples : 0,
+            percent(b1, ps->full, ps->samples), percent(b2, ps->empty, ps->samples));
+    }
+    // A pipe that is mostly full is waiting on its reader, and one that is mostly empty on its writer, so the
+    // process that is running the most is the one holding the others up
+    if(busiest >= 0){
+        fprintf(stderr, "Bottleneck: %s (running in %s of samples)\n", p->procs[busiest].name,
+            percent(b1, p->procs[busiest].running, p->procs[busiest].samples));
+    }
+    else{fprintf(stderr, "No samples: the run was shorter than the sampling interval\n");}
+}
+
+// Reaps process i, which has exited. Returns 1 if it failed.
+static int reap(struct pipeline *p, int i){
+    struct process *s = &p->procs[i];
+    int status;
+    sampleProcess(s, 0); // Its last figures, while it is still there to be read
+    s->lifetime = now() - p->started;
+    waitpid(s->pid, &status, 0);
+    printf("Child %d exited with %d\n", s->pid, status);
+    if(s->pidfd >= 0){close(s->pidfd);}
+    s->pidfd = -1;
+    s->pid = 0;
+    for(int j = 0; j < p->npipes; j++){ // Nobody reads these now, so their writers should get SIGPIPE
+        if(p->pipes[j].reader == i && p->pipes[j].fd >= 0){
+            close(p->pipes[j].fd);
+            p->pipes[j].fd = -1;
+        }
+    }
+    // SIGPIPE is how a stage is told that everything after it has finished, which is no failure
+    return (WIFEXITED(status) && WEXITSTATUS(status) != 0) || (WIFSIGNALED(status) && WTERMSIG(status) != SIGPIPE);
+}
+
+int pipelineRun(struct stagespec *specs, int nstages, int pipesize, int interval){
+    struct pipeline p = {.pipesize = pipesize};
+    int maxprocs = 0, maxpipes = nstages - 1, failed = 0, result = 0;
+    const char *failure = NULL;
+    for(int s = 0; s < nstages; s++){
+        maxprocs += specs[s].replicas > 1 ? specs[s].replicas + 2 : 1;
+        maxpipes += specs[s].replicas > 1 ? 2 * specs[s].replicas : 0;
+    }
+    p.procs = calloc(maxprocs, sizeof(*p.procs));
+    p.pipes = calloc(maxpipes + 1, sizeof(*p.pipes));
+    struct pollfd *pollfds = calloc(maxprocs, sizeof(*pollfds));
+    if(!p.procs || !p.pipes || !pollfds){
+        fprintf(stderr, "Error: Could not allocate memory for the pipeline\n");
+        return -1;
+    }
+    p.started = now();
+    int in = -1;
+    for(int s = 0; s < nstages && !failed; s++){
+        int fds[2] = {-1, -1};
+        char name[NAME_BYTES];
+        stageName(&specs[s], name, "");
+        if(s + 1 < nstages){
+            char from[NAME_BYTES], to[NAME_BYTES];
+            stageName(&specs[s], from, "-merge");
+            stageName(&specs[s + 1], to, "-split");
+            if(makePipe(&p, fds, from, to) < 0){
+                failed = 1;
+                break;
+            }
+        }
+        if(startStage(&p, &specs[s], name, in, fds[1]) < 0){failed = 1;}
+        if(fds[1] >= 0){close(fds[1]);}
+        in = fds[0]; // The launcher's copy stays open, for sampling, until the next stage exits
+    }
+
+    // Sample every interval until every process has exited. Each one's pidfd wakes the loop as soon as it exits,
+    // so that the launcher's copy of the pipe it was reading can be closed at once, and so that if it failed the
+    // rest can be stopped without waiting for them to notice.
+    int alive = p.nprocs, nopidfd = 0;
+    double nexttick = p.started + interval / 1000.0;
+    for(int i = 0; i < p.nprocs; i++){nopidfd |= p.procs[i].pidfd < 0;}
+    if(nopidfd){fprintf(stderr, "Warning: No pidfds, so processes are only checked on every %d ms\n", interval);}
+    if(failed){failure = "the pipeline could not be started";}
+    while(alive > 0){
+        int npoll = 0;
+        if(failure){ // Stops everything still running, once
+            fprintf(stderr, "Error: %s, so the pipeline is being stopped\n", failure);
+            for(int i = 0; i < p.nprocs; i++){if(p.procs[i].pid > 0){signalProcess(&p.procs[i], SIGTERM);}}
+            failure = NULL;
+            result = -1;
+        }
+        for(int i = 0; i < p.nprocs; i++){
+            if(p.procs[i].pid > 0 && p.procs[i].pidfd >= 0){pollfds[npoll++] = (struct pollfd){.fd = p.procs[i].pidfd, .events = POLLIN};}
+        }
+        double wait = nexttick - now();
+        if(wait > 0){poll(pollfds, npoll, (int)(wait * 1000) + 1);}
+        if(now() >= nexttick){
+            for(int i = 0; i < p.nprocs; i++){if(p.procs[i].pid > 0){sampleProcess(&p.procs[i], 1);}}
+            for(int i = 0; i < p.npipes; i++){samplePipe(&p.pipes[i]);}
+            nexttick += interval / 1000.0;
+        }
+        for(int i = 0; i < p.nprocs; i++){
+            siginfo_t info = {.si_pid = 0};
+            if(p.procs[i].pid <= 0 || waitid(P_PID, p.procs[i].pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0 || info.si_pid == 0){continue;}
+            alive--;
+            if(reap(&p, i) && result == 0){
+                static char why[96];
+                snprintf(why, sizeof(why), "%s failed", p.procs[i].name);
+                failure = why;
+            }
+        }
+    }
+    errno = 0;
+    fflush(stdout);
+    printReport(&p);
+    for(int i = 0; i < p.npipes; i++){if(p.pipes[i].fd >= 0){close(p.pipes[i].fd);}}
+    free(p.procs);
+    free(p.pipes);
+    free(pollfds);
+    return result;
+}
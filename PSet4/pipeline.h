@@ -0,0 +1,35 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#define PIPE_SIZE_DEFAULT (1 << 20)
+#define SAMPLE_MS_DEFAULT 100
+#define PIPELINE_BLOCK 65536 // Most the splitter and merger move at once
+#define MAX_REPLICAS 64
+
+// One stage as described: its program and arguments, and how many copies of it run side by side. An argv[0] of
+// "@sink" is the built-in sink, which counts what reaches it.
+struct stagespec{
+    char **argv; // NULL-terminated
+    int replicas;
+};
+
+int pipelineParse(char **words, int nwords, struct stagespec **specs);
+/* Splits words into stages at each "::", a stage that starts with +K being
+* run as K replicas, into a malloc'd array at *specs. Returns the number of
+* stages, or -1 after printing why the description is wrong.
+*/
+
+int pipelineRun(struct stagespec *specs, int nstages, int pipesize, int interval);
+/* Runs the stages joined by pipes grown to pipesize bytes (0 leaves them as
+* they are), the first reading the launcher's standard input and the last
+* writing its standard output. A stage with replicas gets a splitter in
+* front, which deals whole lines to the copies in turn, and a merger behind,
+* which passes on their whole lines as they come. Every interval ms the
+* pipes and processes are sampled, and when all have exited a report of
+* each one's throughput and stalls is printed on stderr. A process that
+* fails (exits nonzero, or is killed by a signal other than SIGPIPE) has
+* the rest terminated at once. Returns 0, or -1 if the pipeline could not
+* be started or a process failed.
+*/
+
+#endif
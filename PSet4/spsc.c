@@ -0,0 +1,72 @@
+# include "spsc.h"
+# include <string.h>
+# include <limits.h>
+# include <unistd.h>
+# include <sys/syscall.h>
+# include <linux/futex.h>
+
+#define SPIN_TRIES 1000 // Polls before sleeping, when there is another CPU for the other side to be running on
+
+static int spinTries = -1;
+
+static void relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+void spscInit(struct spsc *r){
+    memset(r, 0, sizeof(*r));
+    if(spinTries < 0){spinTries = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_TRIES : 0;} // Spinning on one CPU only delays the other side
+}
+
+static void wake(struct spsc *r){
+    __atomic_add_fetch(&r->events, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &r->events, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// Waits until ready says the ring has moved or it is closed. The flag is raised before the last look so that the
+// other side, which checks it after moving its index, either is seen to have moved or sees the flag and wakes us.
+static void waitFor(struct spsc *r, int *flag, int (*ready)(struct spsc *)){
+    for(int tries = 0; !ready(r); tries++){
+        if(tries < spinTries){
+            relax();
+            continue;
+        }
+        unsigned seen = __atomic_load_n(&r->events, __ATOMIC_SEQ_CST);
+        __atomic_store_n(flag, 1, __ATOMIC_SEQ_CST);
+        if(!ready(r)){syscall(SYS_futex, &r->events, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);}
+        __atomic_store_n(flag, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static int hasRoom(struct spsc *r){
+    return __atomic_load_n(&r->closed, __ATOMIC_SEQ_CST) || r->tail - __atomic_load_n(&r->head, __ATOMIC_SEQ_CST) < SPSC_SLOTS;
+}
+
+static int hasItem(struct spsc *r){
+    return __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) != r->head || __atomic_load_n(&r->closed, __ATOMIC_SEQ_CST);
+}
+
+int spscPush(struct spsc *r, void *item){
+    waitFor(r, &r->pushwait, hasRoom);
+    if(__atomic_load_n(&r->closed, __ATOMIC_SEQ_CST)){return -1;}
+    r->slots[r->tail % SPSC_SLOTS] = item;
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&r->popwait, __ATOMIC_SEQ_CST)){wake(r);}
+    return 0;
+}
+
+void *spscPop(struct spsc *r){
+    waitFor(r, &r->popwait, hasItem);
+    if(__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->head){return NULL;} // Closed and drained
+    void *item = r->slots[r->head % SPSC_SLOTS];
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&r->pushwait, __ATOMIC_SEQ_CST)){wake(r);}
+    return item;
+}
+
+void spscClose(struct spsc *r){
+    __atomic_store_n(&r->closed, 1, __ATOMIC_SEQ_CST);
+    wake(r);
+}
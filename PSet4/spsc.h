@@ -0,0 +1,35 @@
+#ifndef _SPSC_H
+#define _SPSC_H
+
+#define SPSC_SLOTS 64 // Power of two
+
+// Lock-free ring handing pointers from exactly one producer thread to exactly one consumer thread. Each side only
+// ever writes its own index, so neither takes a lock; a side that finds the ring full or empty spins briefly and
+// then sleeps on a futex until the other side moves.
+struct spsc{
+    void *slots[SPSC_SLOTS];
+    unsigned head __attribute__((aligned(64))); // Next slot to take, moved only by the consumer
+    unsigned tail __attribute__((aligned(64))); // Next slot to fill, moved only by the producer
+    unsigned events __attribute__((aligned(64))); // Futex word, bumped whenever a sleeper has to be woken
+    int pushwait, popwait; // The producer or consumer is about to sleep
+    int closed;
+};
+
+void spscInit(struct spsc *r);
+
+int spscPush(struct spsc *r, void *item);
+/* Adds item, waiting while the ring is full. Returns 0, or -1 if the ring
+* has been closed, in which case item was not added.
+*/
+
+void *spscPop(struct spsc *r);
+/* Takes the oldest item, waiting while the ring is empty. Returns NULL once
+* the ring is closed and nothing is left in it.
+*/
+
+void spscClose(struct spsc *r);
+/* Either side can close the ring: the producer when it has nothing more,
+* the consumer when it wants nothing more. Wakes whichever side is waiting.
+*/
+
+#endif
@@ -3,48 +3,159 @@
 # include <string.h>
 # include <time.h>
 # include <errno.h>
+# include <unistd.h>
+# include <getopt.h>
+# include <pthread.h>
+# include "words.h"
 
 // wordgen.c
 // By: Jeffrey Wong
-/* Generates an assigned number of words consisting of 3 to 5 uppercase characters. 
+/* Generates an assigned number of words consisting of 3 to 10 uppercase characters.
 This program can accept up to 1 argument. If a positive integer is supplied, it generates
-that number of words, otherwise it generates words until the program is forcibly terminated */
+that number of words, otherwise it generates words until the program is forcibly terminated.
+It may be preceded by --seed N to get the same words every run, as launcher does.
+Words are made a block at a time and written with one write(2) per block. With --threads N
+(-t N), N threads each fill blocks from their own stream of the seed, and the blocks are written
+in turn, so the same seed and number of threads always give the same output; one thread gives
+the same words as launcher's threaded mode. */
 
-int generate_word(int len){
-    char word[len+1];
-    for(int i = 0; i < len; i++){
-        word[i] = 'A' + (rand() % 26);
+#define BLOCK_BYTES (1 << 20)
+#define BLOCK_WORDS (BLOCK_BYTES / (WORD_MAX + 1)) // Words in every block but the last, as many as always fit
+
+// What the generating threads share
+struct generation{
+    long numwords; // 0 generates until killed
+    int nthreads;
+    uint64_t seed;
+    pthread_mutex_t lock;
+    pthread_cond_t turnchanged;
+    long turn; // Block to be written next
+    int failed; // errno of a write that failed, after which nothing more is written
+};
+
+struct generator{
+    struct generation *g;
+    int index;
+    pthread_t thread;
+};
+
+// Writes all of len bytes of buf to stdout. Returns 0, or an errno.
+int writeAll(const char *buf, size_t len){
+    while(len > 0){
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            return errno;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Makes blocks index, index + nthreads, ... from stream index of the seed, and writes each when its turn comes
+void *generateBlocks(void *arg){
+    struct generator *self = arg;
+    struct generation *g = self->g;
+    struct wordrng rng;
+    char *block = malloc(BLOCK_BYTES);
+    if(!block){
+        pthread_mutex_lock(&g->lock);
+        g->failed = ENOMEM;
+        pthread_cond_broadcast(&g->turnchanged);
+        pthread_mutex_unlock(&g->lock);
+        return NULL;
+    }
+    wordSeed(&rng, g->seed, self->index);
+    for(long b = self->index; g->numwords == 0 || b * BLOCK_WORDS < g->numwords; b += g->nthreads){
+        size_t len;
+        long want = g->numwords && g->numwords - b * BLOCK_WORDS < BLOCK_WORDS ? g->numwords - b * BLOCK_WORDS : BLOCK_WORDS;
+        randomLines(&rng, block, BLOCK_BYTES, want, &len);
+        pthread_mutex_lock(&g->lock);
+        while(g->turn != b && !g->failed){pthread_cond_wait(&g->turnchanged, &g->lock);}
+        int failed = g->failed;
+        pthread_mutex_unlock(&g->lock);
+        if(failed){break;}
+        int error = writeAll(block, len); // Outside the lock: nobody else writes until the turn moves on
+        pthread_mutex_lock(&g->lock);
+        if(error){g->failed = error;}
+        g->turn++;
+        pthread_cond_broadcast(&g->turnchanged);
+        pthread_mutex_unlock(&g->lock);
+        if(error){break;}
     }
-    word[len] = '\0';
-    printf("%s\n",word);
+    free(block);
+    return NULL;
 }
 
 int main(int argc, char *argv[]){
-    long numwords = 0, candidate, wordsgenerated = 0;
-    int minlength = 3, maxlength = 10;
-    if(argc > 1){
-        candidate = strtol(argv[1], NULL, 10);
+    struct generation g = {.numwords = 0, .nthreads = 1, .seed = time(NULL), .turn = 0, .failed = 0};
+    long candidate;
+    int c;
+    static struct option options[] = {
+        {"seed", required_argument, NULL, 's'},
+        {"threads", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0}
+    };
+    while((c = getopt_long(argc, argv, "s:t:", options, NULL)) >= 0){
+        switch(c){
+            case 's':
+                g.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                g.nthreads = atoi(optarg);
+                if(g.nthreads < 1){
+                    fprintf(stderr, "Error: Number of threads must be positive\n");
+                    return -1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: wordgen [--seed N] [--threads N] [numwords]\n");
+                return -1;
+        }
+    }
+    if(argc > optind){
+        char *end;
+        errno = 0;
+        candidate = strtol(argv[optind], &end, 10);
+        if(!errno && (end == argv[optind] || *end)){errno = EINVAL;} // Not a number at all, which strtol does not say
         if(errno){
-            fprintf(stderr, "Error: Argument to wordgen invalid: %s", strerror(errno));
+            fprintf(stderr, "Error: Argument to wordgen invalid: %s\n", strerror(errno));
             return -1;
         }
-        numwords = candidate > 0 ? candidate : 0;
-    }
-    srand(time(NULL));
-    if(numwords > 0){
-        for(int i = 0; i < numwords; i++){
-            int wordlength = minlength + (rand() % (maxlength-minlength+1)); // Word length is fixed to max if we call this inside for some reason
-            generate_word(wordlength); // This will generate a random length from 3 to 5
-            wordsgenerated++;
-        }
-        fprintf(stderr, "Finished generating %ld candidate words\n", wordsgenerated);
+        g.numwords = candidate > 0 ? candidate : 0;
+    }
+    pthread_mutex_init(&g.lock, NULL);
+    pthread_cond_init(&g.turnchanged, NULL);
+    struct generator *threads = calloc(g.nthreads, sizeof(*threads));
+    if(!threads){
+        fprintf(stderr, "Error: Could not allocate memory for threads\n");
+        return -1;
     }
-    else{
-        for(;;){ // This will generate words infinitely
-            int wordlength = minlength + (rand() % (maxlength-minlength+1));
-            generate_word(wordlength);
-            wordsgenerated++;
+    int started, startfailed = 0;
+    for(started = 0; started < g.nthreads; started++){
+        threads[started].g = &g;
+        threads[started].index = started;
+        if(started == 0){continue;} // The main thread is the first generator
+        if((errno = pthread_create(&threads[started].thread, NULL, generateBlocks, &threads[started]))){
+            fprintf(stderr, "Error occured while attempting to start thread: %s\n", strerror(errno));
+            startfailed = 1;
+            pthread_mutex_lock(&g.lock);
+            g.failed = errno; // Stops the threads already started
+            pthread_cond_broadcast(&g.turnchanged);
+            pthread_mutex_unlock(&g.lock);
+            break;
         }
     }
+    if(!g.failed){generateBlocks(&threads[0]);}
+    for(int i = 1; i < started; i++){pthread_join(threads[i].thread, NULL);}
+    free(threads);
+    if(startfailed){return -1;}
+    if(g.failed == EPIPE){return 0;} // The reader went away with SIGPIPE ignored, which ends a run as SIGPIPE would
+    if(g.failed){
+        fprintf(stderr, "Error: Could not write words: %s\n", strerror(g.failed));
+        return -1;
+    }
+    fprintf(stderr, "Finished generating %ld candidate words\n", g.numwords);
     return 0;
 }
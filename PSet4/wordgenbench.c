@@ -0,0 +1,95 @@
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <spawn.h>
+# include <time.h>
+# include <sys/wait.h>
+
+// wordgenbench.c
+// By: Jeffrey Wong
+/* Benchmark for wordgen. Runs ./wordgen for 100M words (or the count given as the first argument)
+with 1, 2 and 4 threads (or the counts given after it), once writing to /dev/null, which measures
+generating alone, and once into a pipe this program drains, as it would be feeding wordsearch, and
+reports words/s for each. Runs from the directory wordgen is built in. */
+
+#define BENCH_SEED "12345"
+#define DRAIN_BYTES (1 << 20)
+
+extern char **environ;
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs wordgen with stdout on /dev/null, or on a pipe read here if drain. Returns the wall time, or -1 if it could not be run.
+double runWordgen(char *words, char *threads, int drain){
+    char *argv[] = {"./wordgen", "--seed", BENCH_SEED, "--threads", threads, words, NULL};
+    posix_spawn_file_actions_t actions;
+    int fds[2];
+    pid_t pid;
+    int status;
+    if(drain && pipe(fds) < 0){
+        fprintf(stderr, "ERROR: Could not create pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    posix_spawn_file_actions_init(&actions);
+    if(drain){
+        posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+        posix_spawn_file_actions_addclose(&actions, fds[0]);
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+    }
+    else{posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);}
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    double start = now();
+    errno = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(errno){
+        fprintf(stderr, "ERROR: Could not run %s: %s\n", argv[0], strerror(errno));
+        return -1;
+    }
+    if(drain){
+        static char buf[DRAIN_BYTES];
+        close(fds[1]);
+        while(read(fds[0], buf, sizeof(buf)) > 0){}
+        close(fds[0]);
+    }
+    waitpid(pid, &status, 0);
+    double elapsed = now() - start;
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "ERROR: wordgen exited with status %d\n", status);
+        return -1;
+    }
+    return elapsed;
+}
+
+int main(int argc, char *argv[]){
+    char *words = argc > 1 ? argv[1] : "100000000";
+    char *defaults[] = {"1", "2", "4"};
+    char **threads = argc > 2 ? argv + 2 : defaults;
+    int nthreads = argc > 2 ? argc - 2 : 3, failures = 0;
+    long count = strtol(words, NULL, 10);
+    const char *sinks[] = {"/dev/null", "pipe"};
+
+    if(access("./wordgen", X_OK) < 0){
+        fprintf(stderr, "ERROR: Run from the directory wordgen was built in (make wordgenbench builds it): %s\n", strerror(errno));
+        return -1;
+    }
+    printf("%ld words:\n", count);
+    for(int t = 0; t < nthreads; t++){
+        for(int s = 0; s < 2; s++){
+            double elapsed = runWordgen(words, threads[t], s);
+            if(elapsed < 0){
+                failures++;
+                continue;
+            }
+            printf("  %s thread(s), %-9s %12.0f words/s  (%.3f s)\n", threads[t], sinks[s], count / elapsed, elapsed);
+            fflush(stdout);
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,431 @@
+# include "words.h"
+# include <stdlib.h>
+# include <string.h>
+# include <errno.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+
+#define LETTERS_PER_DRAW 6 // 26^6 uses 29 of a draw's 64 bits, leaving the letters unbiased to within 2^-30
+
+static uint64_t rotl(uint64_t x, int k){
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t rngNext(struct wordrng *r){
+    uint64_t *s = r->s, result = rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+// splitmix64, the seeding xoshiro's authors recommend, so that nearby seeds start far apart
+static uint64_t splitmix(uint64_t *x){
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void wordSeed(struct wordrng *r, uint64_t seed, unsigned stream){
+    static const uint64_t jump[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+    for(int i = 0; i < 4; i++){r->s[i] = splitmix(&seed);}
+    for(unsigned n = 0; n < stream; n++){
+        uint64_t s[4] = {0, 0, 0, 0};
+        for(int i = 0; i < 4; i++){
+            for(int b = 0; b < 64; b++){
+                if(jump[i] & (1ULL << b)){
+                    for(int j = 0; j < 4; j++){s[j] ^= r->s[j];}
+                }
+                rngNext(r);
+            }
+        }
+        memcpy(r->s, s, sizeof(s));
+    }
+}
+
+// Ranges are taken off the top of a draw by multiplying, which leaves the rest of it for the next: no division
+int randomWord(struct wordrng *r, char *word){
+    unsigned __int128 p = (unsigned __int128)rngNext(r) * (WORD_MAX-WORD_MIN+1);
+    int len = WORD_MIN + (int)(p >> 64);
+    uint64_t x = p;
+    for(int i = 0, left = LETTERS_PER_DRAW; i < len; i++, left--){
+        if(!left){
+            x = rngNext(r);
+            left = LETTERS_PER_DRAW;
+        }
+        p = (unsigned __int128)x * 26;
+        word[i] = 'A' + (int)(p >> 64);
+        x = p;
+    }
+    word[len] = '\0';
+    return len;
+}
+
+long randomLines(struct wordrng *r, char *buf, size_t size, long max, size_t *len){
+    size_t used = 0;
+    long words = 0;
+    while(words < max && used + WORD_MAX + 1 <= size){
+        used += randomWord(r, buf + used);
+        buf[used++] = '\n';
+        words++;
+    }
+    *len = used;
+    return words;
+}
+
+void toUpper(char *dst, const char *str, size_t len){
+    for(size_t i = 0; i < len; i++){
+        if(str[i] >= 'a' && str[i] <= 'z'){dst[i] = str[i]-32;}
+        else{dst[i] = str[i];}
+    }
+}
+
+// FNV-1a, and the length of s as strcmp sees it
+static uint64_t hashWord(const char *s, size_t *len){
+    uint64_t h = 14695981039346656037ULL;
+    const char *p = s;
+    for(; *p; p++){
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ULL;
+    }
+    *len = p - s;
+    return h;
+}
+
+// Spreads every bit of x over the result (the murmur3 finalizer), since FNV's low bits are weak on short words
+static uint64_t mix(uint64_t x){
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// A value below n taken from the top of a 32-bit hash, without a division
+static size_t reduce(uint32_t h, size_t n){
+    return ((uint64_t)h * n) >> 32;
+}
+
+// The perfect hash's placement of a word with hash h in a table of n, for a bucket displaced by displace. The top bit
+// marks a bucket of one word, whose displacement is simply the slot it went in.
+#define DIRECT_SLOT 0x80000000u
+static size_t perfectSlot(uint64_t h, uint32_t displace, size_t n){
+    if(displace & DIRECT_SLOT){return displace & ~DIRECT_SLOT;}
+    return reduce(mix(h ^ (displace * 0x9e3779b97f4a7c15ULL)), n);
+}
+
+static size_t perfectBucket(uint64_t h, size_t nbuckets){
+    return reduce(mix(h) >> 32, nbuckets);
+}
+
+// The hash table slot word (len bytes, hash h) is in, or the empty one it would go in
+static struct dictslot *findSlot(struct dict *d, const char *word, size_t len, uint32_t h){
+    size_t mask = d->capacity - 1;
+    for(size_t i = h & mask;; i = (i + 1) & mask){
+        struct dictslot *slot = &d->slots[i];
+        if(!slot->offset || (slot->hash == h && !memcmp(d->strings + slot->offset, word, len + 1))){return slot;}
+    }
+}
+
+static int dictGrow(struct dict *d){
+    size_t newcap = d->capacity ? d->capacity * 2 : 1024;
+    struct dictslot *old = d->slots;
+    size_t oldcap = d->capacity;
+    if((d->slots = calloc(newcap, sizeof(*d->slots))) == NULL){
+        d->slots = old;
+        return -1;
+    }
+    d->capacity = newcap;
+    for(size_t i = 0; i < oldcap; i++){
+        if(!old[i].offset){continue;}
+        size_t mask = newcap - 1, j = old[i].hash & mask;
+        while(d->slots[j].offset){j = (j + 1) & mask;}
+        d->slots[j] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+// Adds a line as read from the word list. Returns -1 if memory ran out.
+static int dictAdd(struct dict *d, const char *entry){
+    size_t len = strlen(entry);
+    if(d->stringsize + len + 1 > d->stringcap){
+        size_t newcap = d->stringcap < 65536 ? 65536 : d->stringcap;
+        while(newcap < d->stringsize + len + 1){newcap *= 2;}
+        if(newcap > UINT32_MAX){return -1;} // Offsets are 32 bits
+        char *grown = realloc(d->strings, newcap);
+        if(!grown){return -1;}
+        d->strings = grown;
+        d->stringcap = newcap;
+    }
+    // Uppercased into place at the end of strings, where it stays unless it turns out to be there already
+    char *word = d->strings + d->stringsize;
+    toUpper(word, entry, len + 1);
+    uint32_t h = mix(hashWord(word, &len));
+    if(((size_t)d->entries + 1) * 2 > d->capacity && dictGrow(d) < 0){return -1;}
+    struct dictslot *slot = findSlot(d, word, len, h);
+    if(slot->offset){return 0;} // Only the first of the same word ever matched
+    slot->hash = h;
+    slot->offset = d->stringsize;
+    d->stringsize += len + 1;
+    d->entries++;
+    return 0;
+}
+
+// Layout of a file dictSave writes, all in this machine's byte order:
+// header, displace[nbuckets], table[entries], strings[stringsize]
+#define DICT_MAGIC "WSMPH1\n"
+struct dictheader{
+    char magic[8];
+    uint64_t entries, nbuckets, stringsize;
+};
+
+// Maps a file dictSave wrote. Returns 0, 1 if path is not one, or -1 after printing why it could not be used.
+static int dictMap(struct dict *d, int fd, const char *path){
+    struct dictheader h;
+    struct stat st;
+    if(pread(fd, &h, sizeof(h), 0) != sizeof(h) || memcmp(h.magic, DICT_MAGIC, sizeof(h.magic))){
+        errno = 0;
+        return 1;
+    }
+    if(fstat(fd, &st) < 0 || h.stringsize == 0 || h.stringsize > (uint64_t)st.st_size || h.entries > INT32_MAX || h.nbuckets > SIZE_MAX / 8 ||
+       (uint64_t)st.st_size != sizeof(h) + h.nbuckets * 4 + h.entries * sizeof(struct dictslot) + h.stringsize){
+        fprintf(stderr, "Error: %s is not a complete dictionary file\n", path);
+        return -1;
+    }
+    if((d->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+        fprintf(stderr, "Error: Could not map %s: %s\n", path, strerror(errno));
+        d->map = NULL;
+        return -1;
+    }
+    d->mapsize = st.st_size;
+    d->entries = h.entries;
+    d->nbuckets = h.nbuckets;
+    d->displace = (const uint32_t *)((char *)d->map + sizeof(h));
+    d->table = (const struct dictslot *)(d->displace + h.nbuckets);
+    d->strings = (char *)(d->table + h.entries);
+    d->stringsize = h.stringsize;
+    if(d->strings[d->stringsize - 1]){ // Every lookup ends at a terminator, even in a damaged file
+        fprintf(stderr, "Error: %s is not a complete dictionary file\n", path);
+        dictFree(d);
+        return -1;
+    }
+    return 0;
+}
+
+int dictLoad(struct dict *d, const char *path){
+    FILE *dictwords;
+    memset(d, 0, sizeof(*d));
+    if((dictwords = fopen(path, "re"))==NULL){
+        fprintf(stderr, "Error: Could not open file %s for reading\n", path);
+        return -1;
+    }
+    int mapped = dictMap(d, fileno(dictwords), path);
+    if(mapped <= 0){
+        fclose(dictwords);
+        return mapped;
+    }
+    char entry[WORD_LINE];
+    d->stringsize = 1; // Offset 0 marks an empty slot
+    if(dictGrow(d) < 0 || (d->strings = calloc(1, 1)) == NULL){
+        fprintf(stderr, "Error: Could not allocate sufficient memory to dictionary\n");
+        fclose(dictwords);
+        dictFree(d);
+        return -1;
+    }
+    d->stringcap = 1;
+    errno = 0;
+    while(fgets(entry, WORD_LINE, dictwords)){
+        if(dictAdd(d, entry) < 0){
+            fprintf(stderr, "Error: Could not allocate sufficient memory to dictionary\n");
+            fclose(dictwords);
+            dictFree(d);
+            return -1;
+        }
+    }
+    if(errno){
+        fprintf(stderr, "Error: Could not read from file %s\n", path);
+        errno = 0;
+    }
+    fclose(dictwords);
+    return 0;
+}
+
+int dictFind(struct dict *d, const char *candidate){
+    size_t len;
+    uint64_t h = hashWord(candidate, &len);
+    if(d->map){
+        if(!d->entries){return 0;}
+        size_t i = perfectSlot(h, d->displace[perfectBucket(h, d->nbuckets)], d->entries);
+        if(i >= (size_t)d->entries){return 0;} // Only in a damaged file, which is not checked through when mapped
+        const struct dictslot *slot = &d->table[i];
+        return slot->hash == (uint32_t)mix(h) && slot->offset < d->stringsize && !strcmp(d->strings + slot->offset, candidate);
+    }
+    return findSlot(d, candidate, len, mix(h))->offset != 0;
+}
+
+// Places every bucket of words, largest first while the table is emptiest. Returns 0, or -1 if some bucket could
+// not be placed, which only two words with the same 64-bit hash would cause.
+static int buildPerfect(struct dict *d, uint64_t *hashes, uint32_t *offsets, uint32_t *displace, size_t nbuckets, struct dictslot *table){
+    size_t n = d->entries;
+    size_t *start = calloc(nbuckets + 1, sizeof(size_t)), *order = malloc(nbuckets * sizeof(size_t));
+    uint32_t *members = malloc(n * sizeof(uint32_t));
+    char *taken = calloc(n, 1);
+    size_t *slots = NULL, biggest = 0;
+    int result = -1;
+    if(!start || !order || !members || !taken){goto done;}
+    // Counting sort of the words by bucket
+    for(size_t i = 0; i < n; i++){start[perfectBucket(hashes[i], nbuckets) + 1]++;}
+    for(size_t b = 0; b < nbuckets; b++){
+        if(start[b + 1] > biggest){biggest = start[b + 1];}
+        start[b + 1] += start[b];
+    }
+    size_t *fill = malloc(nbuckets * sizeof(size_t)), *bysize = calloc(biggest + 2, sizeof(size_t));
+    slots = malloc((biggest + 1) * sizeof(size_t));
+    if(!fill || !bysize || !slots){
+        free(fill);
+        free(bysize);
+        goto done;
+    }
+    memcpy(fill, start, nbuckets * sizeof(size_t));
+    for(size_t i = 0; i < n; i++){members[fill[perfectBucket(hashes[i], nbuckets)]++] = i;}
+    // And of the buckets by size, largest first
+    for(size_t b = 0; b < nbuckets; b++){bysize[biggest - (start[b + 1] - start[b]) + 1]++;}
+    for(size_t s = 0; s <= biggest; s++){bysize[s + 1] += bysize[s];}
+    for(size_t b = 0; b < nbuckets; b++){order[bysize[biggest - (start[b + 1] - start[b])]++] = b;}
+    free(fill);
+    free(bysize);
+
+    size_t nextfree = 0;
+    for(size_t k = 0; k < nbuckets; k++){
+        size_t b = order[k], size = start[b + 1] - start[b];
+        uint32_t *words = members + start[b];
+        displace[b] = 0;
+        if(size == 0){continue;}
+        if(size == 1){ // Any free slot will do, and there is no need to search for one that hashes there
+            while(taken[nextfree]){nextfree++;}
+            displace[b] = DIRECT_SLOT | nextfree;
+            slots[0] = nextfree;
+        }
+        else{
+            uint32_t tries;
+            for(tries = 0; tries < DIRECT_SLOT; tries++){
+                size_t placed = 0;
+                for(; placed < size; placed++){
+                    slots[placed] = perfectSlot(hashes[words[placed]], tries, n);
+                    if(taken[slots[placed]]){break;}
+                    taken[slots[placed]] = 1; // Held while the rest of the bucket is tried
+                }
+                if(placed == size){break;}
+                while(placed > 0){taken[slots[--placed]] = 0;}
+            }
+            if(tries == DIRECT_SLOT){goto done;}
+            displace[b] = tries;
+        }
+        for(size_t i = 0; i < size; i++){
+            taken[slots[i]] = 1;
+            table[slots[i]].hash = mix(hashes[words[i]]);
+            table[slots[i]].offset = offsets[words[i]];
+        }
+    }
+    result = 0;
+done:
+    free(start);
+    free(order);
+    free(members);
+    free(taken);
+    free(slots);
+    return result;
+}
+
+int dictSave(struct dict *d, const char *path){
+    struct dictheader h;
+    size_t n = d->entries, nbuckets = n / DICT_BUCKET_WORDS + 1;
+    uint64_t *hashes = malloc(n * sizeof(uint64_t) + 1);
+    uint32_t *offsets = malloc(n * sizeof(uint32_t) + 1), *displace = malloc(nbuckets * sizeof(uint32_t));
+    struct dictslot *table = calloc(n + 1, sizeof(struct dictslot));
+    int result = -1;
+    if(d->map){
+        fprintf(stderr, "Error: Dictionary is already a saved one\n");
+        goto done;
+    }
+    if(!hashes || !offsets || !displace || !table){
+        fprintf(stderr, "Error: Could not allocate memory to build dictionary file\n");
+        goto done;
+    }
+    for(size_t i = 0, w = 0; i < d->capacity; i++){
+        size_t len;
+        if(!d->slots[i].offset){continue;}
+        offsets[w] = d->slots[i].offset;
+        hashes[w++] = hashWord(d->strings + d->slots[i].offset, &len);
+    }
+    if(buildPerfect(d, hashes, offsets, displace, nbuckets, table) < 0){
+        fprintf(stderr, "Error: Could not build a perfect hash of the dictionary\n");
+        goto done;
+    }
+    FILE *f = fopen(path, "we");
+    if(!f){
+        fprintf(stderr, "Error: Could not open file %s for writing: %s\n", path, strerror(errno));
+        goto done;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DICT_MAGIC, sizeof(h.magic));
+    h.entries = n;
+    h.nbuckets = nbuckets;
+    h.stringsize = d->stringsize;
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(displace, sizeof(uint32_t), nbuckets, f);
+    fwrite(table, sizeof(struct dictslot), n, f);
+    fwrite(d->strings, 1, d->stringsize, f);
+    int failed = ferror(f);
+    if(fclose(f) == EOF || failed){
+        fprintf(stderr, "Error: Could not write to file %s: %s\n", path, strerror(errno));
+        goto done;
+    }
+    result = 0;
+done:
+    free(hashes);
+    free(offsets);
+    free(displace);
+    free(table);
+    errno = 0;
+    return result;
+}
+
+void dictFree(struct dict *d){
+    if(d->map){munmap(d->map, d->mapsize);}
+    else{
+        free(d->strings);
+        free(d->slots);
+    }
+    memset(d, 0, sizeof(*d));
+}
+
+void pagerInit(struct pager *p){
+    p->term = fopen("/dev/tty", "re");
+    p->linesread = 0;
+    errno = 0;
+}
+
+int pagerLine(struct pager *p, const char *line){
+    printf("%s",line);
+    if(!p->term){return 0;} // Nobody to prompt, so everything goes straight through
+    if(++p->linesread >= PAGER_LINES){
+        int cmd;
+        printf("---Press RETURN for more---");
+        fflush(stdout);
+        while((cmd = fgetc(p->term)) != '\n' && cmd != 'q' && cmd != 'Q' && cmd != EOF){}
+        if(cmd == 'q' || cmd == 'Q' || cmd == EOF){
+            printf("*** Pager terminated by Q command ***\n");
+            return 1;
+        }
+        p->linesread = 0;
+    }
+    return 0;
+}
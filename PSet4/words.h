@@ -0,0 +1,99 @@
+#ifndef _WORDS_H
+#define _WORDS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Pieces wordgen, wordsearch and pager share with launcher's threaded mode, so both modes behave exactly alike
+
+#define WORD_MIN 3
+#define WORD_MAX 10
+#define WORD_LINE 4096 // Longest line read at once, as with fgets into the programs' 4096 byte buffers
+#define PAGER_LINES 23
+#define DICT_BUCKET_WORDS 4
+
+// xoshiro256** state. wordgen's threads and launcher's generator each draw from one of these.
+struct wordrng{
+    uint64_t s[4];
+};
+
+void wordSeed(struct wordrng *r, uint64_t seed, unsigned stream);
+/* Seeds r from seed, then jumps it ahead stream times 2^128 draws, so each
+* stream of the same seed is independent of the others and never overlaps
+* them. The same seed and stream always give the same words.
+*/
+
+int randomWord(struct wordrng *r, char *word);
+/* Writes a word of WORD_MIN to WORD_MAX uppercase letters to word (which
+* must have room for WORD_MAX + 1 bytes), null-terminated and without a
+* newline, and returns its length.
+*/
+
+long randomLines(struct wordrng *r, char *buf, size_t size, long max, size_t *len);
+/* Fills buf with words from randomWord a line each, as many as fit in size
+* bytes but no more than max. Sets *len to the bytes written and returns
+* the words.
+*/
+
+// Slot of a dictionary hash table: the word's hash, checked before the word itself is compared, and where it starts
+struct dictslot{
+    uint32_t hash;
+    uint32_t offset; // Into strings, 0 for an empty slot
+};
+
+// Dictionary words packed one after another, null-terminated, in strings. They are found either through an
+// open-addressing hash table built as a word list is read, or through a minimal perfect hash mapped from a file
+// dictSave wrote.
+struct dict{
+    char *strings;
+    size_t stringsize, stringcap;
+    int entries; // Distinct words
+    struct dictslot *slots; // Hash table, a power of two in size and never more than half full
+    size_t capacity;
+    const uint32_t *displace; // Minimal perfect hash: per bucket, how its words were placed in table
+    size_t nbuckets;
+    const struct dictslot *table; // Minimal perfect hash: exactly entries slots
+    void *map; // The mapped file the perfect hash is in
+    size_t mapsize;
+};
+
+int dictLoad(struct dict *d, const char *path);
+/* Reads path into d. A word list is read a line at a time, each line
+* uppercased by toUpper with its newline kept, as wordsearch always has. A
+* file written by dictSave is mapped instead, with nothing to read or hash.
+* Returns 0, or -1 after printing why not.
+*/
+
+int dictFind(struct dict *d, const char *candidate);
+/* 1 if candidate, a line as read (newline included) and not uppercased, is
+* in d: exactly the words strcmp would find equal to it.
+*/
+
+int dictSave(struct dict *d, const char *path);
+/* Builds a minimal perfect hash of d's words (hash and displace, with
+* DICT_BUCKET_WORDS words per bucket on average) and writes it with the
+* words to path, for dictLoad to map. Returns 0, or -1 after printing why
+* not.
+*/
+
+void dictFree(struct dict *d);
+
+void toUpper(char *dst, const char *str, size_t len);
+/* Copies len bytes of str to dst with a-z made uppercase.
+*/
+
+struct pager{
+    FILE *term; // Where the answers to the prompt come from, NULL if there is no terminal to ask
+    int linesread;
+};
+
+void pagerInit(struct pager *p);
+
+int pagerLine(struct pager *p, const char *line);
+/* Prints line to stdout, and after every PAGER_LINES lines prompts and waits
+* for RETURN, q or Q on /dev/tty. Without a terminal lines are passed
+* straight through. Returns 1 if the user quit, after saying so.
+*/
+
+#endif
@@ -7,20 +7,29 @@
 # include <setjmp.h>
 # include <sys/signal.h>
 # include <sys/types.h>
+# include <pthread.h>
+# include "words.h"
+# include "acmatch.h"
+# include "spsc.h"
 
 // wordsearch.c
 // By: Jeffrey Wong
 /* The program accepts one file as an argument and reads in one line at a time
 from that file, adding each line as an entry to a dictionary. It then reads lines
 from standard input to see if the line matches any entry in the dictionary, then
-prints out the number of matches found. */
+prints out the number of matches found. With -o FILE the dictionary is instead
+written to FILE as a minimal perfect hash, which a later run can be given in place
+of the word list to start without reading or hashing it. With -s every dictionary
+word occurring anywhere in the input, not just as a whole line, is found: standard
+input is read in large blocks through an Aho-Corasick automaton, and each match is
+printed as the byte offset it starts at and the word. With -j N the lines are
+matched by N threads: one reads standard input in line-aligned chunks, which are
+dealt in turn to the matchers and written back out in input order, or with -u in
+whatever order they finish. The output is otherwise the same as with one thread. */
 
-// Struct definitions
-struct dict{
-    char **validwords;
-    int entries;
-    int capacity;
-};
+#define STREAM_BLOCK (1 << 20)
+#define CHUNK_BYTES (1 << 18)
+#define CHUNKS_PER_MATCHER 4
 
 // Global variables
 
@@ -32,63 +41,296 @@ void pipeHandler(int sn){
     longjmp(int_jb,1);
 }
 
+// -s: finds every occurrence of every word in standard input. Returns the number found, or -1 if it could not start.
+// SIGPIPE is ignored rather than jumped out of, so a reader going away is seen as a write error after the block.
+long long streamSearch(struct dict *dictionary){
+    struct acmatch matcher;
+    char *block;
+    long long found = 0;
+    unsigned long long offset = 0;
+    uint32_t state = 0;
+    ssize_t n;
+    if(acBuild(&matcher, dictionary) < 0){return -1;}
+    if((block = malloc(STREAM_BLOCK)) == NULL){
+        fprintf(stderr, "Error: Could not allocate memory to read into\n");
+        acFree(&matcher);
+        return -1;
+    }
+    setvbuf(stdout, NULL, _IOFBF, STREAM_BLOCK);
+    signal(SIGPIPE, SIG_IGN);
+    while((n = read(STDIN_FILENO, block, STREAM_BLOCK)) != 0){
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            fprintf(stderr, "Error: Could not read from standard input: %s\n", strerror(errno));
+            break;
+        }
+        found += acScan(&matcher, &state, block, n, offset, stdout);
+        offset += n;
+        if(ferror(stdout)){break;}
+    }
+    fflush(stdout);
+    errno = 0;
+    free(block);
+    acFree(&matcher);
+    return found;
+}
 
-char* toUpper(char *str){
-    char temp[strlen(str)+1];
-    for(int i = 0; i < strlen(str); i++){
-        if(str[i] >= 'a' && str[i] <= 'z'){temp[i] = str[i]-32;}
-        else{temp[i] = str[i];}
+// Lines for a matcher, which leaves only the ones that matched
+struct chunk{
+    size_t len;
+    char data[CHUNK_BYTES + 1]; // The extra byte lets the last line be terminated in place
+};
+
+// One matcher thread. Chunk k of the input goes to matcher k % N, so taking them back from each matcher in the
+// same turn puts them back in input order. Each ring has a single producer and a single consumer:
+// todo from the reader, done to the writer, and free back to the reader from the writer (or the matcher itself with -u).
+struct matcher{
+    struct spsc todo, done, free;
+    struct chunk *chunks;
+    pthread_t thread;
+    struct parallel *p;
+    long matches __attribute__((aligned(64))); // Its own line, so that counting does not bounce between CPUs
+};
+
+struct parallel{
+    struct dict *dictionary;
+    struct matcher *matchers;
+    int nmatchers;
+    int unordered;
+    pthread_mutex_t writelock; // -u: matchers writing their own chunks take turns
+    int quit; // Whatever reads our output has gone
+};
+
+// Writes all of len bytes of buf to stdout. Returns 0, or -1 if it could not.
+int writeAll(const char *buf, size_t len){
+    while(len > 0){
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if(n < 0){
+            if(errno == EINTR){continue;}
+            return -1;
+        }
+        buf += n;
+        len -= n;
     }
-    temp[strlen(str)]='\0'; // Null terminate string
-    char *result = strdup(temp);
-    return result;
+    return 0;
 }
 
-int main(int argc, char **argv){
-    // Initialize Dictionary
-    struct dict dictionary;
-    dictionary.entries = 0;
-    dictionary.capacity = 10;
-    dictionary.validwords = malloc(dictionary.capacity * sizeof (char*));
+// Stops every thread, as SIGPIPE stops the single-threaded loop
+void parallelQuit(struct parallel *p){
+    __atomic_store_n(&p->quit, 1, __ATOMIC_SEQ_CST);
+    for(int i = 0; i < p->nmatchers; i++){
+        spscClose(&p->matchers[i].todo);
+        spscClose(&p->matchers[i].done);
+        spscClose(&p->matchers[i].free);
+    }
+}
 
-    // Open file for reading
-    if(argc < 2){
-        fprintf(stderr, "Error: Not enough arguments supplied to wordsearch.\n");
+// Where the lines of data end, in pieces as fgets would read them: after the last newline, and then after as many
+// whole WORD_LINE - 1 bytes of a longer line as there are. Less than WORD_LINE is left over.
+size_t chunkCut(const char *data, size_t len){
+    size_t line = len;
+    while(line > 0 && data[line - 1] != '\n'){line--;}
+    return line + (len - line) / (WORD_LINE - 1) * (WORD_LINE - 1);
+}
+
+// Splits standard input into chunks of whole lines and deals them out in turn
+void *readerThread(void *arg){
+    struct parallel *p = arg;
+    char carry[WORD_LINE]; // What followed the last whole line, for the start of the next chunk
+    size_t carried = 0;
+    int eof = 0;
+    for(long k = 0; !eof; k++){
+        struct matcher *m = &p->matchers[k % p->nmatchers];
+        struct chunk *c = spscPop(&m->free);
+        if(!c){return NULL;}
+        memcpy(c->data, carry, carried);
+        c->len = carried;
+        for(;;){ // Until the chunk has a line in it, so as to pass lines on as soon as they come
+            ssize_t n = read(STDIN_FILENO, c->data + c->len, CHUNK_BYTES - c->len);
+            if(n < 0 && errno == EINTR){continue;}
+            if(n < 0){fprintf(stderr, "Error: Could not read from standard input: %s\n", strerror(errno));}
+            if(n <= 0){
+                eof = 1;
+                carried = 0;
+                break;
+            }
+            c->len += n;
+            size_t cut = chunkCut(c->data, c->len);
+            if(cut > 0){
+                carried = c->len - cut;
+                memcpy(carry, c->data + cut, carried);
+                c->len = cut;
+                break;
+            }
+        }
+        if(spscPush(&m->todo, c) < 0){return NULL;}
+    }
+    for(int i = 0; i < p->nmatchers; i++){spscClose(&p->matchers[i].todo);}
+    return NULL;
+}
+
+// Keeps the lines of c that are in the dictionary, packed at its start. They are split as fgets would have.
+void matchChunk(struct matcher *m, struct chunk *c){
+    char *line = c->data, *end = c->data + c->len, *out = c->data;
+    while(line < end){
+        size_t most = end - line < WORD_LINE - 1 ? end - line : WORD_LINE - 1;
+        char *newline = memchr(line, '\n', most);
+        char *next = newline ? newline + 1 : line + most;
+        char saved = *next;
+        *next = '\0';
+        if(dictFind(m->p->dictionary, line)){
+            size_t len = strlen(line); // Stops at a null byte in the line, as printf's %s did
+            memmove(out, line, len);
+            out += len;
+            m->matches++;
+        }
+        *next = saved;
+        line = next;
+    }
+    c->len = out - c->data;
+}
+
+void *matcherThread(void *arg){
+    struct matcher *m = arg;
+    struct parallel *p = m->p;
+    struct chunk *c;
+    while((c = spscPop(&m->todo))){
+        matchChunk(m, c);
+        if(!p->unordered){
+            if(spscPush(&m->done, c) < 0){break;}
+            continue;
+        }
+        pthread_mutex_lock(&p->writelock);
+        int failed = !__atomic_load_n(&p->quit, __ATOMIC_SEQ_CST) && writeAll(c->data, c->len) < 0;
+        pthread_mutex_unlock(&p->writelock);
+        if(failed){parallelQuit(p);}
+        if(spscPush(&m->free, c) < 0){break;}
+    }
+    spscClose(&m->done);
+    return NULL;
+}
+
+// Takes chunks back from the matchers in the turn they were dealt and writes them out
+void writerStage(struct parallel *p){
+    for(long k = 0;; k++){
+        struct matcher *m = &p->matchers[k % p->nmatchers];
+        struct chunk *c = spscPop(&m->done);
+        if(!c){return;} // Every chunk before this one has been written, and there are none after it
+        if(writeAll(c->data, c->len) < 0){
+            parallelQuit(p);
+            return;
+        }
+        spscPush(&m->free, c);
+    }
+}
+
+// -j: the lines of standard input matched by nmatchers threads. Returns the number that matched, or -1 if it could
+// not start. After an early quit the reader is not waited for, since it may be blocked reading input nobody wants
+// any more, and what it might still be using is left for the exit to reclaim.
+long long parallelSearch(struct dict *dictionary, int nmatchers, int unordered){
+    static struct parallel p;
+    pthread_t reader;
+    long long matched = 0;
+    p.dictionary = dictionary;
+    p.nmatchers = nmatchers;
+    p.unordered = unordered;
+    pthread_mutex_init(&p.writelock, NULL);
+    if((p.matchers = aligned_alloc(64, nmatchers * sizeof(struct matcher))) == NULL){
+        fprintf(stderr, "Error: Could not allocate memory for matchers\n");
         return -1;
     }
-    FILE *dictwords;
-    if((dictwords = fopen(argv[1], "r"))==NULL){
-        fprintf(stderr, "Error: Could not open file %s for reading\n", argv[1]);
+    for(int i = 0; i < nmatchers; i++){
+        struct matcher *m = &p.matchers[i];
+        memset(m, 0, sizeof(*m));
+        m->p = &p;
+        spscInit(&m->todo);
+        spscInit(&m->done);
+        spscInit(&m->free);
+        if((m->chunks = malloc(CHUNKS_PER_MATCHER * sizeof(struct chunk))) == NULL){
+            fprintf(stderr, "Error: Could not allocate memory for matchers\n");
+            return -1;
+        }
+        for(int j = 0; j < CHUNKS_PER_MATCHER; j++){spscPush(&m->free, &m->chunks[j]);}
+    }
+    signal(SIGPIPE, SIG_IGN); // A reader that has gone away shows up as a write error instead
+    for(int i = 0; i < nmatchers; i++){
+        if((errno = pthread_create(&p.matchers[i].thread, NULL, matcherThread, &p.matchers[i]))){
+            fprintf(stderr, "Error occured while attempting to start thread: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    if((errno = pthread_create(&reader, NULL, readerThread, &p))){
+        fprintf(stderr, "Error occured while attempting to start thread: %s\n", strerror(errno));
         return -1;
     }
+    pthread_detach(reader);
+    if(!unordered){writerStage(&p);}
+    for(int i = 0; i < nmatchers; i++){
+        pthread_join(p.matchers[i].thread, NULL);
+        matched += p.matchers[i].matches;
+    }
+    if(!p.quit){ // The reader closed the matchers' rings as its last act, so it is done with everything
+        for(int i = 0; i < nmatchers; i++){free(p.matchers[i].chunks);}
+        free(p.matchers);
+        dictFree(dictionary);
+    }
+    errno = 0;
+    return matched;
+}
 
-    char entry[4096];
-    while(fgets(entry, 4096, dictwords)){
-        if(dictionary.entries >= dictionary.capacity){
-            dictionary.capacity *= 2; 
-            if((dictionary.validwords = realloc(dictionary.validwords, dictionary.capacity * sizeof (char*))) == NULL){
-                fprintf(stderr, "Error: Could not allocate sufficient memory to dictionary\n");
+int main(int argc, char **argv){
+    char *savepath = NULL;
+    int opt;
+    int stream = 0, nmatchers = 0, unordered = 0;
+    while((opt = getopt(argc, argv, "o:sj:u")) != -1){
+        if(opt == 'o'){savepath = optarg;}
+        else if(opt == 's'){stream = 1;}
+        else if(opt == 'j'){
+            if((nmatchers = atoi(optarg)) < 1){
+                fprintf(stderr, "Error: Number of matchers must be positive\n");
                 return -1;
             }
         }
-        char *entryUpper = toUpper(entry);
-        dictionary.validwords[dictionary.entries] = entryUpper;
-        dictionary.entries++;
+        else if(opt == 'u'){unordered = 1;}
+        else{
+            fprintf(stderr, "Usage: wordsearch [-s | -j N [-u]] [-o dict.mph] dictfile\n");
+            return -1;
+        }
+    }
+    // Open file for reading
+    if(optind >= argc){
+        fprintf(stderr, "Error: Not enough arguments supplied to wordsearch.\n");
+        return -1;
     }
-    if(errno){
-        fprintf(stderr, "Error: Could not read from file %s\n", argv[1]);
+    struct dict dictionary;
+    if(dictLoad(&dictionary, argv[optind]) < 0){return -1;}
+    if(savepath){
+        int saved = dictSave(&dictionary, savepath);
+        if(!saved){fprintf(stderr, "Saved %d words to %s\n", dictionary.entries, savepath);}
+        dictFree(&dictionary);
+        return saved;
+    }
+    if(stream){
+        long long found = streamSearch(&dictionary);
+        dictFree(&dictionary);
+        if(found < 0){return -1;}
+        fprintf(stderr, "Found %lld matches\n", found);
+        return 0;
+    }
+    if(nmatchers){ // Frees the dictionary itself, when it can
+        long long matched = parallelSearch(&dictionary, nmatchers, unordered);
+        if(matched < 0){return -1;}
+        fprintf(stderr, "Matched %lld words\n", matched);
+        return 0;
     }
 
-    char candidate[4096];
+    char candidate[WORD_LINE];
     int numMatches = 0;
     signal(SIGPIPE, pipeHandler);
-    while(fgets(candidate, 4096, stdin)){
-        for(int i = 0; i < dictionary.entries; i++){
-            if(!strcmp(candidate,dictionary.validwords[i])){
-                printf("%s",candidate);
-                numMatches++;
-                break; // We'll just check for the first match. Ignore redundancy
-            }
+    while(fgets(candidate, WORD_LINE, stdin)){
+        if(dictFind(&dictionary, candidate)){
+            printf("%s",candidate);
+            numMatches++;
         }
         /* Check after each word if there is a SIGPIPE to handle. Since we exit immediately after SIGPIPE and the below cleanup,
         the fact that the mask is set after the longjmp is actually a good thing. */
@@ -96,7 +338,7 @@ int main(int argc, char **argv){
             break;
         }
     }
-    free(dictionary.validwords); // Memory cleanup
+    dictFree(&dictionary); // Memory cleanup
     fprintf(stderr, "Matched %d words\n", numMatches);
     return 0;
 }
\ No newline at end of file